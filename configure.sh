@@ -22,6 +22,8 @@ usage() {
 	  --crypto-ld-flags            Args to pass to linker for the crypto LIB
 	  --no-colours                 Don't colourize log ouputs
 	  --static-pd                  Setup PD single statically
+	  --cp-workers                 Service independent CP channels from worker threads
+	  --capture-writer             Background pcapng packet capture writer
 	  --lib-only                   Only build the library
 	  --cross-compile PREFIX       Use to pass a compiler prefix
 	  --prefix PATH                Install path prefix (default: /usr)
@@ -47,6 +49,8 @@ while [ $# -gt 0 ]; do
 	--crypto-ld-flags)     CRYPTO_LD_FLAGS=$2; shift;;
 	--no-colours)          NO_COLOURS=1;;
 	--static-pd)           STATIC_PD=1;;
+	--cp-workers)          CP_WORKERS=1;;
+	--capture-writer)      CAPTURE_WRITER=1;;
 	--lib-only)            LIB_ONLY=1;;
 	--build-dir)           BUILD_DIR=$2; shift;;
 	-d|--debug)            DEBUG=1;;
@@ -140,9 +144,9 @@ if [[ ! -z "${CRYPTO_LD_FLAGS}" ]]; then
 fi
 
 ## Declare sources
-LIBOSDP_SOURCES+=" src/osdp_common.c src/osdp_phy.c src/osdp_sc.c src/osdp_file.c src/osdp_pd.c"
+LIBOSDP_SOURCES+=" src/osdp_common.c src/osdp_crc.c src/osdp_phy.c src/osdp_sc.c src/osdp_file.c src/osdp_pd.c"
 LIBOSDP_SOURCES+=" utils/src/list.c utils/src/queue.c utils/src/slab.c utils/src/utils.c"
-LIBOSDP_SOURCES+=" utils/src/disjoint_set.c utils/src/logger.c utils/src/crc16.c"
+LIBOSDP_SOURCES+=" utils/src/disjoint_set.c utils/src/logger.c"
 
 UTILS_SOURCES+=" utils/src/workqueue.c utils/src/circbuf.c utils/src/event.c utils/src/fdutils.c"
 
@@ -150,8 +154,19 @@ if [[ ! -z "${PACKET_TRACE}" ]] || [[ ! -z "${DATA_TRACE}" ]]; then
 	LIBOSDP_SOURCES+=" src/osdp_diag.c utils/src/pcap_gen.c"
 fi
 
+if [[ ! -z "${CAPTURE_WRITER}" ]]; then
+	CCFLAGS+=" -DOPT_OSDP_CAPTURE_WRITER"
+	LIBOSDP_SOURCES+=" src/osdp_capture.c"
+	LDFLAGS+=" -lpthread"
+fi
+
 if [[ -z "${STATIC_PD}" ]]; then
 	LIBOSDP_SOURCES+=" src/osdp_cp.c"
+	if [[ ! -z "${CP_WORKERS}" ]]; then
+		CCFLAGS+=" -DOPT_OSDP_CP_WORKERS"
+		LIBOSDP_SOURCES+=" src/osdp_cp_worker.c"
+		LDFLAGS+=" -lpthread"
+	fi
 	TARGETS="cp_app pd_app"
 else
 	TARGETS="pd_app"
@@ -165,6 +180,15 @@ TEST_SOURCES+=" tests/unit-tests/test-cp-fsm.c"
 TEST_SOURCES+=" tests/unit-tests/test-file.c"
 TEST_SOURCES+=" tests/unit-tests/test-async-fuzz.c"
 TEST_SOURCES+=" tests/unit-tests/test-hotplug.c"
+TEST_SOURCES+=" tests/unit-tests/test-cp-workers.c"
+TEST_SOURCES+=" tests/unit-tests/test-channel-owner.c"
+TEST_SOURCES+=" tests/unit-tests/test-offline-probe.c"
+TEST_SOURCES+=" tests/unit-tests/test-cmd-pool.c"
+TEST_SOURCES+=" tests/unit-tests/test-cmd-priority.c"
+TEST_SOURCES+=" tests/unit-tests/test-cmd-coalesce.c"
+TEST_SOURCES+=" tests/unit-tests/test-cmd-submit.c"
+TEST_SOURCES+=" tests/unit-tests/test-event-queue.c"
+TEST_SOURCES+=" tests/unit-tests/test-pd-add-remove.c"
 TEST_SOURCES+=" ${LIBOSDP_SOURCES} ${UTILS_SOURCES}"
 
 if [[ ! -z "${LIB_ONLY}" ]]; then
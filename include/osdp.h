@@ -256,6 +256,132 @@ struct osdp_pd_id {
 	uint32_t firmware_version; /**< 3-byte version (major, minor, build) */
 };
 
+/**
+ * @brief State of a PD as last seen by the CP. See osdp_cp_get_pd_snapshot().
+ */
+struct osdp_pd_snapshot {
+	uint32_t version;     /**< Changes each time the snapshot is updated */
+	bool online;          /**< PD is online */
+	bool sc_active;       /**< PD has an active secure channel */
+	bool enabled;         /**< PD is enabled; see osdp_cp_disable_pd() */
+	int last_seen_ms;     /**< Time since the last valid reply; -1 if none */
+	struct osdp_pd_id id; /**< PD ID information that the PD last returned */
+	/** PD capabilities indexed by function code */
+	struct osdp_pd_cap cap[OSDP_PD_CAP_SENTINEL];
+};
+
+/**
+ * @brief Protocol counters of a PD. See osdp_get_pd_stats().
+ *
+ * In CP mode, these count the traffic between the CP and the PD; in PD mode,
+ * they count the traffic of the PD itself. All counters wrap around on
+ * overflow.
+ */
+struct osdp_pd_stats {
+	uint32_t tx_packets;      /**< Packets sent */
+	uint32_t tx_bytes;        /**< Bytes sent (including MARK byte) */
+	uint32_t rx_packets;      /**< Complete packets received (valid or not) */
+	uint32_t rx_bytes;        /**< Bytes read from the channel */
+	uint32_t crc_errors;      /**< Packets dropped due to a bad CRC-16 */
+	uint32_t checksum_errors; /**< Packets dropped due to a bad checksum */
+	/** NAKs received (CP) or sent (PD); indexed by osdp_pd_nak_code_e */
+	uint32_t naks[OSDP_PD_NAK_SENTINEL];
+	uint32_t retries;         /**< Commands sent again (CP only) */
+	uint32_t timeouts;        /**< Replies not received in time (CP only) */
+	uint32_t busy;            /**< BUSY replies received (CP only) */
+	uint32_t sc_handshakes;   /**< Secure channel handshakes started */
+	uint32_t sc_failures;     /**< Secure channel handshakes that failed */
+	uint32_t mac_failures;    /**< Packets dropped due to an invalid MAC */
+	uint32_t scan_skip_bytes; /**< Bytes skipped while looking for SOM */
+	uint32_t rx_overflows;    /**< Times the RX ring buffer overflowed */
+};
+
+/**
+ * @brief Number of packets kept in the flight recorder of each PD. See
+ * osdp_get_flight_recorder().
+ */
+#define OSDP_FLIGHT_RECORDER_DEPTH 16
+
+/**
+ * @brief Number of bytes of each packet kept in the flight recorder.
+ */
+#define OSDP_FLIGHT_RECORDER_SNAPLEN 64
+
+/**
+ * @brief Largest pcap file image of a flight recorder; a 24 byte file header
+ * and a 16 byte header per packet.
+ */
+#define OSDP_FLIGHT_RECORDER_PCAP_MAX \
+	(24 + OSDP_FLIGHT_RECORDER_DEPTH * (16 + OSDP_FLIGHT_RECORDER_SNAPLEN))
+
+/**
+ * @brief Incidents after which the flight recorder of a PD is handed to the
+ * app. See osdp_set_flight_recorder_callback().
+ */
+enum osdp_flight_recorder_trigger_e {
+	OSDP_FLIGHT_RECORDER_PD_OFFLINE, /**< CP mode; PD went offline */
+	OSDP_FLIGHT_RECORDER_SC_FAILURE, /**< Secure channel setup failed */
+	OSDP_FLIGHT_RECORDER_SENTINEL    /**< Max value of this enum */
+};
+
+/**
+ * @brief Callback for the flight recorder of a PD after an incident.
+ *
+ * @param arg Opaque pointer provided by the application during callback
+ *            registration.
+ * @param pd PD offset (0-indexed) of this PD in `osdp_pd_info_t *` passed to
+ * osdp_cp_setup(); 0 in PD mode.
+ * @param trigger What happened; one of enum osdp_flight_recorder_trigger_e
+ * @param buf The last packets sent and received as a pcap file image. Only
+ * valid during this call.
+ * @param len Length of buf
+ */
+typedef void (*osdp_flight_recorder_callback_t)(void *arg, int pd, int trigger,
+						const uint8_t *buf, int len);
+
+/**
+ * @brief Settings of the background packet capture writer. See
+ * osdp_capture_start().
+ */
+struct osdp_capture_config {
+	/**
+	 * Path prefix of the capture files; each file is named
+	 * `<path>-<N>.pcapng` where N starts at 0 and goes up by one each
+	 * time the file is rotated.
+	 */
+	const char *path;
+	/** Start a new file once the current one is this large; 0: no limit */
+	uint32_t max_file_size;
+	/** Start a new file once the current one is this old; 0: no limit */
+	uint32_t max_file_age_sec;
+};
+
+/**
+ * @brief Groups of commands for which the CP keeps reply latency histograms.
+ * See osdp_cp_get_cmd_latency().
+ */
+enum osdp_cmd_latency_e {
+	OSDP_CMD_LATENCY_POLL,      /**< osdp_POLL */
+	OSDP_CMD_LATENCY_OUTPUT,    /**< osdp_OUT */
+	OSDP_CMD_LATENCY_LED,       /**< osdp_LED */
+	OSDP_CMD_LATENCY_FILE_TX,   /**< osdp_FILETRANSFER */
+	OSDP_CMD_LATENCY_SC_CHLNG,  /**< osdp_CHLNG; first SC handshake step */
+	OSDP_CMD_LATENCY_SC_SCRYPT, /**< osdp_SCRYPT; second SC handshake step */
+	OSDP_CMD_LATENCY_OTHER,     /**< All other commands */
+	OSDP_CMD_LATENCY_SENTINEL   /**< Max value of this enum */
+};
+
+/**
+ * @brief Latency from sending a command to receiving a valid reply for it,
+ * including any retries in between. See osdp_cp_get_cmd_latency().
+ */
+struct osdp_cmd_latency {
+	uint32_t count;  /**< Number of commands that got a valid reply */
+	uint32_t p50_ms; /**< Median latency (in milliseconds) */
+	uint32_t p99_ms; /**< 99th percentile latency (in milliseconds) */
+	uint32_t max_ms; /**< Largest latency seen (in milliseconds) */
+};
+
 /**
  * @brief pointer to function that copies received bytes into buffer. This
  * function should be non-blocking.
@@ -269,6 +395,33 @@ struct osdp_pd_id {
  */
 typedef int (*osdp_read_fn_t)(void *data, uint8_t *buf, int maxlen);
 
+/**
+ * @brief A region of memory for vectored channel I/O
+ */
+struct osdp_iovec {
+	uint8_t *buf; /**< Start of the region */
+	int len;      /**< Size of the region in bytes */
+};
+
+/**
+ * @brief pointer to function that receives bytes straight into LibOSDP's RX
+ * buffer (scatter read). This function should be non-blocking.
+ *
+ * LibOSDP hands out the free space of its RX buffer as `iovcnt` regions that
+ * must be filled in order; ie., the second region is written only after the
+ * first one is full. This maps directly on to readv(2) and to DMA/ISR
+ * drivers that can deposit bytes into the caller's memory.
+ *
+ * @param data for use by underlying layers. osdp_channel::data is passed
+ * @param iov regions to fill
+ * @param iovcnt number of entries in `iov` (1 or 2)
+ *
+ * @retval +ve: total number of bytes received. Must be <= sum of lengths
+ * @retval -ve on errors
+ */
+typedef int (*osdp_readv_fn_t)(void *data, const struct osdp_iovec *iov,
+			       int iovcnt);
+
 /**
  * @brief pointer to function that sends byte array into some channel. This
  * function should be non-blocking.
@@ -288,6 +441,25 @@ typedef int (*osdp_read_fn_t)(void *data, uint8_t *buf, int maxlen);
  */
 typedef int (*osdp_write_fn_t)(void *data, uint8_t *buf, int len);
 
+/**
+ * @brief pointer to function that sends the contents of multiple buffers as
+ * one contiguous byte stream (gather write). This function should be
+ * non-blocking.
+ *
+ * An OSDP packet may be handed out in more than one piece (for instance, when
+ * a file transfer chunk is sent directly from the application's memory).
+ * This maps directly on to writev(2).
+ *
+ * @param data for use by underlying layers. osdp_channel::data is passed
+ * @param iov regions to send, in order
+ * @param iovcnt number of entries in `iov`
+ *
+ * @retval +ve: total number of bytes sent. Must be <= sum of lengths
+ * @retval -ve on errors
+ */
+typedef int (*osdp_writev_fn_t)(void *data, const struct osdp_iovec *iov,
+				int iovcnt);
+
 /**
  * @brief pointer to function that drops all bytes in TX/RX fifo. This
  * function should be non-blocking.
@@ -337,6 +509,18 @@ struct osdp_channel {
 	 * Pointer to function used to close the channel (optional)
 	 */
 	osdp_close_fn_t close;
+	/**
+	 * Pointer to function used to receive osdp packet data directly into
+	 * LibOSDP's RX buffer (optional). When set, it is used instead of
+	 * `recv`, which may then be left NULL.
+	 */
+	osdp_readv_fn_t recvv;
+	/**
+	 * Pointer to function used to send osdp packet data from multiple
+	 * buffers in one go (optional). When set, it is used instead of
+	 * `send`, which may then be left NULL.
+	 */
+	osdp_writev_fn_t sendv;
 };
 
 /**
@@ -731,6 +915,36 @@ enum osdp_cmd_e {
  */
 #define OSDP_CMD_FLAG_BROADCAST 0x000000001
 
+/**
+ * @brief Queue this command ahead of all normal priority commands and file
+ * transfer chunks. Meant for latency sensitive commands such as an
+ * OSDP_CMD_OUTPUT that drives a door strike.
+ */
+#define OSDP_CMD_FLAG_PRIO_URGENT 0x000000002
+
+/**
+ * @brief Send this command only when no urgent or normal priority commands are
+ * pending for the PD. Meant for cosmetic commands (LED, TEXT, etc.,).
+ */
+#define OSDP_CMD_FLAG_PRIO_BACKGROUND 0x000000004
+
+/**
+ * @brief Fold this command into a still-queued command of the same kind and
+ * target instead of queuing it behind that one, so that only the latest state
+ * reaches the PD. Applies to the last-writer-wins commands:
+ *   - OSDP_CMD_LED: same reader and LED number. The temporary and permanent
+ *     parts are merged separately; a part with control code 0 (NOP) leaves
+ *     the queued one in place.
+ *   - OSDP_CMD_TEXT: same reader, row and column. Only replaces queued text of
+ *     the same kind (temporary or permanent) that is not longer than this one.
+ *   - OSDP_CMD_BUZZER: same reader
+ *
+ * Only commands of the same priority (see OSDP_CMD_FLAG_PRIO_*) are merged
+ * and the queued command keeps its place in the queue. When a command cannot
+ * be merged, it is queued as usual.
+ */
+#define OSDP_CMD_FLAG_COALESCE 0x000000008
+
 /**
  * @brief OSDP Command Structure. This is a wrapper for all individual OSDP
  * commands.
@@ -750,6 +964,9 @@ struct osdp_cmd {
 		struct osdp_cmd_file_tx file_tx;  /**< File transfer command structure */
 		struct osdp_status_report status; /**< Status report command structure */
 	};
+	uint32_t ttl_ms;       /**< Drop the command (instead of sending it late) if
+	                            it is still queued this many milliseconds after
+	                            submission; 0: never expires */
 };
 
 /* ------------------------------- */
@@ -867,6 +1084,13 @@ enum osdp_event_notification_type {
 	 * arg0: status -- 0: offline; 1: online
 	 */
 	OSDP_EVENT_NOTIFICATION_PD_STATUS,
+	/**
+	 * Application command was dropped as its osdp_cmd::ttl_ms expired
+	 * before it could be sent to the PD.
+	 *
+	 * arg0: The command ID
+	 */
+	OSDP_EVENT_NOTIFICATION_COMMAND_EXPIRED,
 };
 
 /**
@@ -914,6 +1138,24 @@ struct osdp_event {
 	};
 };
 
+/**
+ * @brief What to do with a new event when the CP event queue is full. See
+ * osdp_cp_set_event_queue().
+ */
+enum osdp_event_overflow_e {
+	OSDP_EVENT_OVERFLOW_DROP_NEWEST, /**< Drop the event that did not fit */
+	OSDP_EVENT_OVERFLOW_DROP_OLDEST, /**< Drop the oldest queued event */
+};
+
+/**
+ * @brief An event queued by the CP along with the PD that generated it. See
+ * osdp_cp_get_events().
+ */
+struct osdp_cp_event {
+	int pd;                    /**< PD offset (0-indexed) */
+	struct osdp_event event;   /**< The event itself */
+};
+
 /**
  * @brief Callback for PD command notifications. After it has been registered
  * with `osdp_pd_set_command_callback`, this method is invoked when the PD
@@ -1060,7 +1302,11 @@ OSDP_EXPORT
 osdp_t *osdp_cp_setup(int num_pd, const osdp_pd_info_t *info);
 
 /**
- * @brief Adds more PD devices in the CP control list.
+ * @brief Adds more PD devices in the CP control list. The new PDs get the
+ * lowest free offsets, in order; offsets of removed PDs are reused. A CP can
+ * have at most OSDP_PD_MAX (build config; 126 by default) PDs. This can be
+ * called while CP worker threads are running; the new PDs are shared out to
+ * the running workers by channel (no new threads are started).
  *
  * @param num_pd Number of PDs connected to this CP. The `osdp_pd_info_t *` is
  * treated as an array of length num_pd.
@@ -1072,6 +1318,29 @@ osdp_t *osdp_cp_setup(int num_pd, const osdp_pd_info_t *info);
 OSDP_EXPORT
 int osdp_cp_add_pd(osdp_t *ctx, int num_pd, const osdp_pd_info_t *info);
 
+/**
+ * @brief Remove a PD from the CP control list and release all resources held
+ * by it. Pending commands of this PD are discarded and its channel is closed
+ * if no other PD uses it. The offsets of other PDs do not change; methods
+ * called with the offset of the removed PD fail until osdp_cp_add_pd() reuses
+ * it.
+ *
+ * Calls on this PD that are in progress in other threads are allowed to
+ * finish before its resources are released, so this method may block
+ * briefly.
+ *
+ * @param ctx OSDP context
+ * @param pd PD offset (0-indexed) of this PD in `osdp_pd_info_t *` passed to
+ * osdp_cp_setup()
+ *
+ * @retval 0 on success
+ * @retval -1 on failure
+ *
+ * @note This method must not be called from the event callback.
+ */
+OSDP_EXPORT
+int osdp_cp_remove_pd(osdp_t *ctx, int pd);
+
 /**
  * @brief Periodic refresh method. Must be called by the application at least
  * once every 50ms to meet OSDP timing requirements.
@@ -1081,6 +1350,55 @@ int osdp_cp_add_pd(osdp_t *ctx, int num_pd, const osdp_pd_info_t *info);
 OSDP_EXPORT
 void osdp_cp_refresh(osdp_t *ctx);
 
+/**
+ * @brief Get the time until the next osdp_cp_refresh() call has some work to
+ * do. Applications can use this to sleep (or block on the channel file
+ * descriptors) instead of calling osdp_cp_refresh() on a fixed short tick.
+ *
+ * The value should be queried after each osdp_cp_refresh() call. Commands
+ * submitted or PDs enabled after that point are not accounted for; the
+ * application must call osdp_cp_refresh() again once it has done so.
+ *
+ * @param ctx OSDP context
+ *
+ * @retval 0 if osdp_cp_refresh() has to be called right away
+ * @retval >0 number of milliseconds until the next scheduled activity
+ * @retval -1 if there is no scheduled activity (all PDs are disabled)
+ */
+OSDP_EXPORT
+int osdp_cp_next_deadline_ms(const osdp_t *ctx);
+
+/**
+ * @brief Service the PDs of this context from a pool of worker threads
+ * instead of osdp_cp_refresh(). PDs are split by the channel they are
+ * connected to so that each independent bus is driven by one worker and a
+ * slow bus does not add latency to the others. Only available when LibOSDP is
+ * built with OPT_OSDP_CP_WORKERS.
+ *
+ * While the workers are running, osdp_cp_refresh() does nothing and the event
+ * callback is invoked from the worker threads. The other osdp_cp_* methods
+ * (including osdp_cp_add_pd() and osdp_cp_remove_pd()) can be called from any
+ * thread.
+ *
+ * @param ctx OSDP context
+ * @param num_workers Maximum number of threads to start (capped to the number
+ * of distinct channels)
+ *
+ * @retval 0 on success
+ * @retval -1 on failure
+ */
+OSDP_EXPORT
+int osdp_cp_start_workers(osdp_t *ctx, int num_workers);
+
+/**
+ * @brief Stop the worker threads started with osdp_cp_start_workers(). The
+ * application must call osdp_cp_refresh() after this.
+ *
+ * @param ctx OSDP context
+ */
+OSDP_EXPORT
+void osdp_cp_stop_workers(osdp_t *ctx);
+
 /**
  * @brief Cleanup all osdp resources. The context pointer is no longer valid
  * after this call.
@@ -1122,10 +1440,100 @@ int osdp_cp_send_command(osdp_t *ctx, int pd, const struct osdp_cmd *cmd);
  *
  * @note This method only adds the command on to a particular PD's command
  * queue. The command itself can fail due to various reasons.
+ *
+ * @note Queued commands are sent in the order urgent, normal, background (see
+ * OSDP_CMD_FLAG_PRIO_*) and are all sent ahead of pending file transfer
+ * chunks. Within a priority level, commands are sent in submission order.
+ *
+ * @note This method can be called from any number of threads concurrently
+ * with each other and with osdp_cp_refresh() without any locking by the app;
+ * it never waits for a refresh in progress (OSDP_CMD_FILE_TX is the only
+ * exception). An app that sleeps for osdp_cp_next_deadline_ms() between
+ * refreshes should wake its refresh thread after submitting a command from
+ * another thread.
  */
 OSDP_EXPORT
 int osdp_cp_submit_command(osdp_t *ctx, int pd, const struct osdp_cmd *cmd);
 
+/**
+ * @brief Submit the same CP command to many PDs at once (for instance, to
+ * unlock all doors or to put the building in lockdown). The command is
+ * validated once and queued to each selected PD. These PDs are serviced
+ * ahead of routine POLLs on all channels.
+ *
+ * @param ctx OSDP context
+ * @param pd_mask pointer to an array of bytes with bit N set for each PD
+ * offset N that should get this command; must be as large as
+ * (num_pds + 7 / 8). See osdp_get_status_mask().
+ * @param cmd command pointer. Must be filled by application. Only the
+ * OSDP_CMD_FLAG_PRIO_* and OSDP_CMD_FLAG_COALESCE flags are allowed and
+ * OSDP_CMD_FILE_TX is not.
+ *
+ * @retval Number of PDs the command was queued to
+ * @retval -1 on failure
+ *
+ * @note PDs that are not online (or cannot accept more commands) are
+ * skipped; compare the return value with the number of bits set in pd_mask.
+ *
+ * @note Like osdp_cp_submit_command(), this method can be called from any
+ * thread.
+ */
+OSDP_EXPORT
+int osdp_cp_submit_command_batch(osdp_t *ctx, const uint8_t *pd_mask,
+				 const struct osdp_cmd *cmd);
+
+/**
+ * @brief Set the maximum number of commands that can be queued across all PDs
+ * of this CP context. Memory for commands is allocated on demand (in chunks)
+ * up to this limit and is shared by all PDs. Defaults to OSDP_CP_CMD_POOL_MAX.
+ *
+ * @param ctx OSDP context
+ * @param max_cmds Maximum number of queued commands
+ *
+ * @retval 0 on success
+ * @retval -1 on failure
+ */
+OSDP_EXPORT
+int osdp_cp_set_command_pool_size(osdp_t *ctx, int max_cmds);
+
+/**
+ * @brief Set the maximum number of commands that can be queued for a PD so a
+ * single busy PD cannot drain the shared command pool. Defaults to
+ * OSDP_CP_CMD_QUOTA.
+ *
+ * @param ctx OSDP context
+ * @param pd PD offset (0-indexed) of this PD in `osdp_pd_info_t *` passed to
+ * osdp_cp_setup()
+ * @param quota Maximum number of commands queued for this PD
+ *
+ * @retval 0 on success
+ * @retval -1 on failure
+ */
+OSDP_EXPORT
+int osdp_cp_set_command_quota(osdp_t *ctx, int pd, int quota);
+
+/**
+ * @brief Get the command queue status of a PD. Apps that submit commands in
+ * bursts can use this to throttle themselves instead of having
+ * osdp_cp_submit_command() fail.
+ *
+ * @param ctx OSDP context
+ * @param pd PD offset (0-indexed) of this PD in `osdp_pd_info_t *` passed to
+ * osdp_cp_setup()
+ * @param depth Set to the number of commands waiting to be sent to the PD
+ * (can be NULL)
+ * @param headroom Set to the number of commands that can be submitted to this
+ * PD right now (can be NULL)
+ *
+ * @retval 0 on success
+ * @retval -1 on failure
+ *
+ * @note This method can be called from any thread.
+ */
+OSDP_EXPORT
+int osdp_cp_get_command_queue_status(const osdp_t *ctx, int pd, int *depth,
+				     int *headroom);
+
 /**
  * @brief Deletes all commands queued for a give PD
  *
@@ -1137,6 +1545,80 @@ int osdp_cp_submit_command(osdp_t *ctx, int pd, const struct osdp_cmd *cmd);
 OSDP_EXPORT
 int osdp_cp_flush_commands(osdp_t *ctx, int pd);
 
+/**
+ * @brief Set the range within which the CP adapts the POLL interval of a PD.
+ * A PD that replies with anything other than an ACK (card reads, keypresses,
+ * etc.,) is polled every `min_ms`; a quiet PD is gradually backed off to
+ * `max_ms`. Independently, POLLs on a shared channel are spaced out so they
+ * never take up more than OSDP_CP_BUS_BUDGET_PCT of the wire time at the
+ * configured baud rate. Defaults to OSDP_PD_POLL_TIMEOUT_MS and
+ * OSDP_PD_POLL_MAX_MS.
+ *
+ * @param ctx OSDP context
+ * @param pd PD offset (0-indexed) of this PD in `osdp_pd_info_t *` passed to
+ * osdp_cp_setup()
+ * @param min_ms Poll interval (in milliseconds) for a busy PD
+ * @param max_ms Poll interval (in milliseconds) for a quiet PD
+ *
+ * @retval 0 on success
+ * @retval -1 on failure
+ */
+OSDP_EXPORT
+int osdp_cp_set_poll_interval(osdp_t *ctx, int pd, int min_ms, int max_ms);
+
+/**
+ * @brief Get the reply latency of a group of commands sent to a PD.
+ *
+ * Latencies are kept in fixed size histograms whose buckets are 1 ms wide
+ * below 4 ms and a quarter of a power of 2 wide above that, so percentiles
+ * are accurate to 25%. Values above 8 seconds all go to the last bucket.
+ *
+ * @param ctx OSDP context
+ * @param pd PD offset (0-indexed) of this PD in `osdp_pd_info_t *` passed to
+ * osdp_cp_setup()
+ * @param type Group of commands; one of enum osdp_cmd_latency_e
+ * @param latency A pointer to struct osdp_cmd_latency that will be filled in.
+ *
+ * @retval 0 on success
+ * @retval -1 on failure
+ */
+OSDP_EXPORT
+int osdp_cp_get_cmd_latency(const osdp_t *ctx, int pd, int type,
+			    struct osdp_cmd_latency *latency);
+
+/**
+ * @brief Log a warning for each command sent to this PD that takes longer
+ * than `threshold_ms` to get a valid reply.
+ *
+ * @param ctx OSDP context
+ * @param pd PD offset (0-indexed) of this PD in `osdp_pd_info_t *` passed to
+ * osdp_cp_setup()
+ * @param threshold_ms Latency (in milliseconds) above which commands are
+ * logged; 0 (the default) disables this log.
+ *
+ * @retval 0 on success
+ * @retval -1 on failure
+ */
+OSDP_EXPORT
+int osdp_cp_set_slow_cmd_threshold(osdp_t *ctx, int pd, int threshold_ms);
+
+/**
+ * @brief Get the PD that currently holds the lock on the channel (bus) that a
+ * given PD is attached to. When multiple PDs share a channel, only one of them
+ * can have a transaction in flight at any time.
+ *
+ * @param ctx OSDP context
+ * @param pd PD offset (0-indexed) of this PD in `osdp_pd_info_t *` passed to
+ * osdp_cp_setup()
+ * @param owner Set to the PD offset of the current owner of the channel or -1
+ * if the channel is idle. A PD on a dedicated channel always owns it.
+ *
+ * @retval 0 on success
+ * @retval -1 on failure
+ */
+OSDP_EXPORT
+int osdp_cp_get_channel_owner(const osdp_t *ctx, int pd, int *owner);
+
 /**
  * @brief Get PD ID information as reported by the PD. Calling this method
  * before the CP has had a the chance to get this information will return
@@ -1171,6 +1653,27 @@ int osdp_cp_get_pd_id(const osdp_t *ctx, int pd, struct osdp_pd_id *id);
 OSDP_EXPORT
 int osdp_cp_get_capability(const osdp_t *ctx, int pd, struct osdp_pd_cap *cap);
 
+/**
+ * @brief Get a consistent copy of the state, ID and capabilities of a PD.
+ *
+ * @param ctx OSDP context
+ * @param pd PD offset (0-indexed) of this PD in `osdp_pd_info_t *` passed to
+ * osdp_cp_setup()
+ * @param snapshot A pointer to struct osdp_pd_snapshot that will be filled in.
+ *
+ * @retval 0 on success
+ * @retval -1 on failure
+ *
+ * @note This method, osdp_cp_get_pd_id(), osdp_cp_get_capability(),
+ * osdp_cp_is_pd_enabled(), osdp_get_status_mask() and
+ * osdp_get_sc_status_mask() read state that the refresh thread publishes after
+ * each change; they can be called from any thread without locking and never
+ * wait for a refresh in progress.
+ */
+OSDP_EXPORT
+int osdp_cp_get_pd_snapshot(const osdp_t *ctx, int pd,
+			    struct osdp_pd_snapshot *snapshot);
+
 /**
  * @brief Set callback method for CP event notification. This callback is
  * invoked when the CP receives an event from the PD.
@@ -1182,6 +1685,60 @@ int osdp_cp_get_capability(const osdp_t *ctx, int pd, struct osdp_pd_cap *cap);
 OSDP_EXPORT
 void osdp_cp_set_event_callback(osdp_t *ctx, cp_event_callback_t cb, void *arg);
 
+/**
+ * @brief Deliver events through a bounded queue that the app drains from its
+ * own thread with osdp_cp_get_events() instead of invoking the event callback
+ * from within osdp_cp_refresh() (or the CP worker threads). A slow event
+ * handler then no longer holds up the bus. The event callback is not invoked
+ * while the queue is enabled.
+ *
+ * @param ctx OSDP context
+ * @param size Number of events the queue can hold (rounded up to a power of
+ * two); 0 disables the queue and drops any events still in it.
+ * @param policy What to do when an event arrives while the queue is full.
+ *
+ * @retval 0 on success
+ * @retval -1 on failure
+ *
+ * @note This method must not be called while CP workers are running or
+ * concurrently with osdp_cp_refresh().
+ */
+OSDP_EXPORT
+int osdp_cp_set_event_queue(osdp_t *ctx, int size,
+			    enum osdp_event_overflow_e policy);
+
+/**
+ * @brief Take up to `max` events out of the CP event queue (see
+ * osdp_cp_set_event_queue()) in the order they were generated. This method
+ * can be called from any thread, including concurrently with
+ * osdp_cp_refresh().
+ *
+ * @param ctx OSDP context
+ * @param events Array of at least `max` events to fill
+ * @param max Maximum number of events to take
+ *
+ * @retval Number of events copied to `events` (0 if there were none)
+ * @retval -1 on failure (event queue is not enabled)
+ */
+OSDP_EXPORT
+int osdp_cp_get_events(osdp_t *ctx, struct osdp_cp_event *events, int max);
+
+/**
+ * @brief Get the status of the CP event queue. This method can be called from
+ * any thread.
+ *
+ * @param ctx OSDP context
+ * @param depth Set to the number of events waiting to be taken (can be NULL)
+ * @param dropped Set to the number of events dropped due to overflow since
+ * the queue was enabled (can be NULL)
+ *
+ * @retval 0 on success
+ * @retval -1 on failure (event queue is not enabled)
+ */
+OSDP_EXPORT
+int osdp_cp_get_event_queue_status(const osdp_t *ctx, int *depth,
+				   uint32_t *dropped);
+
 /**
  * @brief Set or clear OSDP public flags
  *
@@ -1355,6 +1912,137 @@ void osdp_get_status_mask(const osdp_t *ctx, uint8_t *bitmask);
 OSDP_EXPORT
 void osdp_get_sc_status_mask(const osdp_t *ctx, uint8_t *bitmask);
 
+/**
+ * @brief Get the protocol counters of a PD.
+ *
+ * @param ctx OSDP context
+ * @param pd PD offset (0-indexed) of this PD in `osdp_pd_info_t *` passed to
+ * osdp_cp_setup(). Must be 0 in PD mode.
+ * @param stats A pointer to struct osdp_pd_stats that will be filled in.
+ * @param reset If true, the counters read now become the new zero so that the
+ * next call reports only what happened since this one.
+ *
+ * @retval 0 on success
+ * @retval -1 on failure
+ *
+ * @note The counters are kept by the thread that refreshes the PD and read
+ * here without locks, so they can be polled from any thread. Calls that reset
+ * the counters must not be made concurrently for the same PD.
+ */
+OSDP_EXPORT
+int osdp_get_pd_stats(osdp_t *ctx, int pd, struct osdp_pd_stats *stats,
+		      bool reset);
+
+/**
+ * @brief Get the flight recorder of a PD as a pcap file image.
+ *
+ * Each PD always keeps the last OSDP_FLIGHT_RECORDER_DEPTH packets sent and
+ * received on its behalf (the first OSDP_FLIGHT_RECORDER_SNAPLEN bytes of
+ * each, as seen on the wire). Timestamps in the image are from
+ * osdp_millis_now().
+ *
+ * @param ctx OSDP context
+ * @param pd PD offset (0-indexed) of this PD in `osdp_pd_info_t *` passed to
+ * osdp_cp_setup(). Must be 0 in PD mode.
+ * @param buf Buffer to write the pcap file image to
+ * @param max_len Size of buf; OSDP_FLIGHT_RECORDER_PCAP_MAX is always enough.
+ *
+ * @retval Length of the pcap file image on success
+ * @retval -1 on failure
+ *
+ * @note The recorder is written by the thread that refreshes the PD; when
+ * called from another thread, the packet being recorded at the time may come
+ * out garbled.
+ */
+OSDP_EXPORT
+int osdp_get_flight_recorder(const osdp_t *ctx, int pd, uint8_t *buf,
+			     int max_len);
+
+/**
+ * @brief Set a callback to be handed the flight recorder of a PD whenever it
+ * goes offline or fails to set up a secure channel, so the packets leading up
+ * to the incident can be saved.
+ *
+ * @param ctx OSDP context
+ * @param cb The callback function's pointer; NULL to disable.
+ * @param arg A pointer that will be passed as the first argument of `cb`
+ *
+ * @retval 0 on success
+ * @retval -1 on failure
+ *
+ * @note The callback is invoked from the thread that refreshes the PD and must
+ * not call into LibOSDP.
+ */
+OSDP_EXPORT
+int osdp_set_flight_recorder_callback(osdp_t *ctx,
+				      osdp_flight_recorder_callback_t cb,
+				      void *arg);
+
+/**
+ * @brief Start capturing packets of all PDs in this context to pcapng files.
+ *
+ * Packets are handed to a background thread through a lock-free ring per PD
+ * and written to a single file in which each PD is an interface (named after
+ * the PD). The threads that refresh the PDs never touch the file so disk I/O
+ * does not affect bus timing; packets are dropped (and logged by the writer)
+ * if the writer falls behind. Capture can be started and stopped at any time
+ * without restarting the context. Only available when LibOSDP is built with
+ * OPT_OSDP_CAPTURE_WRITER.
+ *
+ * @param ctx OSDP context
+ * @param config Capture file path and rotation settings
+ *
+ * @retval 0 on success
+ * @retval -1 on failure
+ *
+ * @note PDs added after this call are not captured until capture is stopped
+ * and started again.
+ */
+OSDP_EXPORT
+int osdp_capture_start(osdp_t *ctx, const struct osdp_capture_config *config);
+
+/**
+ * @brief Stop capturing packets; writes out any packets still in flight and
+ * closes the current capture file.
+ *
+ * @param ctx OSDP context
+ */
+OSDP_EXPORT
+void osdp_capture_stop(osdp_t *ctx);
+
+/**
+ * @brief Enable or disable packet capture for a PD. All PDs are enabled when
+ * capture is started.
+ *
+ * @param ctx OSDP context
+ * @param pd PD offset (0-indexed) of this PD in `osdp_pd_info_t *` passed to
+ * osdp_cp_setup(). Must be 0 in PD mode.
+ * @param enable true to capture packets of this PD; false to skip them.
+ *
+ * @retval 0 on success
+ * @retval -1 on failure (or if capture is not running)
+ */
+OSDP_EXPORT
+int osdp_capture_enable(osdp_t *ctx, int pd, bool enable);
+
+/**
+ * @brief Capture only those packets of a PD whose command/reply ID is in a
+ * given list.
+ *
+ * @param ctx OSDP context
+ * @param pd PD offset (0-indexed) of this PD in `osdp_pd_info_t *` passed to
+ * osdp_cp_setup(). Must be 0 in PD mode.
+ * @param ids Array of command and/or reply IDs (as on the wire; e.g. 0x60
+ * for osdp_POLL, 0x40 for osdp_ACK).
+ * @param num_ids Number of entries in `ids`; 0 to capture all packets again.
+ *
+ * @retval 0 on success
+ * @retval -1 on failure (or if capture is not running)
+ */
+OSDP_EXPORT
+int osdp_capture_set_filter(osdp_t *ctx, int pd, const uint8_t *ids,
+			    int num_ids);
+
 /**
  * @brief Open a pre-agreed file
  *
@@ -1409,6 +2097,29 @@ typedef int (*osdp_file_read_fn_t)(void *arg, void *buf, int size, int offset);
 typedef int (*osdp_file_write_fn_t)(void *arg, const void *buf,
 				   int size, int offset);
 
+/**
+ * @brief Get a pointer to a chunk of file data, without copying it (optional)
+ *
+ * Applications that hold the file in memory (RAM or memory mapped flash) can
+ * provide this so file transfer chunks are sent straight from their memory.
+ * LibOSDP uses it only when it can send the chunk as is (the channel has a
+ * osdp_channel::sendv, the secure channel is not active, and no packet
+ * capture is in progress); otherwise osdp_file_read_fn_t is used.
+ *
+ * @param arg Opaque pointer that was provided in @ref osdp_file_ops when the
+ * ops struct was registered.
+ * @param buf Set to point to the file data at `offset`. This memory must
+ * stay valid and unchanged until the next call to any of the file ops.
+ * @param size Maximum number of bytes needed
+ * @param offset Number of bytes from the beginning of the file
+ *
+ * @retval Number of bytes available at `*buf` (can be less than `size`)
+ * @retval 0 on EOF
+ * @retval -ve on errors.
+ */
+typedef int (*osdp_file_map_fn_t)(void *arg, const void **buf, int size,
+				  int offset);
+
 /**
  * @brief Close file that corresponds to a given file descriptor
  *
@@ -1437,6 +2148,7 @@ struct osdp_file_ops {
 	osdp_file_read_fn_t read;   /**< read handler function */
 	osdp_file_write_fn_t write; /**< write handler function */
 	osdp_file_close_fn_t close; /**< close handler function */
+	osdp_file_map_fn_t map;     /**< zero-copy read handler (optional) */
 };
 
 /**
@@ -45,6 +45,22 @@ public:
 		osdp_get_sc_status_mask(_ctx, bitmask);
 	}
 
+	int get_pd_stats(int pd, struct osdp_pd_stats *stats, bool reset = false)
+	{
+		return osdp_get_pd_stats(_ctx, pd, stats, reset);
+	}
+
+	int get_flight_recorder(int pd, uint8_t *buf, int max_len)
+	{
+		return osdp_get_flight_recorder(_ctx, pd, buf, max_len);
+	}
+
+	int set_flight_recorder_callback(osdp_flight_recorder_callback_t cb,
+					 void *arg)
+	{
+		return osdp_set_flight_recorder_callback(_ctx, cb, arg);
+	}
+
 	int file_register_ops(int pd, struct osdp_file_ops *ops)
 	{
 		return osdp_file_register_ops(_ctx, pd, ops);
@@ -86,11 +102,31 @@ public:
 		return osdp_cp_add_pd(_ctx, num_pd, info);
 	}
 
+	int remove_pd(int pd)
+	{
+		return osdp_cp_remove_pd(_ctx, pd);
+	}
+
 	void refresh()
 	{
 		osdp_cp_refresh(_ctx);
 	}
 
+	int next_deadline_ms()
+	{
+		return osdp_cp_next_deadline_ms(_ctx);
+	}
+
+	int start_workers(int num_workers)
+	{
+		return osdp_cp_start_workers(_ctx, num_workers);
+	}
+
+	void stop_workers()
+	{
+		osdp_cp_stop_workers(_ctx);
+	}
+
 	[[deprecated]]
 	int send_command(int pd, struct osdp_cmd *cmd)
 	{
@@ -102,11 +138,46 @@ public:
 		return osdp_cp_submit_command(_ctx, pd, cmd);
 	}
 
+	int submit_command_batch(const uint8_t *pd_mask, struct osdp_cmd *cmd)
+	{
+		return osdp_cp_submit_command_batch(_ctx, pd_mask, cmd);
+	}
+
+	int set_command_pool_size(int max_cmds)
+	{
+		return osdp_cp_set_command_pool_size(_ctx, max_cmds);
+	}
+
+	int set_command_quota(int pd, int quota)
+	{
+		return osdp_cp_set_command_quota(_ctx, pd, quota);
+	}
+
+	int get_command_queue_status(int pd, int *depth, int *headroom)
+	{
+		return osdp_cp_get_command_queue_status(_ctx, pd, depth, headroom);
+	}
+
 	void set_event_callback(cp_event_callback_t cb, void *arg)
 	{
 		osdp_cp_set_event_callback(_ctx, cb, arg);
 	}
 
+	int set_event_queue(int size, enum osdp_event_overflow_e policy)
+	{
+		return osdp_cp_set_event_queue(_ctx, size, policy);
+	}
+
+	int get_events(struct osdp_cp_event *events, int max)
+	{
+		return osdp_cp_get_events(_ctx, events, max);
+	}
+
+	int get_event_queue_status(int *depth, uint32_t *dropped)
+	{
+		return osdp_cp_get_event_queue_status(_ctx, depth, dropped);
+	}
+
 	int get_pd_id(int pd, struct osdp_pd_id *id)
 	{
 		return osdp_cp_get_pd_id(_ctx, pd, id);
@@ -117,6 +188,31 @@ public:
 		return osdp_cp_get_capability(_ctx, pd, cap);
 	}
 
+	int get_pd_snapshot(int pd, struct osdp_pd_snapshot *snapshot)
+	{
+		return osdp_cp_get_pd_snapshot(_ctx, pd, snapshot);
+	}
+
+	int set_poll_interval(int pd, int min_ms, int max_ms)
+	{
+		return osdp_cp_set_poll_interval(_ctx, pd, min_ms, max_ms);
+	}
+
+	int get_cmd_latency(int pd, int type, struct osdp_cmd_latency *latency)
+	{
+		return osdp_cp_get_cmd_latency(_ctx, pd, type, latency);
+	}
+
+	int set_slow_cmd_threshold(int pd, int threshold_ms)
+	{
+		return osdp_cp_set_slow_cmd_threshold(_ctx, pd, threshold_ms);
+	}
+
+	int get_channel_owner(int pd, int *owner)
+	{
+		return osdp_cp_get_channel_owner(_ctx, pd, owner);
+	}
+
 };
 
 class OSDP_EXPORT PeripheralDevice : public Common {
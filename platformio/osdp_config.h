@@ -24,19 +24,31 @@
  */
 #define OSDP_PD_SC_RETRY_MS                     (600 * 1000)
 #define OSDP_PD_POLL_TIMEOUT_MS                 (50)
+#define OSDP_PD_POLL_MAX_MS                     (200)
+#define OSDP_CP_BUS_BUDGET_PCT                  (50)
 #define OSDP_PD_SC_TIMEOUT_MS                   (8 * 1000)
 #define OSDP_PD_ONLINE_TOUT_MS                  (8 * 1000)
 #define OSDP_RESP_TOUT_MS                       (200)
+#define OSDP_RESP_TOUT_MIN_MS                   (50)
+#define OSDP_RESP_POLL_MS                       (5)
 #define OSDP_CMD_MAX_RETRIES                    (8)
 #define OSDP_ONLINE_RETRY_WAIT_MAX_MS           (300 * 1000)
+#define OSDP_PROBE_TOUT_MS                      (30)
+#define OSDP_PROBE_BACKOFF_MIN_MS               (1000)
+#define OSDP_CP_PROBE_BUDGET_PCT                (10)
 #define OSDP_CMD_RETRY_WAIT_MS                  (800)
 #define OSDP_PACKET_BUF_SIZE                    (256)
 #define OSDP_RX_RB_SIZE                         (512)
 #define OSDP_CP_CMD_POOL_SIZE                   (4)
+#define OSDP_CP_CMD_POOL_MAX                    (256)
+#define OSDP_CP_CMD_QUOTA                       (16)
+#define OSDP_CP_CMD_RING_SIZE                   (16)
 #define OSDP_FILE_ERROR_RETRY_MAX               (10)
 #define OSDP_PD_MAX                             (126)
 #define OSDP_CMD_ID_OFFSET                      (5)
 #define OSDP_PCAP_LINK_TYPE                     (162)
+#define OSDP_CAPTURE_RING_SIZE                  (64)
+#define OSDP_CAPTURE_FLUSH_MS                   (100)
 #define OSDP_PD_NAME_MAXLEN                     (16)
 #define OSDP_MINIMUM_PACKET_SIZE		(128)
 
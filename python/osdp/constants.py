@@ -55,10 +55,15 @@ class CommandLEDColor:
 class CommandFileTxFlags:
     Cancel = osdp_sys.CMD_FILE_TX_FLAG_CANCEL
 
+class CommandPriority:
+    Urgent = osdp_sys.CMD_FLAG_PRIO_URGENT
+    Background = osdp_sys.CMD_FLAG_PRIO_BACKGROUND
+
 class EventNotification:
     Command = osdp_sys.EVENT_NOTIFICATION_COMMAND
     SecureChannelStatus = osdp_sys.EVENT_NOTIFICATION_SC_STATUS
     PeripheralDeviceStatus = osdp_sys.EVENT_NOTIFICATION_PD_STATUS
+    CommandExpired = osdp_sys.EVENT_NOTIFICATION_COMMAND_EXPIRED
 
 class Event:
     CardRead = osdp_sys.EVENT_CARDREAD
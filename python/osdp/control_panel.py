@@ -33,16 +33,25 @@ class ControlPanel():
         self.ctx.set_event_callback(self._internal_event_handler)
         self.set_event_handler(event_handler)
         self.event = None
+        self.wakeup = None
         self.lock = None
         self.thread = None
 
     @staticmethod
-    def refresh(event, lock, ctx):
+    def refresh(event, wakeup, lock, ctx):
         while not event.is_set():
             lock.acquire()
             ctx.refresh()
+            deadline = ctx.next_deadline()
             lock.release()
-            time.sleep(0.020) #sleep for 20ms
+            # sleep until the library has some work to do or until some
+            # other method (submit_command, enable_pd, etc.,) wakes us up.
+            wakeup.wait(deadline / 1000 if deadline >= 0 else None)
+            wakeup.clear()
+
+    def _wakeup_refresh(self):
+        if self.wakeup:
+            self.wakeup.set()
 
     def set_event_handler(self, handler: Callable[[int, dict], int]):
         """Set user event handler while maintaining queue functionality"""
@@ -73,10 +82,7 @@ class ControlPanel():
         return event
 
     def status(self):
-        self.lock.acquire()
-        bitmask = self.ctx.status()
-        self.lock.release()
-        return bitmask
+        return self.ctx.status()
 
     def is_online(self, address):
         pd = self.pd_addr.index(address)
@@ -84,9 +90,7 @@ class ControlPanel():
 
     def get_pd_id(self, address: int) -> PdId:
         pd = self.pd_addr.index(address)
-        self.lock.acquire()
         pd_id_dict = self.ctx.get_pd_id(pd)
-        self.lock.release()
         if pd_id_dict:
             # version: int, model: int, vendor_code: int, serial_number: int, firmware_version: int
             pd_id = PdId(
@@ -100,9 +104,7 @@ class ControlPanel():
 
     def check_capability(self, address: int, cap: Capability) -> Tuple[int, int]:
         pd = self.pd_addr.index(address)
-        self.lock.acquire()
         compliance_level, num_items = self.ctx.check_capability(pd, cap)
-        self.lock.release()
         return (compliance_level, num_items)
 
     def get_num_online(self):
@@ -114,10 +116,7 @@ class ControlPanel():
         return online
 
     def sc_status(self):
-        self.lock.acquire()
-        bitmask = self.ctx.sc_status()
-        self.lock.release()
-        return bitmask
+        return self.ctx.sc_status()
 
     def is_sc_active(self, address):
         pd = self.pd_addr.index(address)
@@ -133,9 +132,9 @@ class ControlPanel():
 
     def submit_command(self, address, cmd):
         pd = self.pd_addr.index(address)
-        self.lock.acquire()
+        # submissions don't need to be serialized with refresh
         ret = self.ctx.submit_command(pd, cmd)
-        self.lock.release()
+        self._wakeup_refresh()
         return ret
 
     def send_command(self, address, cmd):
@@ -162,6 +161,7 @@ class ControlPanel():
         self.lock.acquire()
         ret = self.ctx.disable_pd(pd)
         self.lock.release()
+        self._wakeup_refresh()
         return ret
 
     def enable_pd(self, address: int) -> bool:
@@ -169,6 +169,7 @@ class ControlPanel():
         self.lock.acquire()
         ret = self.ctx.enable_pd(pd)
         self.lock.release()
+        self._wakeup_refresh()
         return ret
 
     def is_pd_enabled(self, address: int) -> bool:
@@ -192,12 +193,21 @@ class ControlPanel():
         self.lock.release()
         return ret
 
+    def get_pd_stats(self, address, reset=False):
+        pd = self.pd_addr.index(address)
+        return self.ctx.get_pd_stats(pd, reset)
+
+    def get_flight_recorder(self, address):
+        pd = self.pd_addr.index(address)
+        return self.ctx.get_flight_recorder(pd)
+
     def start(self):
         if self.thread:
             raise RuntimeError("Thread already running!")
         self.event = threading.Event()
+        self.wakeup = threading.Event()
         self.lock = threading.Lock()
-        args=(self.event, self.lock, self.ctx)
+        args=(self.event, self.wakeup, self.lock, self.ctx)
         self.thread = threading.Thread(name='cp', target=self.refresh, args=args)
         self.thread.start()
 
@@ -206,6 +216,7 @@ class ControlPanel():
             raise RuntimeError("Thread not running!")
         while self.thread.is_alive():
             self.event.set()
+            self.wakeup.set()
             self.thread.join(2)
             if not self.thread.is_alive():
                 self.thread = None
@@ -113,6 +113,12 @@ class PeripheralDevice():
         self.lock.release()
         return ret
 
+    def get_stats(self, reset=False):
+        return self.ctx.get_pd_stats(0, reset)
+
+    def get_flight_recorder(self):
+        return self.ctx.get_flight_recorder(0)
+
     def stop(self):
         if not self.thread:
             raise RuntimeError("Thread not running!")
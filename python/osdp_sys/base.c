@@ -138,6 +138,90 @@ static PyObject *pyosdp_get_file_tx_status(pyosdp_base_t *self, PyObject *args)
 	return dict;
 }
 
+#define pyosdp_get_pd_stats_doc                                                \
+	"Get protocol counters of a PD\n"                                      \
+	"\n"                                                                   \
+	"@param pd PD offset number (0 in PD mode)\n"                          \
+	"@param reset If True, count from zero after this call\n"              \
+	"\n"                                                                   \
+	"@return dictionary of counters. See struct osdp_pd_stats in osdp.h;\n" \
+	"        'naks' is a list indexed by NAK code\n"
+static PyObject *pyosdp_get_pd_stats(pyosdp_base_t *self, PyObject *args)
+{
+	int i, pd_idx, reset = 0;
+	osdp_t *ctx;
+	PyObject *naks, *item;
+	struct osdp_pd_stats stats;
+	pyosdp_cp_t *cp = (pyosdp_cp_t *)self;
+	pyosdp_pd_t *pd = (pyosdp_pd_t *)self;
+
+	ctx = self->is_cp ? cp->ctx : pd->ctx;
+
+	if (!PyArg_ParseTuple(args, "I|p", &pd_idx, &reset))
+		Py_RETURN_NONE;
+
+	if (osdp_get_pd_stats(ctx, pd_idx, &stats, reset))
+		Py_RETURN_NONE;
+
+	naks = PyList_New(OSDP_PD_NAK_SENTINEL);
+	if (naks == NULL)
+		Py_RETURN_NONE;
+
+	for (i = 0; i < OSDP_PD_NAK_SENTINEL; i++) {
+		item = PyLong_FromUnsignedLong(stats.naks[i]);
+		if (item == NULL) {
+			Py_DECREF(naks);
+			Py_RETURN_NONE;
+		}
+		PyList_SET_ITEM(naks, i, item);
+	}
+
+	return Py_BuildValue(
+		"{s:I,s:I,s:I,s:I,s:I,s:I,s:N,s:I,s:I,s:I,s:I,s:I,s:I,s:I,s:I}",
+		"tx_packets", stats.tx_packets,
+		"tx_bytes", stats.tx_bytes,
+		"rx_packets", stats.rx_packets,
+		"rx_bytes", stats.rx_bytes,
+		"crc_errors", stats.crc_errors,
+		"checksum_errors", stats.checksum_errors,
+		"naks", naks,
+		"retries", stats.retries,
+		"timeouts", stats.timeouts,
+		"busy", stats.busy,
+		"sc_handshakes", stats.sc_handshakes,
+		"sc_failures", stats.sc_failures,
+		"mac_failures", stats.mac_failures,
+		"scan_skip_bytes", stats.scan_skip_bytes,
+		"rx_overflows", stats.rx_overflows);
+}
+
+#define pyosdp_get_flight_recorder_doc                                         \
+	"Get the last packets sent/received for a PD\n"                        \
+	"\n"                                                                   \
+	"@param pd PD offset number (0 in PD mode)\n"                          \
+	"\n"                                                                   \
+	"@return bytes; contents of a pcap file\n"
+static PyObject *pyosdp_get_flight_recorder(pyosdp_base_t *self,
+					    PyObject *args)
+{
+	int pd_idx, len;
+	osdp_t *ctx;
+	uint8_t buf[OSDP_FLIGHT_RECORDER_PCAP_MAX];
+	pyosdp_cp_t *cp = (pyosdp_cp_t *)self;
+	pyosdp_pd_t *pd = (pyosdp_pd_t *)self;
+
+	ctx = self->is_cp ? cp->ctx : pd->ctx;
+
+	if (!PyArg_ParseTuple(args, "I", &pd_idx))
+		Py_RETURN_NONE;
+
+	len = osdp_get_flight_recorder(ctx, pd_idx, buf, sizeof(buf));
+	if (len < 0)
+		Py_RETURN_NONE;
+
+	return PyBytes_FromStringAndSize((const char *)buf, len);
+}
+
 #define pyosdp_file_register_ops_doc                                           \
 	"Register file OPs handler\n"                                          \
 	"\n"                                                                   \
@@ -250,6 +334,10 @@ static PyMethodDef pyosdp_base_methods[] = {
 	  pyosdp_file_register_ops_doc },
 	{ "get_file_tx_status", (PyCFunction)pyosdp_get_file_tx_status, METH_VARARGS,
 	  pyosdp_file_tx_status_doc },
+	{ "get_pd_stats", (PyCFunction)pyosdp_get_pd_stats, METH_VARARGS,
+	  pyosdp_get_pd_stats_doc },
+	{ "get_flight_recorder", (PyCFunction)pyosdp_get_flight_recorder,
+	  METH_VARARGS, pyosdp_get_flight_recorder_doc },
 	{ NULL } /* Sentinel */
 };
 
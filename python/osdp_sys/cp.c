@@ -89,6 +89,19 @@ static PyObject *pyosdp_cp_refresh(pyosdp_cp_t *self, pyosdp_cp_t *args)
 	Py_RETURN_NONE;
 }
 
+#define pyosdp_cp_next_deadline_doc                                            \
+	"Get time until the next refresh has some work to do\n"                \
+	"\n"                                                                   \
+	"@return milliseconds to next deadline; -1 if nothing is scheduled\n"
+static PyObject *pyosdp_cp_next_deadline(pyosdp_cp_t *self, PyObject *args)
+{
+	int ms;
+
+	ms = osdp_cp_next_deadline_ms(self->ctx);
+
+	return Py_BuildValue("i", ms);
+}
+
 #define pyosdp_cp_get_pd_id_doc                                                \
 	"Get PD_ID info as reported by the PD\n"                               \
 	"\n"                                                                   \
@@ -447,6 +460,8 @@ static PyGetSetDef pyosdp_cp_tp_getset[] = {
 static PyMethodDef pyosdp_cp_tp_methods[] = {
 	{ "refresh", (PyCFunction)pyosdp_cp_refresh,
 	  METH_NOARGS, pyosdp_cp_refresh_doc },
+	{ "next_deadline", (PyCFunction)pyosdp_cp_next_deadline,
+	  METH_NOARGS, pyosdp_cp_next_deadline_doc },
 	{ "set_event_callback", (PyCFunction)pyosdp_cp_set_event_callback,
 	  METH_VARARGS, pyosdp_cp_set_event_callback_doc },
 	{ "submit_command", (PyCFunction)pyosdp_cp_submit_command,
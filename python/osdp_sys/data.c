@@ -644,7 +644,8 @@ static struct {
 
 int pyosdp_make_struct_cmd(struct osdp_cmd *cmd, PyObject *dict)
 {
-	int cmd_id;
+	int cmd_id, priority, ttl_ms;
+	bool coalesce = false;
 
 	if (pyosdp_dict_get_int(dict, "command", &cmd_id))
 		return -1;
@@ -653,6 +654,25 @@ int pyosdp_make_struct_cmd(struct osdp_cmd *cmd, PyObject *dict)
 	if (command_translator[cmd_id].dict_to_struct(cmd, dict))
 		return -1;
 
+	/* Optional queueing attributes; see OSDP_CMD_FLAG_PRIO_* */
+	if (PyDict_GetItemString(dict, "priority")) {
+		if (pyosdp_dict_get_int(dict, "priority", &priority))
+			return -1;
+		cmd->flags &= ~(OSDP_CMD_FLAG_PRIO_URGENT |
+				OSDP_CMD_FLAG_PRIO_BACKGROUND);
+		cmd->flags |= priority & (OSDP_CMD_FLAG_PRIO_URGENT |
+					  OSDP_CMD_FLAG_PRIO_BACKGROUND);
+	}
+	if (PyDict_GetItemString(dict, "ttl_ms")) {
+		if (pyosdp_dict_get_int(dict, "ttl_ms", &ttl_ms) || ttl_ms < 0)
+			return -1;
+		cmd->ttl_ms = (uint32_t)ttl_ms;
+	}
+	if (pyosdp_dict_get_bool(dict, "coalesce", &coalesce) < 0)
+		return -1;
+	if (coalesce)
+		cmd->flags |= OSDP_CMD_FLAG_COALESCE;
+
 	cmd->id = cmd_id;
 	return 0;
 }
@@ -56,10 +56,16 @@ void pyosdp_add_module_constants(PyObject *module)
 	/* For `struct osdp_cmd_file_tx::flags` */
 	ADD_CONST("CMD_FILE_TX_FLAG_CANCEL", OSDP_CMD_FILE_TX_FLAG_CANCEL);
 
+	/* For `struct osdp_cmd::flags` */
+	ADD_CONST("CMD_FLAG_PRIO_URGENT", OSDP_CMD_FLAG_PRIO_URGENT);
+	ADD_CONST("CMD_FLAG_PRIO_BACKGROUND", OSDP_CMD_FLAG_PRIO_BACKGROUND);
+	ADD_CONST("CMD_FLAG_COALESCE", OSDP_CMD_FLAG_COALESCE);
+
 	/* For `struct osdp_event_notification::type` */
 	ADD_CONST("EVENT_NOTIFICATION_COMMAND", OSDP_EVENT_NOTIFICATION_COMMAND);
 	ADD_CONST("EVENT_NOTIFICATION_SC_STATUS", OSDP_EVENT_NOTIFICATION_SC_STATUS);
 	ADD_CONST("EVENT_NOTIFICATION_PD_STATUS", OSDP_EVENT_NOTIFICATION_PD_STATUS);
+	ADD_CONST("EVENT_NOTIFICATION_COMMAND_EXPIRED", OSDP_EVENT_NOTIFICATION_COMMAND_EXPIRED);
 
 	/* enum osdp_event_type */
 	ADD_CONST("EVENT_CARDREAD", OSDP_EVENT_CARDREAD);
@@ -82,7 +82,6 @@ utils_sources = [
     "utils/src/utils.c",
     "utils/src/logger.c",
     "utils/src/disjoint_set.c",
-    "utils/src/crc16.c",
 ]
 
 utils_includes = [
@@ -93,11 +92,11 @@ utils_includes = [
     "utils/include/utils/utils.h",
     "utils/include/utils/logger.h",
     "utils/include/utils/disjoint_set.h",
-    "utils/include/utils/crc16.h",
 ]
 
 lib_sources = [
     "src/osdp_common.c",
+    "src/osdp_crc.c",
     "src/osdp_phy.c",
     "src/osdp_sc.c",
     "src/osdp_file.c",
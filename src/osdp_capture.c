@@ -0,0 +1,454 @@
+/*
+ * Copyright (c) 2025 Siddharth Chandrasekaran <sidcha.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "osdp_capture.h"
+#include "osdp_cp_worker.h"
+
+#define PCAPNG_SHB                     0x0A0D0D0A
+#define PCAPNG_IDB                     0x00000001
+#define PCAPNG_EPB                     0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC        0x1A2B3C4D
+#define PCAPNG_OPT_END                 0
+#define PCAPNG_OPT_IF_NAME             2
+
+#define PAD4(x)                        (((x) + 3) & ~3)
+
+/**
+ * Packets of one PD on their way to the writer. head is only written by the
+ * thread that refreshes the PD and tail only by the writer thread so a slot
+ * is never touched by both at the same time. IDs set in filter[] are the
+ * only ones captured when filter_on is set.
+ */
+struct capture_ring {
+	osdp_atomic_t head;
+	osdp_atomic_t tail;
+	osdp_atomic_t enabled;
+	osdp_atomic_t filter_on;
+	osdp_atomic_t filter[256 / 32];
+	osdp_atomic_t dropped;
+	uint32_t dropped_seen; /* writer's copy of dropped */
+	char name[OSDP_PD_NAME_MAXLEN];
+	struct {
+		int64_t tstamp;
+		int len;
+		uint8_t data[OSDP_PACKET_BUF_SIZE];
+	} slot[OSDP_CAPTURE_RING_SIZE];
+};
+
+struct osdp_capture {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool stop;
+
+	char *path;
+	uint32_t max_file_size;
+	int64_t max_file_age_ms;
+	int64_t wall_clock_offset; /* wall clock ms - osdp_millis_now() */
+
+	FILE *file;
+	uint32_t file_index;
+	uint32_t file_size;
+	int64_t file_tstamp;
+
+	int num_rings;
+	struct capture_ring *rings;
+};
+
+static int capture_write(struct osdp_capture *c, const void *buf, size_t len)
+{
+	if (fwrite(buf, 1, len, c->file) != len) {
+		return -1;
+	}
+	c->file_size += (uint32_t)len;
+	return 0;
+}
+
+static int capture_write_u32(struct osdp_capture *c, uint32_t val)
+{
+	return capture_write(c, &val, sizeof(val));
+}
+
+static int capture_write_header(struct osdp_capture *c)
+{
+	int i, name_len;
+	uint32_t len;
+	uint16_t opt[2];
+	const uint8_t pad[4] = { 0 };
+	struct capture_ring *r;
+
+	/* Section Header Block; section length unknown (-1) */
+	capture_write_u32(c, PCAPNG_SHB);
+	capture_write_u32(c, 28);
+	capture_write_u32(c, PCAPNG_BYTE_ORDER_MAGIC);
+	opt[0] = 1; /* version 1.0 */
+	opt[1] = 0;
+	capture_write(c, opt, sizeof(opt));
+	capture_write_u32(c, 0xffffffff);
+	capture_write_u32(c, 0xffffffff);
+	capture_write_u32(c, 28);
+
+	/* Interface Description Block for each PD; interface ID is PD offset */
+	for (i = 0; i < c->num_rings; i++) {
+		r = c->rings + i;
+		name_len = (int)strnlen(r->name, sizeof(r->name));
+		len = 20 + 4 + PAD4(name_len) + 4;
+		capture_write_u32(c, PCAPNG_IDB);
+		capture_write_u32(c, len);
+		opt[0] = OSDP_PCAP_LINK_TYPE;
+		opt[1] = 0; /* reserved */
+		capture_write(c, opt, sizeof(opt));
+		capture_write_u32(c, OSDP_PACKET_BUF_SIZE);
+		opt[0] = PCAPNG_OPT_IF_NAME;
+		opt[1] = (uint16_t)name_len;
+		capture_write(c, opt, sizeof(opt));
+		capture_write(c, r->name, name_len);
+		capture_write(c, pad, PAD4(name_len) - name_len);
+		opt[0] = PCAPNG_OPT_END;
+		opt[1] = 0;
+		capture_write(c, opt, sizeof(opt));
+		if (capture_write_u32(c, len)) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int capture_open(struct osdp_capture *c)
+{
+	char path[256];
+
+	snprintf(path, sizeof(path), "%s-%u.pcapng", c->path, c->file_index);
+	c->file = fopen(path, "wb");
+	if (c->file == NULL) {
+		LOG_PRINT("Failed to open capture file '%s'", path);
+		return -1;
+	}
+	c->file_index++;
+	c->file_size = 0;
+	c->file_tstamp = osdp_millis_now();
+	if (capture_write_header(c)) {
+		LOG_PRINT("Failed to write capture file '%s'", path);
+		fclose(c->file);
+		c->file = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+static void capture_close(struct osdp_capture *c)
+{
+	if (c->file) {
+		fclose(c->file);
+		c->file = NULL;
+	}
+}
+
+static bool capture_needs_rotation(struct osdp_capture *c, uint32_t len)
+{
+	if (c->max_file_size && c->file_size + len > c->max_file_size) {
+		return true;
+	}
+	return (c->max_file_age_ms &&
+		osdp_millis_since(c->file_tstamp) >= c->max_file_age_ms);
+}
+
+static void capture_write_packet(struct osdp_capture *c, int interface,
+				 int64_t tstamp, const uint8_t *data, int len)
+{
+	const uint8_t pad[4] = { 0 };
+	uint64_t usec;
+	uint32_t block_len = 28 + PAD4(len) + 4;
+
+	if (c->file && capture_needs_rotation(c, block_len)) {
+		capture_close(c);
+		capture_open(c);
+	}
+	if (c->file == NULL) {
+		return;
+	}
+
+	/* Enhanced Packet Block; default timestamp resolution is 1 us */
+	usec = (uint64_t)(tstamp + c->wall_clock_offset) * 1000;
+	capture_write_u32(c, PCAPNG_EPB);
+	capture_write_u32(c, block_len);
+	capture_write_u32(c, (uint32_t)interface);
+	capture_write_u32(c, (uint32_t)(usec >> 32));
+	capture_write_u32(c, (uint32_t)usec);
+	capture_write_u32(c, (uint32_t)len);
+	capture_write_u32(c, (uint32_t)len);
+	capture_write(c, data, len);
+	capture_write(c, pad, PAD4(len) - len);
+	capture_write_u32(c, block_len);
+}
+
+static void capture_drain(struct osdp_capture *c)
+{
+	int i;
+	uint32_t head, tail, dropped;
+	struct capture_ring *r;
+
+	for (i = 0; i < c->num_rings; i++) {
+		r = c->rings + i;
+		head = osdp_atomic_load(&r->head);
+		tail = osdp_atomic_load(&r->tail);
+		while (tail != head) {
+			capture_write_packet(c, i,
+				r->slot[tail % OSDP_CAPTURE_RING_SIZE].tstamp,
+				r->slot[tail % OSDP_CAPTURE_RING_SIZE].data,
+				r->slot[tail % OSDP_CAPTURE_RING_SIZE].len);
+			tail++;
+			osdp_atomic_store(&r->tail, tail);
+		}
+		dropped = osdp_atomic_load(&r->dropped);
+		if (dropped != r->dropped_seen) {
+			LOG_PRINT("Capture: dropped %u packets of %s",
+				  dropped - r->dropped_seen, r->name);
+			r->dropped_seen = dropped;
+		}
+	}
+	if (c->file) {
+		fflush(c->file);
+	}
+}
+
+static void capture_timed_wait(struct osdp_capture *c, int64_t wait_ms)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += wait_ms / 1000;
+	ts.tv_nsec += (wait_ms % 1000) * 1000000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec += 1;
+		ts.tv_nsec -= 1000000000;
+	}
+	pthread_cond_timedwait(&c->cond, &c->lock, &ts);
+}
+
+/**
+ * The threads that refresh PDs never wake the writer (that would put a
+ * syscall in the bus timing path); it polls the rings every
+ * OSDP_CAPTURE_FLUSH_MS instead, which OSDP_CAPTURE_RING_SIZE must cover.
+ */
+static void *capture_thread(void *arg)
+{
+	struct osdp_capture *c = arg;
+
+	pthread_mutex_lock(&c->lock);
+	while (!c->stop) {
+		pthread_mutex_unlock(&c->lock);
+		capture_drain(c);
+		pthread_mutex_lock(&c->lock);
+		if (!c->stop) {
+			capture_timed_wait(c, OSDP_CAPTURE_FLUSH_MS);
+		}
+	}
+	pthread_mutex_unlock(&c->lock);
+	capture_drain(c);
+	return NULL;
+}
+
+static void capture_destroy(struct osdp_capture *c)
+{
+	capture_close(c);
+	pthread_cond_destroy(&c->cond);
+	pthread_mutex_destroy(&c->lock);
+	free(c->rings);
+	free(c->path);
+	free(c);
+}
+
+static struct osdp_capture *capture_create(struct osdp *ctx,
+				const struct osdp_capture_config *config)
+{
+	int i;
+	struct timespec ts;
+	struct osdp_pd *pd;
+	struct osdp_capture *c;
+
+	c = calloc(1, sizeof(struct osdp_capture));
+	if (c == NULL) {
+		return NULL;
+	}
+	c->num_rings = NUM_PD(ctx);
+	c->rings = calloc(c->num_rings, sizeof(struct capture_ring));
+	c->path = strdup(config->path);
+	if (c->rings == NULL || c->path == NULL ||
+	    pthread_mutex_init(&c->lock, NULL)) {
+		free(c->rings);
+		free(c->path);
+		free(c);
+		return NULL;
+	}
+	if (pthread_cond_init(&c->cond, NULL)) {
+		pthread_mutex_destroy(&c->lock);
+		free(c->rings);
+		free(c->path);
+		free(c);
+		return NULL;
+	}
+	c->max_file_size = config->max_file_size;
+	c->max_file_age_ms = (int64_t)config->max_file_age_sec * 1000;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	c->wall_clock_offset = (int64_t)ts.tv_sec * 1000 +
+			       ts.tv_nsec / 1000000 - osdp_millis_now();
+
+	for (i = 0; i < c->num_rings; i++) {
+		pd = osdp_to_pd(ctx, i);
+		osdp_atomic_store(&c->rings[i].enabled, 1);
+		strncpy(c->rings[i].name, pd ? pd->name : "-",
+			sizeof(c->rings[i].name) - 1);
+	}
+	return c;
+}
+
+/* Hook the rings to their PDs; the groups are locked while this is done */
+static void capture_attach(struct osdp *ctx, struct osdp_capture *c)
+{
+	int i;
+	struct osdp_pd *pd;
+
+	for (i = 0; i < NUM_PD(ctx); i++) {
+		pd = osdp_to_pd(ctx, i);
+		if (pd != NULL) {
+			pd->capture = (c && i < c->num_rings) ? c->rings + i :
+								NULL;
+		}
+	}
+}
+
+static void capture_lock_all(struct osdp *ctx)
+{
+	int i;
+
+	for (i = 0; i < ctx->num_sched; i++) {
+		osdp_cp_worker_lock(ctx->sched[i]);
+	}
+}
+
+static void capture_unlock_all(struct osdp *ctx)
+{
+	int i;
+
+	for (i = ctx->num_sched - 1; i >= 0; i--) {
+		osdp_cp_worker_unlock(ctx->sched[i]);
+	}
+}
+
+int osdp_capture_writer_start(struct osdp *ctx,
+			      const struct osdp_capture_config *config)
+{
+	struct osdp_capture *c;
+
+	if (ctx->capture) {
+		LOG_PRINT("Capture already running");
+		return -1;
+	}
+
+	c = capture_create(ctx, config);
+	if (c == NULL) {
+		LOG_PRINT("Failed to allocate capture context");
+		return -1;
+	}
+	if (capture_open(c)) {
+		capture_destroy(c);
+		return -1;
+	}
+	if (pthread_create(&c->thread, NULL, capture_thread, c)) {
+		LOG_PRINT("Failed to start capture writer thread");
+		capture_destroy(c);
+		return -1;
+	}
+
+	capture_lock_all(ctx);
+	capture_attach(ctx, c);
+	ctx->capture = c;
+	capture_unlock_all(ctx);
+	return 0;
+}
+
+void osdp_capture_writer_stop(struct osdp *ctx)
+{
+	struct osdp_capture *c = ctx->capture;
+
+	if (c == NULL) {
+		return;
+	}
+
+	capture_lock_all(ctx);
+	capture_attach(ctx, NULL);
+	ctx->capture = NULL;
+	capture_unlock_all(ctx);
+
+	pthread_mutex_lock(&c->lock);
+	c->stop = true;
+	pthread_cond_signal(&c->cond);
+	pthread_mutex_unlock(&c->lock);
+	pthread_join(c->thread, NULL);
+
+	LOG_PRINT("Capture stopped; wrote %u file(s) to '%s-*.pcapng'",
+		  c->file_index, c->path);
+	capture_destroy(c);
+}
+
+void osdp_capture_writer_add(struct osdp_pd *pd, const uint8_t *buf, int len,
+			     int id)
+{
+	struct capture_ring *r = pd->capture;
+	uint32_t head;
+	int i;
+
+	if (!osdp_atomic_load(&r->enabled)) {
+		return;
+	}
+	if (osdp_atomic_load(&r->filter_on) &&
+	    (id < 0 || !(osdp_atomic_load(&r->filter[id / 32]) &
+			 (1U << (id % 32))))) {
+		return;
+	}
+
+	head = osdp_atomic_load(&r->head);
+	if (head - osdp_atomic_load(&r->tail) >= OSDP_CAPTURE_RING_SIZE) {
+		osdp_atomic_add(&r->dropped, 1);
+		return;
+	}
+	i = (int)(head % OSDP_CAPTURE_RING_SIZE);
+	r->slot[i].tstamp = osdp_millis_now();
+	r->slot[i].len = (len < OSDP_PACKET_BUF_SIZE) ? len :
+						       OSDP_PACKET_BUF_SIZE;
+	memcpy(r->slot[i].data, buf, r->slot[i].len);
+	osdp_atomic_store(&r->head, head + 1);
+}
+
+void osdp_capture_writer_enable(struct osdp_pd *pd, bool enable)
+{
+	struct capture_ring *r = pd->capture;
+
+	osdp_atomic_store(&r->enabled, enable ? 1 : 0);
+}
+
+void osdp_capture_writer_filter(struct osdp_pd *pd, const uint8_t *ids,
+				int num_ids)
+{
+	struct capture_ring *r = pd->capture;
+	uint32_t filter[256 / 32] = { 0 };
+	int i;
+
+	for (i = 0; i < num_ids; i++) {
+		filter[ids[i] / 32] |= 1U << (ids[i] % 32);
+	}
+	osdp_atomic_store(&r->filter_on, 0);
+	for (i = 0; i < 256 / 32; i++) {
+		osdp_atomic_store(&r->filter[i], filter[i]);
+	}
+	osdp_atomic_store(&r->filter_on, num_ids > 0);
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2025 Siddharth Chandrasekaran <sidcha.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _OSDP_CAPTURE_H_
+#define _OSDP_CAPTURE_H_
+
+#include "osdp_common.h"
+
+#if defined(OPT_OSDP_CAPTURE_WRITER)
+
+int osdp_capture_writer_start(struct osdp *ctx,
+			      const struct osdp_capture_config *config);
+void osdp_capture_writer_stop(struct osdp *ctx);
+void osdp_capture_writer_add(struct osdp_pd *pd, const uint8_t *buf, int len,
+			     int id);
+void osdp_capture_writer_enable(struct osdp_pd *pd, bool enable);
+void osdp_capture_writer_filter(struct osdp_pd *pd, const uint8_t *ids,
+				int num_ids);
+
+#else
+
+static inline int osdp_capture_writer_start(struct osdp *ctx,
+				const struct osdp_capture_config *config)
+{
+	ARG_UNUSED(ctx);
+	ARG_UNUSED(config);
+	return -1;
+}
+
+static inline void osdp_capture_writer_stop(struct osdp *ctx)
+{
+	ARG_UNUSED(ctx);
+}
+
+static inline void osdp_capture_writer_add(struct osdp_pd *pd,
+					   const uint8_t *buf, int len, int id)
+{
+	ARG_UNUSED(pd);
+	ARG_UNUSED(buf);
+	ARG_UNUSED(len);
+	ARG_UNUSED(id);
+}
+
+static inline void osdp_capture_writer_enable(struct osdp_pd *pd, bool enable)
+{
+	ARG_UNUSED(pd);
+	ARG_UNUSED(enable);
+}
+
+static inline void osdp_capture_writer_filter(struct osdp_pd *pd,
+					      const uint8_t *ids, int num_ids)
+{
+	ARG_UNUSED(pd);
+	ARG_UNUSED(ids);
+	ARG_UNUSED(num_ids);
+}
+
+#endif
+
+#endif /* _OSDP_CAPTURE_H_ */
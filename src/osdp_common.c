@@ -14,13 +14,7 @@
 #endif
 
 #include "osdp_common.h"
-
-#include <utils/crc16.h>
-
-uint16_t osdp_compute_crc16(const uint8_t *buf, size_t len)
-{
-	return crc16_itu_t(0x1D0F, buf, len);
-}
+#include "osdp_capture.h"
 
 __weak int64_t osdp_millis_now(void)
 {
@@ -134,15 +128,19 @@ int osdp_rb_push(struct osdp_rb *p, uint8_t data)
 
 int osdp_rb_push_buf(struct osdp_rb *p, uint8_t *buf, int len)
 {
-	int i;
-
-	for (i = 0; i < len; i++) {
-		if (osdp_rb_push(p, buf[i])) {
-			break;
-		}
+	int n, total = 0;
+	uint8_t *ptr;
+
+	/* At most two spans: up to the end of buffer and then from its start */
+	while (total < len && (n = osdp_rb_write_view(p, 0, &ptr)) > 0) {
+		if (n > len - total)
+			n = len - total;
+		memcpy(ptr, buf + total, n);
+		osdp_rb_commit(p, n);
+		total += n;
 	}
 
-	return i;
+	return total;
 }
 
 int osdp_rb_pop(struct osdp_rb *p, uint8_t *data)
@@ -163,15 +161,202 @@ int osdp_rb_pop(struct osdp_rb *p, uint8_t *data)
 
 int osdp_rb_pop_buf(struct osdp_rb *p, uint8_t *buf, int max_len)
 {
-	int i;
+	int n, total = 0;
+	uint8_t *ptr;
+
+	while (total < max_len && (n = osdp_rb_read_view(p, 0, &ptr)) > 0) {
+		if (n > max_len - total)
+			n = max_len - total;
+		memcpy(buf + total, ptr, n);
+		osdp_rb_consume(p, n);
+		total += n;
+	}
+
+	return total;
+}
+
+int osdp_rb_len(struct osdp_rb *p)
+{
+	if (p->head >= p->tail)
+		return (int)(p->head - p->tail);
+	return (int)(sizeof(p->buffer) - p->tail + p->head);
+}
+
+int osdp_rb_write_view(struct osdp_rb *p, int offset, uint8_t **ptr)
+{
+	size_t start, end;
+
+	/* One slot is always left empty to tell a full ring from an empty one */
+	if (offset >= (int)sizeof(p->buffer) - 1 - osdp_rb_len(p))
+		return 0;
+
+	start = p->head + offset;
+	if (start >= sizeof(p->buffer))
+		start -= sizeof(p->buffer);
+
+	if (start >= p->tail) {
+		end = sizeof(p->buffer);
+		if (p->tail == 0)
+			end -= 1;
+	} else {
+		end = p->tail - 1;
+	}
+
+	*ptr = p->buffer + start;
+	return (int)(end - start);
+}
+
+void osdp_rb_commit(struct osdp_rb *p, int len)
+{
+	size_t next = p->head + len;
+
+	if (next >= sizeof(p->buffer))
+		next -= sizeof(p->buffer);
+	p->head = next;
+}
+
+int osdp_rb_read_view(struct osdp_rb *p, int offset, uint8_t **ptr)
+{
+	size_t start;
+
+	if (offset >= osdp_rb_len(p))
+		return 0;
+
+	start = p->tail + offset;
+	if (start >= sizeof(p->buffer))
+		start -= sizeof(p->buffer);
+
+	*ptr = p->buffer + start;
+	if (p->head > start)
+		return (int)(p->head - start);
+	return (int)(sizeof(p->buffer) - start);
+}
+
+void osdp_rb_consume(struct osdp_rb *p, int len)
+{
+	size_t next;
+
+	if (len > osdp_rb_len(p))
+		len = osdp_rb_len(p);
+
+	next = p->tail + len;
+	if (next >= sizeof(p->buffer))
+		next -= sizeof(p->buffer);
+	p->tail = next;
+}
+
+int osdp_rb_find(struct osdp_rb *p, int offset, uint8_t byte)
+{
+	uint8_t *ptr, *found;
+	int n;
 
-	for (i = 0; i < max_len; i++) {
-		if (osdp_rb_pop(p, buf + i)) {
-			break;
+	while ((n = osdp_rb_read_view(p, offset, &ptr)) > 0) {
+		found = memchr(ptr, byte, n);
+		if (found) {
+			return offset + (int)(found - ptr);
 		}
+		offset += n;
+	}
+	return -1;
+}
+
+uint8_t *osdp_rb_peek(struct osdp_rb *p, int offset, uint8_t *tmp, int len)
+{
+	uint8_t *ptr;
+	int n;
+
+	if (osdp_rb_len(p) - offset < len)
+		return NULL;
+
+	n = osdp_rb_read_view(p, offset, &ptr);
+	if (n >= len)
+		return ptr;
+
+	/* Wraps around the end of the ring; stitch both spans into tmp */
+	memcpy(tmp, ptr, n);
+	osdp_rb_read_view(p, offset + n, &ptr);
+	memcpy(tmp + n, ptr, len - n);
+	return tmp;
+}
+
+void osdp_flight_recorder_add(struct osdp_pd *pd, const uint8_t *buf, int len)
+{
+	struct osdp_flight_recorder *r = &pd->recorder;
+	int i = (int)(r->count % OSDP_FLIGHT_RECORDER_DEPTH);
+
+	r->entry[i].tstamp = osdp_millis_now();
+	r->entry[i].len = (uint16_t)len;
+	if (len > OSDP_FLIGHT_RECORDER_SNAPLEN) {
+		len = OSDP_FLIGHT_RECORDER_SNAPLEN;
+	}
+	memcpy(r->entry[i].data, buf, len);
+	r->count++;
+}
+
+static void pcap_put_u32(uint8_t *buf, int *pos, uint32_t val)
+{
+	memcpy(buf + *pos, &val, sizeof(val));
+	*pos += (int)sizeof(val);
+}
+
+static int flight_recorder_dump(struct osdp_pd *pd, uint8_t *buf, int max_len)
+{
+	const struct osdp_flight_recorder *r = &pd->recorder;
+	uint32_t i, n, start, len, caplen;
+	int pos = 0, e;
+
+	n = r->count;
+	if (n > OSDP_FLIGHT_RECORDER_DEPTH) {
+		n = OSDP_FLIGHT_RECORDER_DEPTH;
 	}
+	start = r->count - n;
 
-	return i;
+	/* pcap file header: native byte order with microsecond timestamps */
+	if (max_len < 24) {
+		return -1;
+	}
+	pcap_put_u32(buf, &pos, 0xa1b2c3d4);
+	pcap_put_u32(buf, &pos, 2 | (4 << 16)); /* version 2.4 */
+	pcap_put_u32(buf, &pos, 0);             /* thiszone */
+	pcap_put_u32(buf, &pos, 0);             /* sigfigs */
+	pcap_put_u32(buf, &pos, OSDP_FLIGHT_RECORDER_SNAPLEN);
+	pcap_put_u32(buf, &pos, OSDP_PCAP_LINK_TYPE);
+
+	for (i = 0; i < n; i++) {
+		e = (int)((start + i) % OSDP_FLIGHT_RECORDER_DEPTH);
+		len = r->entry[e].len;
+		caplen = len;
+		if (caplen > OSDP_FLIGHT_RECORDER_SNAPLEN) {
+			caplen = OSDP_FLIGHT_RECORDER_SNAPLEN;
+		}
+		if (pos + 16 + (int)caplen > max_len) {
+			return -1;
+		}
+		pcap_put_u32(buf, &pos, (uint32_t)(r->entry[e].tstamp / 1000));
+		pcap_put_u32(buf, &pos,
+			     (uint32_t)(r->entry[e].tstamp % 1000) * 1000);
+		pcap_put_u32(buf, &pos, caplen);
+		pcap_put_u32(buf, &pos, len);
+		memcpy(buf + pos, r->entry[e].data, caplen);
+		pos += (int)caplen;
+	}
+	return pos;
+}
+
+void osdp_flight_recorder_trigger(struct osdp_pd *pd, int trigger)
+{
+	struct osdp *ctx = pd_to_osdp(pd);
+	int len;
+
+	if (!ctx->recorder_callback) {
+		return;
+	}
+	len = flight_recorder_dump(pd, ctx->recorder_buf,
+				   OSDP_FLIGHT_RECORDER_PCAP_MAX);
+	if (len > 0) {
+		ctx->recorder_callback(ctx->recorder_callback_arg, pd->idx,
+				       trigger, ctx->recorder_buf, len);
+	}
 }
 
 /* --- Exported Methods --- */
@@ -218,50 +403,177 @@ const char *osdp_get_source_info()
 	}
 }
 
+/**
+ * CP mode keeps a bit per PD in words of 32 (see cp_snapshot_sync_state());
+ * copy them out as bytes.
+ */
+static void osdp_copy_pd_mask(const osdp_t *ctx, osdp_atomic_t *words,
+			      uint8_t *bitmask)
+{
+	int i;
+	unsigned int word = 0;
+
+	bitmask[0] = 0;
+	for (i = 0; i < (NUM_PD(ctx) + 7) / 8; i++) {
+		if ((i & 3) == 0) {
+			word = osdp_atomic_load(words + i / 4);
+		}
+		bitmask[i] = (uint8_t)(word >> ((i & 3) * 8));
+	}
+}
+
 void osdp_get_sc_status_mask(const osdp_t *ctx, uint8_t *bitmask)
 {
 	input_check(ctx);
-	int i, pos;
-	uint8_t *mask = bitmask;
-	struct osdp_pd *pd;
+	struct osdp_pd *pd = GET_CURRENT_PD(ctx);
 
-	*mask = 0;
-	for (i = 0; i < NUM_PD(ctx); i++) {
-		pos = i & 0x07;
-		if (i && pos == 0) {
-			mask++;
-			*mask = 0;
-		}
-		pd = osdp_to_pd(ctx, i);
-		if (ISSET_FLAG(pd, PD_FLAG_SC_ACTIVE) &&
-		    !ISSET_FLAG(pd, PD_FLAG_SC_USE_SCBKD)) {
-			*mask |= 1 << pos;
-		}
+	if (pd && ISSET_FLAG(pd, PD_FLAG_PD_MODE)) {
+		*bitmask = ISSET_FLAG(pd, PD_FLAG_SC_ACTIVE) &&
+			   !ISSET_FLAG(pd, PD_FLAG_SC_USE_SCBKD);
+		return;
 	}
+
+	osdp_copy_pd_mask(ctx, TO_OSDP(ctx)->sc_mask, bitmask);
 }
 
 void osdp_get_status_mask(const osdp_t *ctx, uint8_t *bitmask)
 {
 	input_check(ctx);
-	int i, pos;
-	uint8_t *mask = bitmask;
-	struct osdp_pd *pd = osdp_to_pd(ctx, 0);
+	struct osdp_pd *pd = GET_CURRENT_PD(ctx);
 
-	if (ISSET_FLAG(pd, PD_FLAG_PD_MODE)) {
-		*mask = osdp_millis_since(pd->tstamp) < OSDP_PD_ONLINE_TOUT_MS;
+	if (pd && ISSET_FLAG(pd, PD_FLAG_PD_MODE)) {
+		*bitmask = osdp_millis_since(pd->tstamp) < OSDP_PD_ONLINE_TOUT_MS;
 		return;
 	}
 
-	*mask = 0;
-	for (i = 0; i < NUM_PD(ctx); i++) {
-		pos = i & 0x07;
-		if (i && pos == 0) {
-			mask++;
-			*mask = 0;
+	osdp_copy_pd_mask(ctx, TO_OSDP(ctx)->online_mask, bitmask);
+}
+
+int osdp_get_pd_stats(osdp_t *ctx, int pd_idx, struct osdp_pd_stats *stats,
+		      bool reset)
+{
+	input_check(ctx, pd_idx);
+	size_t i;
+	uint32_t now, *base;
+	struct osdp_pd *pd = osdp_pd_get(ctx, pd_idx);
+	uint32_t *cur = (uint32_t *)stats;
+
+	if (pd == NULL) {
+		return -1;
+	}
+	base = (uint32_t *)&pd->stats_base;
+
+	/**
+	 * The counters only ever go up (modulo 2^32) so a reset just moves
+	 * the base line; the thread that owns pd->stats is never disturbed.
+	 * struct osdp_pd_stats is made of uint32_t counters only.
+	 */
+	memcpy(stats, &pd->stats, sizeof(struct osdp_pd_stats));
+	for (i = 0; i < sizeof(struct osdp_pd_stats) / sizeof(uint32_t); i++) {
+		now = cur[i];
+		cur[i] = now - base[i];
+		if (reset) {
+			base[i] = now;
 		}
-		pd = osdp_to_pd(ctx, i);
-		if (pd->state == OSDP_CP_STATE_ONLINE) {
-			*mask |= 1 << pos;
+	}
+	osdp_pd_put(pd);
+	return 0;
+}
+
+int osdp_get_flight_recorder(const osdp_t *ctx, int pd_idx, uint8_t *buf,
+			     int max_len)
+{
+	input_check(ctx, pd_idx);
+	int rc;
+	struct osdp_pd *pd;
+
+	if (buf == NULL) {
+		return -1;
+	}
+	pd = osdp_pd_get(ctx, pd_idx);
+	if (pd == NULL) {
+		return -1;
+	}
+	rc = flight_recorder_dump(pd, buf, max_len);
+	osdp_pd_put(pd);
+	return rc;
+}
+
+int osdp_set_flight_recorder_callback(osdp_t *ctx,
+				      osdp_flight_recorder_callback_t cb,
+				      void *arg)
+{
+	input_check(ctx);
+	struct osdp *p = TO_OSDP(ctx);
+
+	if (cb && p->recorder_buf == NULL) {
+		p->recorder_buf = malloc(OSDP_FLIGHT_RECORDER_PCAP_MAX);
+		if (p->recorder_buf == NULL) {
+			LOG_PRINT("Failed to allocate flight recorder buffer");
+			return -1;
 		}
 	}
+	p->recorder_callback = cb;
+	p->recorder_callback_arg = arg;
+	return 0;
+}
+
+int osdp_capture_start(osdp_t *ctx, const struct osdp_capture_config *config)
+{
+	input_check(ctx);
+
+	if (!IS_ENABLED(OPT_OSDP_CAPTURE_WRITER)) {
+		LOG_PRINT("Capture writer needs OPT_OSDP_CAPTURE_WRITER");
+		return -1;
+	}
+	if (config == NULL || config->path == NULL) {
+		return -1;
+	}
+	return osdp_capture_writer_start(TO_OSDP(ctx), config);
+}
+
+void osdp_capture_stop(osdp_t *ctx)
+{
+	input_check(ctx);
+
+	osdp_capture_writer_stop(TO_OSDP(ctx));
+}
+
+int osdp_capture_enable(osdp_t *ctx, int pd_idx, bool enable)
+{
+	input_check(ctx, pd_idx);
+	int rc = -1;
+	struct osdp_pd *pd = osdp_pd_get(ctx, pd_idx);
+
+	if (pd == NULL) {
+		return -1;
+	}
+	if (pd->capture != NULL) {
+		osdp_capture_writer_enable(pd, enable);
+		rc = 0;
+	}
+	osdp_pd_put(pd);
+	return rc;
+}
+
+int osdp_capture_set_filter(osdp_t *ctx, int pd_idx, const uint8_t *ids,
+			    int num_ids)
+{
+	input_check(ctx, pd_idx);
+	int rc = -1;
+	struct osdp_pd *pd;
+
+	if (num_ids < 0 || (num_ids && ids == NULL)) {
+		return -1;
+	}
+	pd = osdp_pd_get(ctx, pd_idx);
+	if (pd == NULL) {
+		return -1;
+	}
+	if (pd->capture != NULL) {
+		osdp_capture_writer_filter(pd, ids, num_ids);
+		rc = 0;
+	}
+	osdp_pd_put(pd);
+	return rc;
 }
@@ -32,6 +32,87 @@
 #define NULL ((void *)0)
 #endif
 
+/**
+ * Atomics for the few members that application threads touch without taking
+ * any lock (see osdp_cp_submit_command). Bare metal builds have no threads to
+ * speak of and some toolchains lack C11 atomics; there they are plain
+ * accesses and CP worker threads cannot be used.
+ */
+#if !defined(__BARE_METAL__) && !defined(__STDC_NO_ATOMICS__) && \
+    defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#include <stdatomic.h>
+
+typedef atomic_uint osdp_atomic_t;
+
+#define osdp_atomic_load(p)     atomic_load_explicit(p, memory_order_acquire)
+#define osdp_atomic_store(p, v) atomic_store_explicit(p, v, memory_order_release)
+#define osdp_atomic_add(p, v)   atomic_fetch_add_explicit(p, v, memory_order_acq_rel)
+#define osdp_atomic_sub(p, v)   atomic_fetch_sub_explicit(p, v, memory_order_acq_rel)
+#define osdp_atomic_or(p, v)    atomic_fetch_or_explicit(p, v, memory_order_acq_rel)
+#define osdp_atomic_and(p, v)   atomic_fetch_and_explicit(p, v, memory_order_acq_rel)
+#define osdp_atomic_acquire_fence() atomic_thread_fence(memory_order_acquire)
+#define osdp_atomic_release_fence() atomic_thread_fence(memory_order_release)
+#define osdp_atomic_fence()     atomic_thread_fence(memory_order_seq_cst)
+#define osdp_atomic_cas(p, e, v)                                               \
+	atomic_compare_exchange_weak_explicit(p, e, v, memory_order_acq_rel,  \
+					      memory_order_relaxed)
+#else
+#if defined(OPT_OSDP_CP_WORKERS)
+#error "OPT_OSDP_CP_WORKERS needs C11 atomics"
+#endif
+typedef unsigned int osdp_atomic_t;
+
+#define osdp_atomic_load(p)     (*(p))
+#define osdp_atomic_store(p, v) (*(p) = (v))
+
+static inline unsigned int osdp_atomic_add(osdp_atomic_t *p, unsigned int v)
+{
+	unsigned int old = *p;
+
+	*p = old + v;
+	return old;
+}
+
+static inline unsigned int osdp_atomic_sub(osdp_atomic_t *p, unsigned int v)
+{
+	unsigned int old = *p;
+
+	*p = old - v;
+	return old;
+}
+
+static inline unsigned int osdp_atomic_or(osdp_atomic_t *p, unsigned int v)
+{
+	unsigned int old = *p;
+
+	*p = old | v;
+	return old;
+}
+
+static inline unsigned int osdp_atomic_and(osdp_atomic_t *p, unsigned int v)
+{
+	unsigned int old = *p;
+
+	*p = old & v;
+	return old;
+}
+
+#define osdp_atomic_acquire_fence()
+#define osdp_atomic_release_fence()
+#define osdp_atomic_fence()
+
+static inline bool osdp_atomic_cas(osdp_atomic_t *p, unsigned int *expected,
+				   unsigned int v)
+{
+	if (*p != *expected) {
+		*expected = *p;
+		return false;
+	}
+	*p = v;
+	return true;
+}
+#endif
+
 #define OSDP_CTX_MAGIC 0xDEADBEAF
 
 #define ARG_UNUSED(x) (void)(x)
@@ -141,7 +222,7 @@ static inline __noreturn void die()
 		} \
 	} while (0)
 
-/* Unused type only to estimate ephemeral_data size */
+/* Only used to size and align osdp_pd::ephemeral_data */
 union osdp_ephemeral_data {
 	struct osdp_cmd cmd;
 	struct osdp_event event;
@@ -168,7 +249,8 @@ union osdp_ephemeral_data {
 #define input_check_pd_offset(_ctx, _pd) do { \
 		struct osdp *__ctx = (struct osdp *)_ctx; \
 		int __pd = _pd; \
-		if (__pd < 0 || __pd >= __ctx->_num_pd) { \
+		if (__pd < 0 || __pd >= __ctx->_num_pd || \
+		    __ctx->pd[__pd] == NULL) { \
 			LOG_PRINT("Invalid PD number %d", __pd); \
 			return -1; \
 		} \
@@ -263,6 +345,7 @@ union osdp_ephemeral_data {
 #define PD_FLAG_TAMPER         BIT(1)  /* local tamper status */
 #define PD_FLAG_POWER          BIT(2)  /* local power status */
 #define PD_FLAG_R_TAMPER       BIT(3)  /* remote tamper status */
+#define PD_FLAG_CHN_WAIT       BIT(4)  /* waiting for shared channel lock */
 #define PD_FLAG_SKIP_SEQ_CHECK BIT(5)  /* disable seq checks (debug) */
 #define PD_FLAG_SC_USE_SCBKD   BIT(6)  /* in this SC attempt, use SCBKD */
 #define PD_FLAG_SC_ACTIVE      BIT(7)  /* secure channel is active */
@@ -282,6 +365,16 @@ union osdp_ephemeral_data {
 #define CP_REQ_DISABLE                 0x00000008
 #define CP_REQ_ENABLE                  0x00000010
 
+/* PD scheduler deadline for PDs with no pending work */
+#define CP_SCHED_NEVER                 INT64_MAX
+#define CP_SCHED_URGENT                0 /* ahead of anything merely due */
+
+/* Words in the online/SC bit masks of struct osdp (a bit per PD) */
+#define CP_PD_MASK_WORDS               ((OSDP_PD_MAX + 31) / 32)
+
+/* Event callbacks held back per group until its lock is released */
+#define CP_SCHED_EVENTS_MAX            8
+
 enum osdp_cp_phy_state_e {
 	OSDP_CP_PHY_STATE_IDLE,
 	OSDP_CP_PHY_STATE_SEND_CMD,
@@ -304,6 +397,14 @@ enum osdp_cp_state_e {
 	OSDP_CP_STATE_SENTINEL
 };
 
+/* CP command queues; served in this order, all ahead of file transfer */
+enum osdp_cp_cmd_prio_e {
+	OSDP_CP_CMD_PRIO_URGENT,
+	OSDP_CP_CMD_PRIO_NORMAL,
+	OSDP_CP_CMD_PRIO_BACKGROUND,
+	OSDP_CP_CMD_PRIO_SENTINEL
+};
+
 enum osdp_pkt_errors_e {
 	OSDP_ERR_PKT_NONE = 0,
 	/**
@@ -367,6 +468,16 @@ struct osdp_secure_channel {
 	uint8_t pd_cryptogram[16];
 };
 
+/**
+ * Byte ring buffer. Besides the byte/buffer push and pop, callers can work on
+ * the contiguous spans of the ring directly:
+ *
+ *  - osdp_rb_write_view() + osdp_rb_commit(): fill free space in place
+ *  - osdp_rb_read_view() + osdp_rb_consume(): inspect/drop data in place
+ *  - osdp_rb_peek(): get `len` bytes at an offset; in place when they don't
+ *    wrap around the end of the buffer, else copied into a scratch buffer
+ *  - osdp_rb_find(): offset of the first occurrence of a byte (memchr)
+ */
 struct osdp_rb {
     size_t head;
     size_t tail;
@@ -382,54 +493,203 @@ struct osdp_app_data_pool {
 	uint8_t slab_blob[OSDP_APP_DATA_QUEUE_SIZE];
 };
 
-struct osdp_pd {
-	char name[OSDP_PD_NAME_MAXLEN];
-	struct osdp *osdp_ctx; /* Ref to osdp * to access shared resources */
-	int idx;               /* Offset into osdp->pd[] for this PD */
-	uint32_t flags;        /* Used with: ISSET_FLAG, SET_FLAG, CLEAR_FLAG */
-
-	uint32_t baud_rate;    /* Serial baud/bit rate */
-	int address;           /* PD address */
-	int seq_number;        /* Current packet sequence number */
-	struct osdp_pd_id id;  /* PD ID information (as received from app) */
-
-	/* PD Capability; Those received from app + implicit capabilities */
-	struct osdp_pd_cap cap[OSDP_PD_CAP_SENTINEL];
-
-	int state;             /* FSM state (CP mode only) */
-	int phy_state;         /* phy layer FSM state (CP mode only) */
-	int phy_retry_count;   /* command retry counter */
-	uint32_t wait_ms;      /* wait time in MS to retry communication */
-	int64_t tstamp;        /* Last POLL command issued time in ticks */
-	int64_t sc_tstamp;     /* Last received secure reply time in ticks */
-	int64_t phy_tstamp;    /* Time in ticks since command was sent */
-	uint32_t request;      /* Event loop requests */
-
-	uint16_t peer_rx_size; /* Receive buffer size of the peer PD/CP */
+/**
+ * CP command pool shared by all PDs of a context. Commands are carved out of
+ * chunks of OSDP_CP_CMD_POOL_SIZE that are allocated on demand (up to max)
+ * and recycled through a free list; they are released only on teardown.
+ *
+ * Submitters reserve room in the pool (in_use) before posting a command so
+ * that a command that was accepted always finds a free node later on.
+ */
+struct osdp_cmd_pool {
+	void *free_list;       /* Free commands (struct cp_cmd_node) */
+	void *chunks;          /* Allocated chunks of commands */
+	int capacity;          /* Number of commands allocated so far */
+	osdp_atomic_t in_use;  /* Number of commands reserved by submitters */
+	osdp_atomic_t max;     /* Upper limit for capacity */
+	void *lock;            /* Pool lock (only with OPT_OSDP_CP_WORKERS) */
+};
 
-	/* Raw bytes received from the serial line for this PD */
+/**
+ * Receive ring and packet scratch space of a channel. On a half-duplex bus
+ * only the PD that holds the channel lock can be in a transaction so this is
+ * shared by all PDs on the channel.
+ */
+struct osdp_chn_buf {
+	/* Raw bytes received from the serial line */
 	struct osdp_rb rx_rb;
 	uint8_t packet_buf[OSDP_PACKET_BUF_SIZE];
 	unsigned long packet_len;
 	unsigned long packet_buf_len;
 	uint32_t packet_scan_skip;
+	/* Bytes at the tail of rx_rb that belong to the packet being received */
+	unsigned long rx_held;
+	/* Received packet; points into rx_rb or packet_buf (if it wrapped) */
+	uint8_t *rx_pkt;
+	/* CRC (or byte sum) of the packet so far, updated as bytes arrive */
+	uint16_t rx_check;
+	unsigned long rx_check_pos;
+	unsigned long rx_check_end;
+	/* Trailing data of the packet being sent that is not in packet_buf */
+	struct osdp_iovec tx_payload;
+};
+
+/* Per-channel (bus) state; shared by all PDs on the channel */
+struct osdp_bus {
+	int64_t poll_gate;     /* Earliest time for the next POLL */
+	int64_t probe_gate;    /* Earliest time for the next offline PD probe */
+	int num_pd;            /* PDs on this channel; closed when it drops to 0 */
+	int owner;             /* PD offset holding the channel lock (or -1) */
+	struct osdp_chn_buf buf;
+};
 
+/* A group of PDs that are scheduled (and refreshed) together */
+struct osdp_sched {
+	int *heap;             /* min-heap of PD offsets keyed by sched_deadline */
+	int *due;              /* PD offsets due in the current refresh cycle */
+	int len;               /* Number of PDs currently in heap */
+	int num_chn_waiters;   /* PDs waiting for a shared channel lock */
+	struct osdp_pd *refreshing; /* PD in cp_refresh() right now (if any) */
+	osdp_atomic_t posted;  /* Bumped when a command is posted to a PD here */
+	unsigned int posted_seen; /* posted as of last refresh */
+	void *worker;          /* Worker thread servicing this group (if any) */
+	int num_events;        /* Callbacks in events[] yet to be made */
+	struct {
+		int pd;
+		struct osdp_event event;
+	} events[CP_SCHED_EVENTS_MAX];
+};
+
+/**
+ * Last packets sent/received for a PD; written by the thread that refreshes
+ * it. count is the number of packets ever recorded so the oldest entry is at
+ * count % OSDP_FLIGHT_RECORDER_DEPTH once the ring has wrapped.
+ */
+struct osdp_flight_recorder {
+	uint32_t count;
+	struct {
+		int64_t tstamp;
+		uint16_t len;  /* length on the wire; only SNAPLEN bytes kept */
+		uint8_t data[OSDP_FLIGHT_RECORDER_SNAPLEN];
+	} entry[OSDP_FLIGHT_RECORDER_DEPTH];
+};
+
+/**
+ * Log-linear histogram of command latencies (in ms). Values below 4 have a
+ * bucket each; each power of 2 above that is split into 4 equal buckets. The
+ * last bucket (7168-8191 ms) also takes everything above it.
+ */
+#define OSDP_LATENCY_BUCKETS 48
+
+struct osdp_latency_hist {
+	uint32_t count;
+	uint32_t max_ms;
+	uint32_t bucket[OSDP_LATENCY_BUCKETS];
+};
+
+/**
+ * State of a PD published by the thread that refreshes it for app threads to
+ * read without locks. seq is odd while an update is in progress.
+ */
+struct osdp_snapshot {
+	osdp_atomic_t seq;
+	int64_t last_seen;     /* Time of the last valid reply; 0 if none */
+	struct osdp_pd_snapshot view;
+};
+
+/**
+ * Members used by the refresh sweep (scheduling and FSM state) come first so
+ * that they share as few cache lines as possible; identity, capabilities and
+ * other rarely touched state follows.
+ */
+struct osdp_pd {
+	/* -- hot: touched on every refresh of this PD -- */
+	struct osdp *osdp_ctx; /* Ref to osdp * to access shared resources */
+	uint32_t flags;        /* Used with: ISSET_FLAG, SET_FLAG, CLEAR_FLAG */
+	int idx;               /* Offset into osdp->pd[] for this PD */
+	int state;             /* FSM state (CP mode only) */
+	int phy_state;         /* phy layer FSM state (CP mode only) */
+	uint32_t request;      /* Event loop requests */
+	int64_t sched_deadline; /* Next time cp_refresh() has work for this PD */
+	int sched_pos;         /* Offset of this PD in its osdp_sched->heap */
+	int sched_id;          /* Offset into osdp->sched[] for this PD */
+	int chn_slot;          /* Number of this PD's channel; see pd->bus */
+	int64_t tstamp;        /* Last POLL command issued time in ticks */
+	uint32_t poll_ms;      /* Current (adaptive) POLL interval */
+	uint32_t wait_ms;      /* wait time in MS to retry communication */
+	int64_t phy_tstamp;    /* Time in ticks since command was sent */
+	int64_t sc_tstamp;     /* Last received secure reply time in ticks */
 	int cmd_id;            /* Currently processing command ID */
 	int reply_id;          /* Currently processing reply ID */
 
-	/* Data bytes of the current command/reply ID */
-	uint8_t ephemeral_data[OSDP_EPHEMERAL_DATA_MAX_LEN];
+	/* Channel of this PD; chn_buf is its RX ring and packet scratch space */
+	struct osdp_bus *bus;
+	struct osdp_chn_buf *chn_buf;
+
+	int phy_retry_count;   /* command retry counter */
+	int phy_busy_count;    /* consecutive BUSY replies to current command */
+	int32_t srtt;          /* Smoothed reply turnaround time (ms, x8) */
+	int32_t rttvar;        /* Reply turnaround time variation (ms, x4) */
+	int tx_len;            /* Length of the last command sent */
+	void *capture;         /* Capture ring (see osdp_capture.c) if running */
+	int64_t cmd_tstamp;    /* First send of the current command; 0 if unsent */
+	uint32_t slow_cmd_ms;  /* Log commands slower than this (0: don't) */
+	int offline_count;     /* Failed attempts to bring this PD online */
+	uint32_t poll_min_ms;  /* POLL interval when the PD is busy */
+	uint32_t poll_max_ms;  /* POLL interval when the PD is quiet */
+	uint32_t baud_rate;    /* Serial baud/bit rate */
+	int address;           /* PD address */
+	int seq_number;        /* Current packet sequence number */
+	uint16_t peer_rx_size; /* Receive buffer size of the peer PD/CP */
+	struct osdp_pd_stats stats; /* Protocol counters; see osdp_get_pd_stats */
 
 	union {
-		queue_t cmd_queue;
-		queue_t event_queue;
+		struct { /* CP mode */
+			/* one per priority */
+			queue_t cmd_queue[OSDP_CP_CMD_PRIO_SENTINEL];
+			int cmd_queue_depth; /* Commands pending in cmd_queue */
+			void *cmd_ring;      /* App submissions (struct cp_cmd_ring) */
+			osdp_atomic_t cmd_pending; /* cmd_ring + cmd_queue */
+			osdp_atomic_t cmd_quota;   /* Max of cmd_pending */
+		};
+		queue_t event_queue; /* PD mode */
 	};
-	struct osdp_app_data_pool app_data; /* alloc osdp_event / osdp_cmd */
+	osdp_atomic_t refs;    /* App calls using this PD; see osdp_pd_get() */
 
 	struct osdp_channel channel;     /* PD's serial channel */
 	struct osdp_secure_channel sc;   /* Secure Channel session context */
 	struct osdp_file *file;          /* File transfer context */
 
+	/* -- cold: set up once or used only by specific commands/replies -- */
+
+	/**
+	 * Data bytes of the current command/reply ID. This is accessed as a
+	 * struct osdp_cmd/osdp_event; the union keeps it aligned for that
+	 * regardless of where it sits in this struct.
+	 */
+	union {
+		uint8_t ephemeral_data[OSDP_EPHEMERAL_DATA_MAX_LEN];
+		union osdp_ephemeral_data ephemeral_align;
+	};
+
+	char name[OSDP_PD_NAME_MAXLEN];
+	struct osdp_pd_id id;  /* PD ID information (as received from app) */
+
+	/* PD Capability; Those received from app + implicit capabilities */
+	struct osdp_pd_cap cap[OSDP_PD_CAP_SENTINEL];
+
+	/* Copy of state/id/cap for app threads (CP mode); see osdp_cp.c */
+	struct osdp_snapshot snapshot;
+
+	/* Value of stats at the last reset (see osdp_get_pd_stats) */
+	struct osdp_pd_stats stats_base;
+
+	/* Reply latency; OSDP_CMD_LATENCY_SENTINEL entries (CP mode) */
+	struct osdp_latency_hist *latency;
+
+	/* Last packets on the wire (see osdp_get_flight_recorder) */
+	struct osdp_flight_recorder recorder;
+
 	/* PD command callback to app with opaque arg pointer as passed by app */
 	void *command_callback_arg;
 	pd_command_callback_t command_callback;
@@ -443,15 +703,32 @@ struct osdp_pd {
 
 struct osdp {
 	uint32_t _magic;       /* Canary to be used in input_check() */
-	int _num_pd;           /* Number of PDs attached to this context */
+	int _num_pd;           /* Offset of the last PD in the PD table + 1 */
 	struct osdp_pd *_current_pd; /* current operational pd's pointer */
-	struct osdp_pd *pd;    /* base of PD list (must be at lest one) */
+	struct osdp_pd **pd;   /* PD table; entries are NULL for removed PDs */
+	osdp_atomic_t pd_lookups; /* osdp_pd_get() calls in progress */
 	int num_channels;      /* Number of distinct channels */
-	int *channel_lock;     /* array of length NUM_PD() to lock a channel */
+	struct osdp_bus *bus;  /* PD mode: the only bus (CP: see pd->bus) */
+	int num_sched;         /* Number of PD scheduling groups in use */
+	struct osdp_sched **sched; /* OSDP_PD_MAX groups; see cp_sched_init() */
+	int num_workers;       /* Worker threads running; see osdp_cp_worker.c */
+	struct osdp_cmd_pool cmd_pool; /* Commands queued to all PDs */
+	/* Bit per PD (32 per word); read by app threads without any lock */
+	osdp_atomic_t online_mask[CP_PD_MASK_WORDS]; /* PD is online */
+	osdp_atomic_t sc_mask[CP_PD_MASK_WORDS];     /* PD has SC active */
+	struct osdp_app_data_pool app_data; /* alloc osdp_event (PD mode) */
 
 	/* CP event callback to app with opaque arg pointer as passed by app */
 	void *event_callback_arg;
 	cp_event_callback_t event_callback;
+	void *event_ring;      /* CP event queue (struct cp_event_ring) if any */
+
+	/* Flight recorder callback to app (see osdp_flight_recorder_trigger) */
+	void *recorder_callback_arg;
+	osdp_flight_recorder_callback_t recorder_callback;
+	uint8_t *recorder_buf; /* OSDP_FLIGHT_RECORDER_PCAP_MAX bytes */
+
+	void *capture;         /* Background capture writer (if running) */
 };
 
 void osdp_keyset_complete(struct osdp_pd *pd);
@@ -466,19 +743,37 @@ uint8_t *osdp_phy_packet_get_smb(struct osdp_pd *p, const uint8_t *buf);
 int osdp_phy_send_packet(struct osdp_pd *pd, uint8_t *buf,
 			 int len, int max_len);
 void osdp_phy_progress_sequence(struct osdp_pd *pd);
+bool osdp_phy_can_gather(struct osdp_pd *pd);
+void osdp_phy_packet_set_payload(struct osdp_pd *pd, const uint8_t *buf,
+				 int len);
+
+/* from osdp_crc.c */
+#define OSDP_CRC16_SEED 0x1D0F
+uint16_t osdp_compute_crc16(const uint8_t *buf, size_t len);
+uint16_t osdp_crc16_update(uint16_t crc, const uint8_t *buf, size_t len);
+uint8_t osdp_checksum_update(uint8_t sum, const uint8_t *buf, size_t len);
 
 /* from osdp_common.c */
 __weak int64_t osdp_millis_now(void);
 int64_t osdp_millis_since(int64_t last);
-uint16_t osdp_compute_crc16(const uint8_t *buf, size_t len);
 
 const char *osdp_cmd_name(int cmd_id);
 const char *osdp_reply_name(int reply_id);
 
+void osdp_flight_recorder_add(struct osdp_pd *pd, const uint8_t *buf, int len);
+void osdp_flight_recorder_trigger(struct osdp_pd *pd, int trigger);
+
 int osdp_rb_push(struct osdp_rb *p, uint8_t data);
 int osdp_rb_push_buf(struct osdp_rb *p, uint8_t *buf, int len);
 int osdp_rb_pop(struct osdp_rb *p, uint8_t *data);
 int osdp_rb_pop_buf(struct osdp_rb *p, uint8_t *buf, int max_len);
+int osdp_rb_len(struct osdp_rb *p);
+int osdp_rb_write_view(struct osdp_rb *p, int offset, uint8_t **ptr);
+void osdp_rb_commit(struct osdp_rb *p, int len);
+int osdp_rb_read_view(struct osdp_rb *p, int offset, uint8_t **ptr);
+void osdp_rb_consume(struct osdp_rb *p, int len);
+int osdp_rb_find(struct osdp_rb *p, int offset, uint8_t byte);
+uint8_t *osdp_rb_peek(struct osdp_rb *p, int offset, uint8_t *tmp, int len);
 
 void osdp_crypt_setup();
 void osdp_encrypt(uint8_t *key, uint8_t *iv, uint8_t *data, int len);
@@ -503,7 +798,7 @@ void osdp_sc_teardown(struct osdp_pd *pd);
 
 static inline int get_tx_buf_size(struct osdp_pd *pd)
 {
-	int packet_buf_size = sizeof(pd->packet_buf);
+	int packet_buf_size = sizeof(pd->chn_buf->packet_buf);
 
 	if (pd->peer_rx_size) {
 		if (packet_buf_size > (int)pd->peer_rx_size)
@@ -517,9 +812,42 @@ static inline struct osdp *pd_to_osdp(struct osdp_pd *pd)
 	return pd->osdp_ctx;
 }
 
+/* May return NULL in CP mode if the PD at this offset was removed */
 static inline struct osdp_pd *osdp_to_pd(const struct osdp *ctx, int pd_idx)
 {
-	return ctx->pd + pd_idx;
+	return ctx->pd[pd_idx];
+}
+
+/**
+ * Look up a PD for an exported method and keep it from being freed (see
+ * osdp_cp_remove_pd) until osdp_pd_put(). Returns NULL if it was removed.
+ *
+ * The remover takes the PD out of the table and then waits for pd_lookups
+ * to drop to 0 (so nobody can be about to take a reference) and for refs to
+ * drop to 0. The fences make sure that either we see the table entry gone or
+ * the remover sees our lookup.
+ */
+static inline struct osdp_pd *osdp_pd_get(const struct osdp *ctx, int pd_idx)
+{
+	struct osdp *p = (struct osdp *)ctx;
+	struct osdp_pd *pd;
+
+	osdp_atomic_add(&p->pd_lookups, 1);
+	osdp_atomic_fence();
+	pd = p->pd[pd_idx];
+	if (pd != NULL) {
+		osdp_atomic_add(&pd->refs, 1);
+	}
+	osdp_atomic_sub(&p->pd_lookups, 1);
+	if (pd == NULL) {
+		LOG_PRINT("Invalid PD number %d", pd_idx);
+	}
+	return pd;
+}
+
+static inline void osdp_pd_put(struct osdp_pd *pd)
+{
+	osdp_atomic_sub(&pd->refs, 1);
 }
 
 static inline bool is_pd_mode(struct osdp_pd *pd)
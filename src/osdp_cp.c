@@ -6,11 +6,11 @@
 
 #include <stdlib.h>
 
-#include <utils/disjoint_set.h>
-
 #include "osdp_common.h"
 #include "osdp_file.h"
 #include "osdp_diag.h"
+#include "osdp_cp_worker.h"
+#include "osdp_capture.h"
 
 #define CMD_POLL_LEN                   1
 #define CMD_LSTAT_LEN                  1
@@ -44,6 +44,9 @@
 #define REPLY_BUSY_DATA_LEN            0
 #define REPLY_MFGREP_LEN               3   /* variable length command */
 
+#define CP_POLL_WIRE_LEN               18  /* POLL + ACK incl. mark bytes */
+#define CP_POLL_WIRE_SC_LEN            12  /* SCB + MAC of POLL and ACK */
+
 enum osdp_cp_error_e {
 	OSDP_CP_ERR_NONE = 0,
 	OSDP_CP_ERR_GENERIC = -1,
@@ -57,99 +60,773 @@ enum osdp_cp_error_e {
 
 struct cp_cmd_node {
 	queue_node_t node;
+	struct cp_cmd_node *next_free;
+	int64_t expiry;        /* drop if not sent by this time; 0: never */
 	struct osdp_cmd object;
 };
 
+struct cp_cmd_chunk {
+	struct cp_cmd_chunk *next;
+	struct cp_cmd_node nodes[OSDP_CP_CMD_POOL_SIZE];
+};
+
+/**
+ * Per-PD bounded ring through which application threads hand commands over to
+ * the thread that refreshes the PD. Any number of threads can post to it
+ * without taking a lock; the refresh context is the only consumer. Producers
+ * claim a slot by advancing head and publish it by setting the slot's seq to
+ * pos + 1; the consumer releases it for the next lap by setting seq to
+ * pos + OSDP_CP_CMD_RING_SIZE.
+ */
+#define CP_CMD_RING_MASK (OSDP_CP_CMD_RING_SIZE - 1)
+
+struct cp_cmd_ring_slot {
+	osdp_atomic_t seq;
+	int64_t expiry;
+	struct osdp_cmd cmd;
+};
+
+struct cp_cmd_ring {
+	osdp_atomic_t head;    /* Next slot to be claimed by a producer */
+	unsigned int tail;     /* Next slot to be drained by the consumer */
+	struct cp_cmd_ring_slot slots[OSDP_CP_CMD_RING_SIZE];
+};
+
+static int cp_cmd_ring_push(struct cp_cmd_ring *r, const struct osdp_cmd *cmd,
+			    int64_t expiry)
+{
+	struct cp_cmd_ring_slot *slot;
+	unsigned int pos;
+	int diff;
+
+	pos = osdp_atomic_load(&r->head);
+	while (1) {
+		slot = &r->slots[pos & CP_CMD_RING_MASK];
+		diff = (int)(osdp_atomic_load(&slot->seq) - pos);
+		if (diff < 0) {
+			return -1; /* full */
+		}
+		if (diff > 0) {
+			/* another producer claimed this slot; catch up */
+			pos = osdp_atomic_load(&r->head);
+			continue;
+		}
+		if (osdp_atomic_cas(&r->head, &pos, pos + 1)) {
+			break;
+		}
+	}
+	slot->expiry = expiry;
+	memcpy(&slot->cmd, cmd, sizeof(struct osdp_cmd));
+	osdp_atomic_store(&slot->seq, pos + 1);
+	return 0;
+}
+
+static inline bool cp_cmd_ring_ready(struct cp_cmd_ring *r)
+{
+	struct cp_cmd_ring_slot *slot = &r->slots[r->tail & CP_CMD_RING_MASK];
+
+	return osdp_atomic_load(&slot->seq) == r->tail + 1;
+}
+
+/* Oldest posted slot (if any); it stays in the ring until cp_cmd_ring_skip() */
+static struct cp_cmd_ring_slot *cp_cmd_ring_peek(struct cp_cmd_ring *r)
+{
+	if (!cp_cmd_ring_ready(r)) {
+		return NULL;
+	}
+	return &r->slots[r->tail & CP_CMD_RING_MASK];
+}
+
+static void cp_cmd_ring_skip(struct cp_cmd_ring *r)
+{
+	struct cp_cmd_ring_slot *slot = &r->slots[r->tail & CP_CMD_RING_MASK];
+
+	osdp_atomic_store(&slot->seq, r->tail + OSDP_CP_CMD_RING_SIZE);
+	r->tail++;
+}
+
+static int cp_cmd_ring_pop(struct cp_cmd_ring *r, struct osdp_cmd *cmd,
+			   int64_t *expiry)
+{
+	struct cp_cmd_ring_slot *slot = cp_cmd_ring_peek(r);
+
+	if (slot == NULL) {
+		return -1;
+	}
+	*expiry = slot->expiry;
+	memcpy(cmd, &slot->cmd, sizeof(struct osdp_cmd));
+	cp_cmd_ring_skip(r);
+	return 0;
+}
+
+static int cp_cmd_pool_grow(struct osdp_cmd_pool *pool)
+{
+	int i;
+	struct cp_cmd_chunk *chunk;
+	struct cp_cmd_node *n;
+
+	if (pool->capacity >= (int)osdp_atomic_load(&pool->max)) {
+		return -1;
+	}
+	chunk = malloc(sizeof(struct cp_cmd_chunk));
+	if (chunk == NULL) {
+		return -1;
+	}
+	chunk->next = pool->chunks;
+	pool->chunks = chunk;
+	for (i = 0; i < OSDP_CP_CMD_POOL_SIZE; i++) {
+		n = &chunk->nodes[i];
+		n->next_free = pool->free_list;
+		pool->free_list = n;
+	}
+	pool->capacity += OSDP_CP_CMD_POOL_SIZE;
+	return 0;
+}
+
+static void cp_cmd_pool_destroy(struct osdp_cmd_pool *pool)
+{
+	struct cp_cmd_chunk *chunk;
+
+	while (pool->chunks) {
+		chunk = pool->chunks;
+		pool->chunks = chunk->next;
+		free(chunk);
+	}
+	pool->free_list = NULL;
+	pool->capacity = 0;
+	osdp_atomic_store(&pool->in_use, 0);
+}
+
 static int cp_cmd_queue_init(struct osdp_pd *pd)
 {
-	if (slab_init(&pd->app_data.slab,
-		      sizeof(struct cp_cmd_node),
-		      pd->app_data.slab_blob,
-		      sizeof(pd->app_data.slab_blob)) < 0) {
-		LOG_ERR("Failed to initialize command slab");
+	int i;
+	struct cp_cmd_ring *r;
+
+	for (i = 0; i < OSDP_CP_CMD_PRIO_SENTINEL; i++) {
+		queue_init(&pd->cmd_queue[i]);
+	}
+	r = calloc(1, sizeof(struct cp_cmd_ring));
+	if (r == NULL) {
+		LOG_PRINT("Failed to allocate command ring");
+		return -1;
+	}
+	for (i = 0; i < OSDP_CP_CMD_RING_SIZE; i++) {
+		osdp_atomic_store(&r->slots[i].seq, i);
+	}
+	pd->cmd_ring = r;
+	osdp_atomic_store(&pd->cmd_quota, OSDP_CP_CMD_QUOTA);
+	return 0;
+}
+
+static inline int cp_cmd_headroom(struct osdp_pd *pd)
+{
+	struct osdp_cmd_pool *pool = &pd_to_osdp(pd)->cmd_pool;
+	int pool_free, quota_free;
+
+	pool_free = (int)osdp_atomic_load(&pool->max) -
+		    (int)osdp_atomic_load(&pool->in_use);
+	quota_free = (int)osdp_atomic_load(&pd->cmd_quota) -
+		     (int)osdp_atomic_load(&pd->cmd_pending);
+
+	return (pool_free < quota_free) ? pool_free : quota_free;
+}
+
+/**
+ * Reserve room for one command of this PD in its quota and in the shared
+ * pool. Safe to call from any thread.
+ */
+static int cp_cmd_reserve(struct osdp_pd *pd)
+{
+	struct osdp_cmd_pool *pool = &pd_to_osdp(pd)->cmd_pool;
+	int quota = (int)osdp_atomic_load(&pd->cmd_quota);
+	int max = (int)osdp_atomic_load(&pool->max);
+
+	if ((int)osdp_atomic_add(&pd->cmd_pending, 1) >= quota) {
+		osdp_atomic_sub(&pd->cmd_pending, 1);
+		LOG_WRN("Command queue full (quota: %d)", quota);
+		return -1;
+	}
+	if ((int)osdp_atomic_add(&pool->in_use, 1) >= max) {
+		osdp_atomic_sub(&pool->in_use, 1);
+		osdp_atomic_sub(&pd->cmd_pending, 1);
+		LOG_ERR("Command pool exhausted (max: %d)", max);
 		return -1;
 	}
-	queue_init(&pd->cmd_queue);
 	return 0;
 }
 
+static inline void cp_cmd_unreserve(struct osdp_pd *pd)
+{
+	osdp_atomic_sub(&pd_to_osdp(pd)->cmd_pool.in_use, 1);
+	osdp_atomic_sub(&pd->cmd_pending, 1);
+}
+
 static struct osdp_cmd *cp_cmd_alloc(struct osdp_pd *pd)
 {
-	struct cp_cmd_node *n = NULL;
+	struct osdp *ctx = pd_to_osdp(pd);
+	struct osdp_cmd_pool *pool = &ctx->cmd_pool;
+	struct cp_cmd_node *n;
+
+	osdp_cp_pool_lock(ctx);
+	if (pool->free_list == NULL) {
+		cp_cmd_pool_grow(pool);
+	}
+	n = pool->free_list;
+	if (n != NULL) {
+		pool->free_list = n->next_free;
+	}
+	osdp_cp_pool_unlock(ctx);
 
-	if (slab_alloc(&pd->app_data.slab, (void **)&n)) {
-		LOG_ERR("Command slab allocation failed");
+	if (n == NULL) {
+		LOG_ERR("Failed to allocate command");
 		return NULL;
 	}
 	memset(&n->object, 0, sizeof(n->object));
 	return &n->object;
 }
 
+/* Return a command to the pool and release its reservation */
 static void cp_cmd_free(struct osdp_pd *pd, struct osdp_cmd *cmd)
 {
+	struct osdp *ctx = pd_to_osdp(pd);
+	struct osdp_cmd_pool *pool = &ctx->cmd_pool;
 	struct cp_cmd_node *n;
 
 	n = CONTAINER_OF(cmd, struct cp_cmd_node, object);
-	slab_free(&pd->app_data.slab, n);
+	osdp_cp_pool_lock(ctx);
+	n->next_free = pool->free_list;
+	pool->free_list = n;
+	osdp_cp_pool_unlock(ctx);
+	cp_cmd_unreserve(pd);
+}
+
+static inline int cp_cmd_prio(const struct osdp_cmd *cmd)
+{
+	if (cmd->flags & OSDP_CMD_FLAG_PRIO_URGENT) {
+		return OSDP_CP_CMD_PRIO_URGENT;
+	}
+	if (cmd->flags & OSDP_CMD_FLAG_PRIO_BACKGROUND) {
+		return OSDP_CP_CMD_PRIO_BACKGROUND;
+	}
+	return OSDP_CP_CMD_PRIO_NORMAL;
 }
 
-static void cp_cmd_enqueue(struct osdp_pd *pd, struct osdp_cmd *cmd)
+static inline int64_t cp_cmd_expiry(const struct osdp_cmd *cmd)
+{
+	return cmd->ttl_ms ? osdp_millis_now() + cmd->ttl_ms : 0;
+}
+
+static void cp_cmd_enqueue(struct osdp_pd *pd, struct osdp_cmd *cmd,
+			   int64_t expiry)
 {
 	struct cp_cmd_node *n;
 
 	n = CONTAINER_OF(cmd, struct cp_cmd_node, object);
-	queue_enqueue(&pd->cmd_queue, &n->node);
+	n->expiry = expiry;
+	queue_enqueue(&pd->cmd_queue[cp_cmd_prio(cmd)], &n->node);
+	pd->cmd_queue_depth++;
 }
 
 static int cp_cmd_dequeue(struct osdp_pd *pd, struct osdp_cmd **cmd)
 {
+	int i;
 	struct cp_cmd_node *n;
 	queue_node_t *node;
 
-	if (queue_dequeue(&pd->cmd_queue, &node)) {
+	for (i = 0; i < OSDP_CP_CMD_PRIO_SENTINEL; i++) {
+		if (queue_dequeue(&pd->cmd_queue[i], &node) == 0) {
+			break;
+		}
+	}
+	if (i == OSDP_CP_CMD_PRIO_SENTINEL) {
 		return -1;
 	}
 	n = CONTAINER_OF(node, struct cp_cmd_node, node);
 	*cmd = &n->object;
+	pd->cmd_queue_depth--;
+	return 0;
+}
+
+static bool cp_cmd_same_target(const struct osdp_cmd *a,
+			       const struct osdp_cmd *b)
+{
+	if (a->id != b->id) {
+		return false;
+	}
+
+	switch (a->id) {
+	case OSDP_CMD_LED:
+		return a->led.reader == b->led.reader &&
+		       a->led.led_number == b->led.led_number;
+	case OSDP_CMD_TEXT:
+		return a->text.reader == b->text.reader &&
+		       a->text.offset_row == b->text.offset_row &&
+		       a->text.offset_col == b->text.offset_col;
+	case OSDP_CMD_BUZZER:
+		return a->buzzer.reader == b->buzzer.reader;
+	default:
+		return false;
+	}
+}
+
+static inline bool cp_text_is_temporary(const struct osdp_cmd_text *t)
+{
+	return t->control_code == 3 || t->control_code == 4;
+}
+
+/**
+ * Fold @a cmd into the queued command @a q (same target) so that sending only
+ * @a q has the same effect as sending both in order. LED commands carry a
+ * temporary and a permanent part, each of which can be a NOP; a part that @a
+ * cmd leaves alone keeps what was queued. A TEXT command is either temporary
+ * or permanent, and only replaces a queued one of the same kind that it
+ * fully overwrites.
+ *
+ * Returns true if @a q was updated; false if both must be sent.
+ */
+static bool cp_cmd_merge(struct osdp_cmd *q, const struct osdp_cmd *cmd)
+{
+	switch (cmd->id) {
+	case OSDP_CMD_LED:
+		if (cmd->led.temporary.control_code != 0) {
+			q->led.temporary = cmd->led.temporary;
+		}
+		if (cmd->led.permanent.control_code != 0) {
+			q->led.permanent = cmd->led.permanent;
+		}
+		break;
+	case OSDP_CMD_TEXT:
+		if (cp_text_is_temporary(&q->text) !=
+			    cp_text_is_temporary(&cmd->text) ||
+		    cmd->text.length < q->text.length) {
+			return false;
+		}
+		q->text = cmd->text;
+		break;
+	default:
+		memcpy(q, cmd, sizeof(struct osdp_cmd));
+		return true;
+	}
+	q->flags = cmd->flags;
+	q->ttl_ms = cmd->ttl_ms;
+	return true;
+}
+
+/**
+ * Update the last queued command that @a cmd supersedes (OSDP_CMD_FLAG_COALESCE)
+ * so the PD only gets the latest state. The queued node keeps its position.
+ *
+ * Returns 0 if a queued command was updated; -1 otherwise.
+ */
+static int cp_cmd_coalesce(struct osdp_pd *pd, const struct osdp_cmd *cmd,
+			   int64_t expiry)
+{
+	struct cp_cmd_node *n, *last = NULL;
+	queue_node_t *node;
+
+	/* only the last one; anything queued after it must still follow */
+	node = pd->cmd_queue[cp_cmd_prio(cmd)].list.head;
+	while (node != NULL) {
+		n = CONTAINER_OF(node, struct cp_cmd_node, node);
+		if (cp_cmd_same_target(&n->object, cmd)) {
+			last = n;
+		}
+		node = node->next;
+	}
+	if (last == NULL || !cp_cmd_merge(&last->object, cmd)) {
+		return -1;
+	}
+	last->expiry = expiry;
 	return 0;
 }
 
+static inline bool cp_cmd_expired(struct osdp_cmd *cmd, int64_t now)
+{
+	struct cp_cmd_node *n = CONTAINER_OF(cmd, struct cp_cmd_node, object);
+
+	return n->expiry != 0 && now > n->expiry;
+}
+
+/**
+ * Move the commands that app threads have posted to cmd_queue[]. Must only be
+ * called from the context that refreshes this PD.
+ *
+ * Room for each posted command was reserved in the pool, so allocation only
+ * fails if the pool could not grow (out of memory). The commands are then
+ * left in the ring (in order) for the next refresh to pick up.
+ */
+static void cp_cmd_ring_drain(struct osdp_pd *pd)
+{
+	struct cp_cmd_ring_slot *slot;
+	struct osdp_cmd *p;
+
+	while ((slot = cp_cmd_ring_peek(pd->cmd_ring)) != NULL) {
+		if ((slot->cmd.flags & OSDP_CMD_FLAG_COALESCE) &&
+		    cp_cmd_coalesce(pd, &slot->cmd, slot->expiry) == 0) {
+			cp_cmd_ring_skip(pd->cmd_ring);
+			cp_cmd_unreserve(pd);
+			continue;
+		}
+		p = cp_cmd_alloc(pd);
+		if (p == NULL) {
+			break;
+		}
+		memcpy(p, &slot->cmd, sizeof(struct osdp_cmd));
+		cp_cmd_enqueue(pd, p, slot->expiry);
+		cp_cmd_ring_skip(pd->cmd_ring);
+	}
+}
+
+/* Drop all posted and queued commands of this PD; returns the count */
+static int cp_cmd_flush(struct osdp_pd *pd)
+{
+	struct osdp_cmd cmd, *p;
+	int64_t expiry;
+	int count = 0;
+
+	while (cp_cmd_ring_pop(pd->cmd_ring, &cmd, &expiry) == 0) {
+		cp_cmd_unreserve(pd);
+		count++;
+	}
+	while (cp_cmd_dequeue(pd, &p) == 0) {
+		cp_cmd_free(pd, p);
+		count++;
+	}
+	return count;
+}
+
 static int cp_channel_acquire(struct osdp_pd *pd, int *owner)
 {
-	int i;
-	struct osdp *ctx = pd_to_osdp(pd);
+	int cur = pd->bus->owner;
 
-	if (ctx->channel_lock[pd->idx] == pd->channel.id) {
+	if (cur == pd->idx) {
 		return 0; /* already acquired! by current PD */
 	}
-	assert(ctx->channel_lock[pd->idx] == 0);
-	for (i = 0; i < NUM_PD(ctx); i++) {
-		if (ctx->channel_lock[i] == pd->channel.id) {
-			/* some other PD has locked this channel */
-			if (owner != NULL) {
-				*owner = i;
-			}
-			return -1;
+	if (cur >= 0) {
+		/* some other PD has locked this channel */
+		if (owner != NULL) {
+			*owner = cur;
 		}
+		return -1;
 	}
-	ctx->channel_lock[pd->idx] = pd->channel.id;
+	pd->bus->owner = pd->idx;
 
 	return 0;
 }
 
 static int cp_channel_release(struct osdp_pd *pd)
 {
-	struct osdp *ctx = pd_to_osdp(pd);
-
-	if (ctx->channel_lock[pd->idx] != pd->channel.id) {
+	if (pd->bus->owner != pd->idx) {
 		LOG_ERR("Attempt to release another PD's channel lock");
 		return -1;
 	}
-	ctx->channel_lock[pd->idx] = 0;
+	pd->bus->owner = -1;
+
+	return 0;
+}
+
+/**
+ * PD scheduler: Each osdp_sched holds a binary min-heap of PD offsets keyed by
+ * pd->sched_deadline. osdp_cp_refresh() only visits the PDs at the top of
+ * these heaps whose deadline has expired. PDs that share a channel are always
+ * in the same osdp_sched.
+ */
+static inline struct osdp_sched *pd_to_sched(struct osdp_pd *pd)
+{
+	return pd_to_osdp(pd)->sched[pd->sched_id];
+}
+
+/**
+ * Take the lock of the group that this PD is in. cp_sched_init() can move the
+ * PD to another group while we wait for the lock, so check again once we have
+ * it. Returns the group to pass to osdp_cp_worker_unlock().
+ */
+static struct osdp_sched *cp_pd_lock(struct osdp_pd *pd)
+{
+	struct osdp_sched *s;
+
+	while (1) {
+		s = pd_to_sched(pd);
+		osdp_cp_worker_lock(s);
+		if (s == pd_to_sched(pd)) {
+			return s;
+		}
+		osdp_cp_worker_unlock(s);
+	}
+}
+
+static inline int64_t cp_sched_key(struct osdp *ctx, struct osdp_sched *s,
+				   int pos)
+{
+	return osdp_to_pd(ctx, s->heap[pos])->sched_deadline;
+}
+
+static void cp_sched_swap(struct osdp *ctx, struct osdp_sched *s, int a, int b)
+{
+	int tmp = s->heap[a];
+
+	s->heap[a] = s->heap[b];
+	s->heap[b] = tmp;
+	osdp_to_pd(ctx, s->heap[a])->sched_pos = a;
+	osdp_to_pd(ctx, s->heap[b])->sched_pos = b;
+}
+
+static void cp_sched_sift_up(struct osdp *ctx, struct osdp_sched *s, int pos)
+{
+	int parent;
+
+	while (pos > 0) {
+		parent = (pos - 1) / 2;
+		if (cp_sched_key(ctx, s, parent) <= cp_sched_key(ctx, s, pos)) {
+			break;
+		}
+		cp_sched_swap(ctx, s, parent, pos);
+		pos = parent;
+	}
+}
+
+static void cp_sched_sift_down(struct osdp *ctx, struct osdp_sched *s, int pos)
+{
+	int child;
+
+	while ((child = 2 * pos + 1) < s->len) {
+		if (child + 1 < s->len &&
+		    cp_sched_key(ctx, s, child + 1) < cp_sched_key(ctx, s, child)) {
+			child++;
+		}
+		if (cp_sched_key(ctx, s, pos) <= cp_sched_key(ctx, s, child)) {
+			break;
+		}
+		cp_sched_swap(ctx, s, pos, child);
+		pos = child;
+	}
+}
+
+static void cp_sched_push(struct osdp_pd *pd)
+{
+	struct osdp_sched *s = pd_to_sched(pd);
+
+	pd->sched_pos = s->len++;
+	s->heap[pd->sched_pos] = pd->idx;
+	cp_sched_sift_up(pd_to_osdp(pd), s, pd->sched_pos);
+}
+
+static struct osdp_pd *cp_sched_pop(struct osdp *ctx, struct osdp_sched *s)
+{
+	struct osdp_pd *pd = osdp_to_pd(ctx, s->heap[0]);
+
+	cp_sched_swap(ctx, s, 0, --s->len);
+	cp_sched_sift_down(ctx, s, 0);
+	pd->sched_pos = -1;
+	return pd;
+}
+
+static void cp_sched_update(struct osdp_pd *pd, int64_t deadline)
+{
+	int64_t old = pd->sched_deadline;
+
+	pd->sched_deadline = deadline;
+	if (pd->sched_pos < 0) {
+		return; /* being refreshed now; will be pushed back later */
+	}
+	if (deadline < old) {
+		cp_sched_sift_up(pd_to_osdp(pd), pd_to_sched(pd), pd->sched_pos);
+	} else {
+		cp_sched_sift_down(pd_to_osdp(pd), pd_to_sched(pd), pd->sched_pos);
+	}
+}
+
+static void cp_sched_remove(struct osdp_pd *pd)
+{
+	struct osdp *ctx = pd_to_osdp(pd);
+	struct osdp_sched *s = pd_to_sched(pd);
+	int pos = pd->sched_pos;
+
+	cp_sched_swap(ctx, s, pos, --s->len);
+	pd->sched_pos = -1;
+	if (pos < s->len) {
+		cp_sched_sift_up(ctx, s, pos);
+		cp_sched_sift_down(ctx, s, pos);
+	}
+}
+
+/* Something changed outside of refresh; schedule this PD right away */
+static inline void cp_sched_kick(struct osdp_pd *pd)
+{
+	cp_sched_update(pd, CP_SCHED_URGENT);
+	osdp_cp_worker_wake(pd_to_sched(pd));
+}
+
+static inline int64_t cp_sched_next_deadline(struct osdp *ctx,
+					     struct osdp_sched *s)
+{
+	return s->len ? cp_sched_key(ctx, s, 0) : CP_SCHED_NEVER;
+}
+
+static struct osdp_sched *cp_sched_alloc(void)
+{
+	struct osdp_sched *s;
+
+	s = calloc(1, sizeof(struct osdp_sched));
+	if (s == NULL) {
+		return NULL;
+	}
+	/* a group can end up with all PDs in it */
+	s->heap = calloc(2 * OSDP_PD_MAX, sizeof(int));
+	if (s->heap == NULL) {
+		free(s);
+		return NULL;
+	}
+	s->due = s->heap + OSDP_PD_MAX;
+	return s;
+}
+
+static void cp_sched_free(struct osdp_sched *s)
+{
+	osdp_cp_worker_free(s);
+	free(s->heap);
+	free(s);
+}
+
+/**
+ * Split the PDs into num_sched groups such that PDs that share a channel
+ * always end up in the same group, and (re)build the heap of each group.
+ *
+ * Groups are allocated the first time they are needed and are kept until
+ * teardown since app threads get to them through pd_to_sched() without any
+ * locks. The PDs are moved around with the locks of all groups held so that
+ * cp_pd_lock() sees a consistent pd->sched_id.
+ */
+static int cp_sched_init(struct osdp *ctx, int num_sched)
+{
+	int i, num_alloc;
+	struct osdp_pd *pd;
+	struct osdp_sched *s;
+
+	if (num_sched > ctx->num_channels) {
+		num_sched = ctx->num_channels;
+	}
+	if (num_sched < 1) {
+		num_sched = 1;
+	}
+
+	for (i = 0; i < num_sched; i++) {
+		if (ctx->sched[i] != NULL) {
+			continue;
+		}
+		ctx->sched[i] = cp_sched_alloc();
+		if (ctx->sched[i] == NULL) {
+			LOG_PRINT("Failed to allocate PD scheduler");
+			return -1;
+		}
+	}
+	for (num_alloc = num_sched; num_alloc < OSDP_PD_MAX; num_alloc++) {
+		if (ctx->sched[num_alloc] == NULL) {
+			break;
+		}
+	}
+
+	for (i = 0; i < num_alloc; i++) {
+		s = ctx->sched[i];
+		osdp_cp_worker_lock(s);
+		s->len = 0;
+		s->num_chn_waiters = 0;
+	}
+	ctx->num_sched = num_sched;
+
+	for (i = 0; i < NUM_PD(ctx); i++) {
+		pd = osdp_to_pd(ctx, i);
+		if (pd == NULL) {
+			continue;
+		}
+		CLEAR_FLAG(pd, PD_FLAG_CHN_WAIT);
+		pd->sched_id = pd->chn_slot % num_sched;
+		pd->sched_deadline = 0;
+		cp_sched_push(pd);
+	}
 
+	for (i = num_alloc - 1; i >= 0; i--) {
+		osdp_cp_worker_unlock(ctx->sched[i]);
+	}
 	return 0;
 }
 
+static inline void cp_pd_mask_assign(osdp_atomic_t *mask, int pd_idx, bool set)
+{
+	unsigned int bit = 1U << (pd_idx & 31);
+
+	if (set) {
+		osdp_atomic_or(mask + pd_idx / 32, bit);
+	} else {
+		osdp_atomic_and(mask + pd_idx / 32, ~bit);
+	}
+}
+
+/**
+ * pd->snapshot is written only by the thread that refreshes the PD and read
+ * by app threads without any locks: the writer keeps snapshot.seq odd for the
+ * duration of an update and readers retry their copy until they see the same
+ * even seq before and after it.
+ */
+static inline void cp_snapshot_begin(struct osdp_pd *pd)
+{
+	osdp_atomic_add(&pd->snapshot.seq, 1);
+	osdp_atomic_release_fence();
+}
+
+static inline void cp_snapshot_end(struct osdp_pd *pd)
+{
+	osdp_atomic_add(&pd->snapshot.seq, 1);
+}
+
+static int64_t cp_snapshot_read(struct osdp_pd *pd,
+				struct osdp_pd_snapshot *view)
+{
+	unsigned int seq;
+	int64_t last_seen;
+
+	do {
+		while ((seq = osdp_atomic_load(&pd->snapshot.seq)) & 1) {
+			/* an update is only a handful of stores long */
+		}
+		memcpy(view, &pd->snapshot.view, sizeof(*view));
+		last_seen = pd->snapshot.last_seen;
+		osdp_atomic_acquire_fence();
+	} while (osdp_atomic_load(&pd->snapshot.seq) != seq);
+
+	view->version = seq / 2;
+	return last_seen;
+}
+
+/**
+ * Publish changes to the online/SC/enabled state of this PD; called after
+ * each run of the FSM. The status masks are kept in step here so that
+ * osdp_get_status_mask() and friends don't have to look at each PD.
+ */
+static void cp_snapshot_sync_state(struct osdp_pd *pd)
+{
+	struct osdp *ctx = pd_to_osdp(pd);
+	struct osdp_pd_snapshot *view = &pd->snapshot.view;
+	bool online = pd->state == OSDP_CP_STATE_ONLINE;
+	bool enabled = pd->state != OSDP_CP_STATE_DISABLED;
+	bool sc_active = sc_is_active(pd) &&
+			 !ISSET_FLAG(pd, PD_FLAG_SC_USE_SCBKD);
+
+	if (view->online == online && view->enabled == enabled &&
+	    view->sc_active == sc_active) {
+		return;
+	}
+
+	cp_snapshot_begin(pd);
+	view->online = online;
+	view->enabled = enabled;
+	view->sc_active = sc_active;
+	cp_snapshot_end(pd);
+
+	cp_pd_mask_assign(ctx->online_mask, pd->idx, online);
+	cp_pd_mask_assign(ctx->sc_mask, pd->idx, sc_active);
+}
+
 static const char *cp_get_cap_name(int cap)
 {
 	if (cap <= OSDP_PD_CAP_UNUSED || cap >= OSDP_PD_CAP_SENTINEL) {
@@ -416,6 +1093,9 @@ static int cp_decode_response(struct osdp_pd *pd, uint8_t *buf, int len)
 		if (len != REPLY_NAK_DATA_LEN) {
 			break;
 		}
+		if (buf[pos] < OSDP_PD_NAK_SENTINEL) {
+			pd->stats.naks[buf[pos]]++;
+		}
 		if (buf[pos] == OSDP_PD_NAK_MSG_CHK &&
 		    ISSET_FLAG(pd, PD_FLAG_CP_USE_CRC)) {
 			LOG_INF("PD NAK'd CRC-16, falling back to checksum");
@@ -441,11 +1121,15 @@ static int cp_decode_response(struct osdp_pd *pd, uint8_t *buf, int len)
 		pd->id.serial_number = buf[pos++];
 		pd->id.serial_number |= buf[pos++] << 8;
 		pd->id.serial_number |= buf[pos++] << 16;
-		pd->id.serial_number |= buf[pos++] << 24;
+		pd->id.serial_number |= (uint32_t)buf[pos++] << 24;
 
 		pd->id.firmware_version = buf[pos++] << 16;
 		pd->id.firmware_version |= buf[pos++] << 8;
 		pd->id.firmware_version |= buf[pos++];
+
+		cp_snapshot_begin(pd);
+		pd->snapshot.view.id = pd->id;
+		cp_snapshot_end(pd);
 		ret = OSDP_CP_ERR_NONE;
 		break;
 	case REPLY_PDCAP:
@@ -467,6 +1151,10 @@ static int cp_decode_response(struct osdp_pd *pd, uint8_t *buf, int len)
 				pd->cap[t1].num_items);
 		}
 
+		cp_snapshot_begin(pd);
+		memcpy(pd->snapshot.view.cap, pd->cap, sizeof(pd->cap));
+		cp_snapshot_end(pd);
+
 		/* Get peer RX buffer size */
 		t1 = OSDP_PD_CAP_RECEIVE_BUFFERSIZE;
 		if (pd->cap[t1].function_code == t1) {
@@ -564,7 +1252,7 @@ static int cp_decode_response(struct osdp_pd *pd, uint8_t *buf, int len)
 		temp32 = buf[pos++];
 		temp32 |= buf[pos++] << 8;
 		temp32 |= buf[pos++] << 16;
-		temp32 |= buf[pos++] << 24;
+		temp32 |= (uint32_t)buf[pos++] << 24;
 		LOG_INF("COMSET responded with ID:%d Baud:%d", t1, temp32);
 		pd->address = t1;
 		pd->baud_rate = temp32;
@@ -620,6 +1308,7 @@ static int cp_decode_response(struct osdp_pd *pd, uint8_t *buf, int len)
 		if (len != REPLY_BUSY_DATA_LEN) {
 			break;
 		}
+		pd->stats.busy++;
 		ret = OSDP_CP_ERR_RETRY_CMD;
 		break;
 	case REPLY_MFGREP:
@@ -694,35 +1383,185 @@ static int cp_decode_response(struct osdp_pd *pd, uint8_t *buf, int len)
 	return ret;
 }
 
-static void do_event_callback(struct osdp_pd *pd)
+/**
+ * Optional CP event queue (see osdp_cp_set_event_queue). Events are produced
+ * by whichever thread refreshes a PD and are taken out by the app from its own
+ * thread(s) so this ring is multi-producer, multi-consumer. It works the same
+ * way as the command ring except that consumers also claim slots through a
+ * CAS on tail.
+ */
+struct cp_event_slot {
+	osdp_atomic_t seq;
+	int pd;
+	struct osdp_event event;
+};
+
+struct cp_event_ring {
+	osdp_atomic_t head;    /* Next slot to be claimed by a producer */
+	osdp_atomic_t tail;    /* Next slot to be claimed by a consumer */
+	osdp_atomic_t dropped; /* Events lost to overflow */
+	unsigned int mask;     /* Number of slots - 1 */
+	enum osdp_event_overflow_e policy;
+	struct cp_event_slot slots[];
+};
+
+static int cp_event_ring_push(struct cp_event_ring *r, int pd,
+			      const struct osdp_event *event)
+{
+	struct cp_event_slot *slot;
+	unsigned int pos;
+	int diff;
+
+	pos = osdp_atomic_load(&r->head);
+	while (1) {
+		slot = &r->slots[pos & r->mask];
+		diff = (int)(osdp_atomic_load(&slot->seq) - pos);
+		if (diff < 0) {
+			return -1; /* full */
+		}
+		if (diff > 0) {
+			pos = osdp_atomic_load(&r->head);
+			continue;
+		}
+		if (osdp_atomic_cas(&r->head, &pos, pos + 1)) {
+			break;
+		}
+	}
+	slot->pd = pd;
+	memcpy(&slot->event, event, sizeof(struct osdp_event));
+	osdp_atomic_store(&slot->seq, pos + 1);
+	return 0;
+}
+
+static int cp_event_ring_pop(struct cp_event_ring *r, int *pd,
+			     struct osdp_event *event)
+{
+	struct cp_event_slot *slot;
+	unsigned int pos;
+	int diff;
+
+	pos = osdp_atomic_load(&r->tail);
+	while (1) {
+		slot = &r->slots[pos & r->mask];
+		diff = (int)(osdp_atomic_load(&slot->seq) - (pos + 1));
+		if (diff < 0) {
+			return -1; /* empty */
+		}
+		if (diff > 0) {
+			pos = osdp_atomic_load(&r->tail);
+			continue;
+		}
+		if (osdp_atomic_cas(&r->tail, &pos, pos + 1)) {
+			break;
+		}
+	}
+	*pd = slot->pd;
+	memcpy(event, &slot->event, sizeof(struct osdp_event));
+	osdp_atomic_store(&slot->seq, pos + r->mask + 1);
+	return 0;
+}
+
+static struct cp_event_ring *cp_event_ring_alloc(int size,
+						 enum osdp_event_overflow_e policy)
+{
+	int i, n = 1;
+	struct cp_event_ring *r;
+
+	while (n < size) {
+		n <<= 1;
+	}
+	r = calloc(1, sizeof(struct cp_event_ring) +
+		      n * sizeof(struct cp_event_slot));
+	if (r == NULL) {
+		return NULL;
+	}
+	for (i = 0; i < n; i++) {
+		osdp_atomic_store(&r->slots[i].seq, i);
+	}
+	r->mask = n - 1;
+	r->policy = policy;
+	return r;
+}
+
+static void cp_event_ring_put(struct cp_event_ring *r, int pd,
+			      const struct osdp_event *event)
+{
+	struct osdp_event oldest;
+	int oldest_pd;
+
+	while (cp_event_ring_push(r, pd, event)) {
+		if (r->policy == OSDP_EVENT_OVERFLOW_DROP_NEWEST) {
+			osdp_atomic_add(&r->dropped, 1);
+			return;
+		}
+		/* make room; the app may have drained it meanwhile */
+		if (cp_event_ring_pop(r, &oldest_pd, &oldest) == 0) {
+			osdp_atomic_add(&r->dropped, 1);
+		}
+	}
+}
+
+static inline bool cp_has_event_sink(struct osdp *ctx)
+{
+	return ctx->event_ring != NULL || ctx->event_callback != NULL;
+}
+
+/**
+ * Hand an event over to the app (queue or callback; whichever is in use).
+ *
+ * The app can call into LibOSDP from the event callback, which could take the
+ * lock of another group while we hold the lock of this one. So callbacks are
+ * held back in the group and made by cp_sched_flush_events() once the lock is
+ * released. If too many of them pile up in a single refresh, make it here.
+ */
+static void cp_dispatch_event(struct osdp_pd *pd, struct osdp_event *event)
 {
 	struct osdp *ctx = pd_to_osdp(pd);
+	struct osdp_sched *s = pd_to_sched(pd);
 
-	if (ctx->event_callback) {
-		ctx->event_callback(ctx->event_callback_arg, pd->idx,
-				    (struct osdp_event *)pd->ephemeral_data);
+	if (ctx->event_ring) {
+		cp_event_ring_put(ctx->event_ring, pd->idx, event);
+		return;
+	}
+	if (ctx->event_callback == NULL) {
+		return;
+	}
+	if (s->num_events < CP_SCHED_EVENTS_MAX) {
+		s->events[s->num_events].pd = pd->idx;
+		memcpy(&s->events[s->num_events].event, event,
+		       sizeof(struct osdp_event));
+		s->num_events++;
+		return;
 	}
+	LOG_WRN("Too many pending events; making callback under lock");
+	ctx->event_callback(ctx->event_callback_arg, pd->idx, event);
+}
+
+static void do_event_callback(struct osdp_pd *pd)
+{
+	cp_dispatch_event(pd, (struct osdp_event *)pd->ephemeral_data);
 }
 
 static int cp_build_and_send_packet(struct osdp_pd *pd)
 {
+	struct osdp_chn_buf *cbuf = pd->chn_buf;
 	int ret, packet_buf_size = get_tx_buf_size(pd);
 
 	/* init packet buf with header */
-	ret = osdp_phy_packet_init(pd, pd->packet_buf, packet_buf_size);
+	ret = osdp_phy_packet_init(pd, cbuf->packet_buf, packet_buf_size);
 	if (ret < 0) {
 		return OSDP_CP_ERR_GENERIC;
 	}
-	pd->packet_buf_len = ret;
+	cbuf->packet_buf_len = ret;
 
 	/* fill command data */
-	ret = cp_build_command(pd, pd->packet_buf, packet_buf_size);
+	ret = cp_build_command(pd, cbuf->packet_buf, packet_buf_size);
 	if (ret < 0) {
 		return OSDP_CP_ERR_GENERIC;
 	}
-	pd->packet_buf_len += ret;
+	cbuf->packet_buf_len += ret;
 
-	ret = osdp_phy_send_packet(pd, pd->packet_buf, pd->packet_buf_len,
+	ret = osdp_phy_send_packet(pd, cbuf->packet_buf, cbuf->packet_buf_len,
 				   packet_buf_size);
 	if (ret < 0) {
 		return OSDP_CP_ERR_GENERIC;
@@ -746,6 +1585,7 @@ static int cp_process_reply(struct osdp_pd *pd)
 	case OSDP_ERR_PKT_NO_DATA:
 		return OSDP_CP_ERR_NO_DATA;
 	case OSDP_ERR_PKT_BUSY:
+		pd->stats.busy++;
 		return OSDP_CP_ERR_RETRY_CMD;
 	case OSDP_ERR_PKT_NACK:
 		if (pd->ephemeral_data[0] == OSDP_PD_NAK_SEQ_NUM) {
@@ -840,19 +1680,308 @@ static inline bool cp_phy_kick(struct osdp_pd *pd)
 {
 	if (pd->phy_state == OSDP_CP_PHY_STATE_IDLE) {
 		pd->phy_state = OSDP_CP_PHY_STATE_SEND_CMD;
+		pd->cmd_tstamp = 0;
 		return true;
 	}
 	return false;
 }
 
-static void cp_phy_state_done(struct osdp_pd *pd)
+static void cp_phy_state_done(struct osdp_pd *pd)
+{
+	/* called when we have a valid response from the PD */
+	if (sc_is_active(pd)) {
+		pd->sc_tstamp = osdp_millis_now();
+	}
+	pd->phy_retry_count = 0;
+	pd->phy_busy_count = 0;
+	pd->phy_state = OSDP_CP_PHY_STATE_DONE;
+}
+
+/* Time (in ms) to clock len bytes on the wire at 8N1 (10 bits per byte) */
+static int cp_wire_ms(struct osdp_pd *pd, int len)
+{
+	if (pd->baud_rate == 0) {
+		return 0;
+	}
+	return (len * 10 * 1000 + pd->baud_rate - 1) / pd->baud_rate;
+}
+
+/* Bus time (in ms) spent on a POLL and its ACK at this PD's baud rate */
+static int cp_poll_wire_ms(struct osdp_pd *pd)
+{
+	int len = CP_POLL_WIRE_LEN;
+
+	if (sc_is_active(pd)) {
+		len += CP_POLL_WIRE_SC_LEN;
+	}
+	return cp_wire_ms(pd, len);
+}
+
+/**
+ * POLLs on a channel are spaced such that they consume no more than
+ * OSDP_CP_BUS_BUDGET_PCT of the wire time. Commands queued by the app are
+ * not subject to this budget.
+ */
+static inline int64_t cp_poll_gate(struct osdp_pd *pd)
+{
+	return pd->bus->poll_gate;
+}
+
+static void cp_poll_gate_update(struct osdp_pd *pd, int64_t now)
+{
+	int wire_ms = cp_poll_wire_ms(pd);
+
+	pd->bus->poll_gate =
+		now + (wire_ms * 100) / OSDP_CP_BUS_BUDGET_PCT;
+}
+
+/**
+ * Adapt the POLL interval based on what the PD had to say: anything other
+ * than an ACK (card reads, keypresses, status changes, ...) suggests more is
+ * coming so poll at poll_min_ms; an idle PD is backed off towards poll_max_ms.
+ */
+static void cp_poll_adapt(struct osdp_pd *pd)
+{
+	if (pd->reply_id != REPLY_ACK) {
+		pd->poll_ms = pd->poll_min_ms;
+		return;
+	}
+	pd->poll_ms += pd->poll_ms / 2 + 1;
+	if (pd->poll_ms > pd->poll_max_ms) {
+		pd->poll_ms = pd->poll_max_ms;
+	}
+}
+
+/**
+ * Reply timeout estimation (RFC 6298 style). What we track is the turnaround
+ * time of the PD -- round trip time less the time spent clocking the command
+ * and reply bytes on the wire -- so the estimate holds for commands/replies
+ * of any size and baud rate. As in TCP, pd->srtt is scaled by 8 and
+ * pd->rttvar by 4; pd->srtt < 0 means we don't have a sample yet.
+ */
+static void cp_rtt_sample(struct osdp_pd *pd, int64_t now)
+{
+	int32_t rtt, delta;
+
+	if (pd->phy_retry_count) {
+		return; /* Karn: can't tell which attempt this reply is for */
+	}
+	rtt = (int32_t)(now - pd->phy_tstamp);
+	rtt -= cp_wire_ms(pd, pd->tx_len + (int)pd->chn_buf->packet_len);
+	if (rtt < 0) {
+		rtt = 0;
+	}
+	if (pd->srtt < 0) {
+		pd->srtt = rtt << 3;
+		pd->rttvar = rtt << 1;
+		return;
+	}
+	delta = rtt - (pd->srtt >> 3);
+	pd->srtt += delta;
+	if (delta < 0) {
+		delta = -delta;
+	}
+	pd->rttvar += delta - (pd->rttvar >> 2);
+}
+
+static int cp_latency_type(int cmd_id)
+{
+	switch (cmd_id) {
+	case CMD_POLL:         return OSDP_CMD_LATENCY_POLL;
+	case CMD_OUT:          return OSDP_CMD_LATENCY_OUTPUT;
+	case CMD_LED:          return OSDP_CMD_LATENCY_LED;
+	case CMD_FILETRANSFER: return OSDP_CMD_LATENCY_FILE_TX;
+	case CMD_CHLNG:        return OSDP_CMD_LATENCY_SC_CHLNG;
+	case CMD_SCRYPT:       return OSDP_CMD_LATENCY_SC_SCRYPT;
+	default:               return OSDP_CMD_LATENCY_OTHER;
+	}
+}
+
+static int latency_bucket(uint32_t ms)
+{
+	int msb = 0;
+
+	if (ms < 4) {
+		return (int)ms;
+	}
+	while (ms >> (msb + 1)) {
+		msb++;
+	}
+	if (msb > 12) {
+		return OSDP_LATENCY_BUCKETS - 1;
+	}
+	return 4 * (msb - 1) + (int)((ms >> (msb - 2)) & 3);
+}
+
+/* Largest value that falls in bucket b */
+static uint32_t latency_bucket_max(int b)
+{
+	int shift;
+
+	if (b < 4) {
+		return (uint32_t)b;
+	}
+	shift = b / 4 - 1;
+	return ((uint32_t)(4 + (b & 3) + 1) << shift) - 1;
+}
+
+static uint32_t latency_percentile(const struct osdp_latency_hist *h, int pc)
+{
+	uint32_t sum = 0, rank;
+	int b;
+
+	/* Rank of the sample at this percentile, rounded up; 1-indexed */
+	rank = (uint32_t)(((uint64_t)h->count * pc + 99) / 100);
+	for (b = 0; b < OSDP_LATENCY_BUCKETS; b++) {
+		sum += h->bucket[b];
+		if (sum >= rank) {
+			break;
+		}
+	}
+	return (latency_bucket_max(b) < h->max_ms) ?
+		latency_bucket_max(b) : h->max_ms;
+}
+
+/* Time from first send of the current command to a valid reply for it */
+static void cp_latency_sample(struct osdp_pd *pd, int64_t now)
+{
+	struct osdp_latency_hist *h;
+	uint32_t ms;
+
+	if (pd->latency == NULL || pd->cmd_tstamp == 0) {
+		return;
+	}
+	ms = (now > pd->cmd_tstamp) ? (uint32_t)(now - pd->cmd_tstamp) : 0;
+	h = &pd->latency[cp_latency_type(pd->cmd_id)];
+	h->bucket[latency_bucket(ms)]++;
+	h->count++;
+	if (ms > h->max_ms) {
+		h->max_ms = ms;
+	}
+	if (pd->slow_cmd_ms && ms > pd->slow_cmd_ms) {
+		LOG_WRN("Slow reply to CMD: %s(%02x); took %u ms (%d retries)",
+			osdp_cmd_name(pd->cmd_id), pd->cmd_id, ms,
+			pd->phy_retry_count);
+	}
+}
+
+/**
+ * Retransmission timeout for the last command sent to this PD. As in RFC 6298
+ * (2.4), the result is rounded up to OSDP_RESP_TOUT_MIN_MS: on a half duplex
+ * bus, a retry that goes out while a slow (but compliant) PD is still about
+ * to reply collides with that reply.
+ */
+static int cp_rto_ms(struct osdp_pd *pd)
+{
+	int rto;
+
+	if (pd->srtt < 0) {
+		return OSDP_RESP_TOUT_MS;
+	}
+	rto = pd->rttvar;
+	if (rto < OSDP_RESP_POLL_MS) {
+		rto = OSDP_RESP_POLL_MS; /* clock granularity (G) */
+	}
+	rto += (pd->srtt >> 3) + cp_wire_ms(pd, pd->tx_len);
+	if (rto < OSDP_RESP_TOUT_MIN_MS) {
+		rto = OSDP_RESP_TOUT_MIN_MS;
+	}
+	return (rto < OSDP_RESP_TOUT_MS) ? rto : OSDP_RESP_TOUT_MS;
+}
+
+/**
+ * "Equal jitter": pick a random wait in [wait/2, wait] so that PDs that
+ * failed together don't retry in lockstep.
+ */
+static uint32_t cp_jitter(uint32_t wait)
+{
+	uint32_t rnd;
+
+	osdp_fill_random((uint8_t *)&rnd, sizeof(rnd));
+	return wait / 2 + rnd % (wait / 2 + 1);
+}
+
+/* Exponential backoff from the RTO, capped at OSDP_CMD_RETRY_WAIT_MS */
+static uint32_t cp_retry_backoff_ms(struct osdp_pd *pd, int attempt)
+{
+	int i;
+	uint32_t wait = cp_rto_ms(pd);
+
+	for (i = 1; i < attempt && wait < OSDP_CMD_RETRY_WAIT_MS; i++) {
+		wait <<= 1;
+	}
+	if (wait > OSDP_CMD_RETRY_WAIT_MS) {
+		wait = OSDP_CMD_RETRY_WAIT_MS;
+	}
+	return cp_jitter(wait);
+}
+
+/**
+ * Offline PD probing: once a PD has failed to come online, each attempt to
+ * bring it back starts with a single ID request (a probe) that gets a short
+ * timeout and no retries. Failed probes are backed off exponentially (with
+ * jitter) up to OSDP_ONLINE_RETRY_WAIT_MAX_MS, and probes on a channel are
+ * spaced so they take at most OSDP_CP_PROBE_BUDGET_PCT of the wire time.
+ */
+static inline bool cp_is_probing(struct osdp_pd *pd)
+{
+	return pd->state == OSDP_CP_STATE_INIT && pd->offline_count > 0;
+}
+
+static inline int cp_probe_timeout_ms(struct osdp_pd *pd)
+{
+	return OSDP_PROBE_TOUT_MS + cp_wire_ms(pd, pd->tx_len);
+}
+
+static inline int64_t cp_probe_gate(struct osdp_pd *pd)
+{
+	return pd->bus->probe_gate;
+}
+
+static void cp_probe_gate_update(struct osdp_pd *pd, int64_t now)
+{
+	int cost_ms = OSDP_PROBE_TOUT_MS + cp_poll_wire_ms(pd);
+
+	pd->bus->probe_gate =
+		now + (cost_ms * 100) / OSDP_CP_PROBE_BUDGET_PCT;
+}
+
+static uint32_t cp_offline_backoff_ms(struct osdp_pd *pd)
+{
+	int i;
+	uint32_t wait = OSDP_PROBE_BACKOFF_MIN_MS;
+
+	for (i = 1; i < pd->offline_count &&
+		    wait < OSDP_ONLINE_RETRY_WAIT_MAX_MS; i++) {
+		wait <<= 1;
+	}
+	if (wait > OSDP_ONLINE_RETRY_WAIT_MAX_MS) {
+		wait = OSDP_ONLINE_RETRY_WAIT_MAX_MS;
+	}
+	return cp_jitter(wait);
+}
+
+/**
+ * How long to wait for a reply before probing again. The timeout is doubled
+ * for each retry and is never more than OSDP_RESP_TOUT_MS (the maximum that
+ * the spec allows the PD to take). Once the reply has started to arrive, we
+ * give it the full OSDP_RESP_TOUT_MS.
+ */
+static int cp_reply_timeout_ms(struct osdp_pd *pd)
 {
-	/* called when we have a valid response from the PD */
-	if (sc_is_active(pd)) {
-		pd->sc_tstamp = osdp_millis_now();
+	int i, tout;
+
+	if (pd->chn_buf->packet_buf_len) {
+		return OSDP_RESP_TOUT_MS;
 	}
-	pd->phy_retry_count = 0;
-	pd->phy_state = OSDP_CP_PHY_STATE_DONE;
+	if (cp_is_probing(pd)) {
+		return cp_probe_timeout_ms(pd);
+	}
+	tout = cp_rto_ms(pd);
+	for (i = 0; i < pd->phy_retry_count && tout < OSDP_RESP_TOUT_MS; i++) {
+		tout <<= 1;
+	}
+	return (tout < OSDP_RESP_TOUT_MS) ? tout : OSDP_RESP_TOUT_MS;
 }
 
 static void cp_phy_state_wait(struct osdp_pd *pd, uint32_t wait_ms)
@@ -864,7 +1993,7 @@ static void cp_phy_state_wait(struct osdp_pd *pd, uint32_t wait_ms)
 
 static int cp_phy_state_update(struct osdp_pd *pd)
 {
-	int rc, ret = OSDP_CP_ERR_CAN_YIELD;
+	int rc, tout, ret = OSDP_CP_ERR_CAN_YIELD;
 
 	switch (pd->phy_state) {
 	case OSDP_CP_PHY_STATE_DONE:
@@ -888,15 +2017,28 @@ static int cp_phy_state_update(struct osdp_pd *pd)
 			goto error;
 		}
 		ret = OSDP_CP_ERR_INPROG;
+		pd->tx_len = (int)(pd->chn_buf->packet_buf_len +
+				   pd->chn_buf->tx_payload.len);
 		osdp_phy_state_reset(pd, false);
 		pd->reply_id = REPLY_INVALID;
 		pd->phy_state = OSDP_CP_PHY_STATE_REPLY_WAIT;
 		pd->phy_tstamp = osdp_millis_now();
+		if (pd->cmd_tstamp == 0) {
+			pd->cmd_tstamp = pd->phy_tstamp;
+		}
 		break;
 	case OSDP_CP_PHY_STATE_REPLY_WAIT:
 		rc = cp_process_reply(pd);
 		if (rc == OSDP_CP_ERR_NONE) {
 			pd->tstamp = osdp_millis_now();
+			cp_rtt_sample(pd, pd->tstamp);
+			cp_latency_sample(pd, pd->tstamp);
+			cp_snapshot_begin(pd);
+			pd->snapshot.last_seen = pd->tstamp;
+			cp_snapshot_end(pd);
+			if (pd->cmd_id == CMD_POLL) {
+				cp_poll_adapt(pd);
+			}
 			osdp_phy_progress_sequence(pd);
 			cp_phy_state_done(pd);
 			return OSDP_CP_ERR_NONE;
@@ -911,15 +2053,26 @@ static int cp_phy_state_update(struct osdp_pd *pd)
 			goto error;
 		}
 		if (rc == OSDP_CP_ERR_RETRY_CMD) {
-			cp_phy_state_wait(pd, OSDP_CMD_RETRY_WAIT_MS);
+			pd->phy_busy_count += 1;
+			pd->stats.retries++;
+			cp_phy_state_wait(pd, cp_retry_backoff_ms(pd,
+						pd->phy_busy_count));
 			return OSDP_CP_ERR_CAN_YIELD;
 		}
-		if (osdp_millis_since(pd->phy_tstamp) > OSDP_RESP_TOUT_MS) {
+		tout = cp_reply_timeout_ms(pd);
+		if (osdp_millis_since(pd->phy_tstamp) > tout) {
+			pd->stats.timeouts++;
+			if (cp_is_probing(pd)) {
+				LOG_DBG("No response to probe in %dms", tout);
+				goto error;
+			}
 			if (pd->phy_retry_count < OSDP_CMD_MAX_RETRIES) {
 				pd->phy_retry_count += 1;
-				LOG_WRN("No response in 200ms; probing (%d)",
-					pd->phy_retry_count);
-				cp_phy_state_wait(pd, OSDP_CMD_RETRY_WAIT_MS);
+				pd->stats.retries++;
+				LOG_WRN("No response in %dms; probing (%d)",
+					tout, pd->phy_retry_count);
+				cp_phy_state_wait(pd, cp_retry_backoff_ms(pd,
+						pd->phy_retry_count));
 				return OSDP_CP_ERR_CAN_YIELD;
 			}
 			LOG_ERR("Response timeout for CMD: %s(%02x)",
@@ -932,6 +2085,7 @@ static int cp_phy_state_update(struct osdp_pd *pd)
 
 	return ret;
 error:
+	pd->phy_busy_count = 0;
 	pd->phy_state = OSDP_CP_PHY_STATE_ERR;
 	return OSDP_CP_ERR_GENERIC;
 }
@@ -952,12 +2106,42 @@ static const char *state_get_name(enum osdp_cp_state_e state)
 	}
 }
 
+static void notify_command_expired(struct osdp_pd *pd, struct osdp_cmd *cmd)
+{
+	struct osdp_event evt;
+	struct osdp *ctx = pd_to_osdp(pd);
+
+	LOG_WRN("Dropping expired command %d (ttl: %ums)", cmd->id, cmd->ttl_ms);
+
+	if (!cp_has_event_sink(ctx) ||
+	    !ISSET_FLAG(pd, OSDP_FLAG_ENABLE_NOTIFICATION)) {
+		return;
+	}
+
+	evt.type = OSDP_EVENT_NOTIFICATION;
+	evt.notif.type = OSDP_EVENT_NOTIFICATION_COMMAND_EXPIRED;
+	evt.notif.arg0 = cmd->id;
+	evt.notif.arg1 = 0;
+
+	cp_dispatch_event(pd, &evt);
+}
+
 static int cp_get_online_command(struct osdp_pd *pd)
 {
 	struct osdp_cmd *cmd;
+	int64_t now;
 	int ret;
 
-	if (cp_cmd_dequeue(pd, &cmd) == 0) {
+	/* pick up anything posted since this refresh started */
+	cp_cmd_ring_drain(pd);
+
+	now = osdp_millis_now();
+	while (cp_cmd_dequeue(pd, &cmd) == 0) {
+		if (cp_cmd_expired(cmd, now)) {
+			notify_command_expired(pd, cmd);
+			cp_cmd_free(pd, cmd);
+			continue;
+		}
 		ret = cp_translate_cmd(pd, cmd);
 		if (cmd->flags & OSDP_CMD_FLAG_BROADCAST) {
 			SET_FLAG(pd, PD_FLAG_PKT_BROADCAST);
@@ -971,8 +2155,9 @@ static int cp_get_online_command(struct osdp_pd *pd)
 		return ret;
 	}
 
-	if (osdp_millis_since(pd->tstamp) > OSDP_PD_POLL_TIMEOUT_MS) {
-		pd->tstamp = osdp_millis_now();
+	if (now - pd->tstamp > pd->poll_ms && now >= cp_poll_gate(pd)) {
+		pd->tstamp = now;
+		cp_poll_gate_update(pd, now);
 		return CMD_POLL;
 	}
 
@@ -984,7 +2169,7 @@ static void notify_pd_status(struct osdp_pd *pd, bool is_online)
 	struct osdp *ctx = pd_to_osdp(pd);
 	struct osdp_event evt;
 
-	if (!ctx->event_callback ||
+	if (!cp_has_event_sink(ctx) ||
 	    !ISSET_FLAG(pd, OSDP_FLAG_ENABLE_NOTIFICATION)) {
 		return;
 	}
@@ -992,7 +2177,7 @@ static void notify_pd_status(struct osdp_pd *pd, bool is_online)
 	evt.type = OSDP_EVENT_NOTIFICATION;
 	evt.notif.type = OSDP_EVENT_NOTIFICATION_PD_STATUS;
 	evt.notif.arg0 = is_online;
-	ctx->event_callback(ctx->event_callback_arg, pd->idx, &evt);
+	cp_dispatch_event(pd, &evt);
 }
 
 static void notify_sc_status(struct osdp_pd *pd)
@@ -1000,7 +2185,7 @@ static void notify_sc_status(struct osdp_pd *pd)
 	struct osdp *ctx = pd_to_osdp(pd);
 	struct osdp_event evt;
 
-	if (!ctx->event_callback ||
+	if (!cp_has_event_sink(ctx) ||
 	    !ISSET_FLAG(pd, OSDP_FLAG_ENABLE_NOTIFICATION)) {
 		return;
 	}
@@ -1009,7 +2194,7 @@ static void notify_sc_status(struct osdp_pd *pd)
 	evt.notif.type = OSDP_EVENT_NOTIFICATION_SC_STATUS;
 	evt.notif.arg0 = sc_is_active(pd);
 	evt.notif.arg1 = ISSET_FLAG(pd, PD_FLAG_SC_USE_SCBKD);
-	ctx->event_callback(ctx->event_callback_arg, pd->idx, &evt);
+	cp_dispatch_event(pd, &evt);
 }
 
 static void cp_keyset_complete(struct osdp_pd *pd)
@@ -1152,7 +2337,8 @@ static enum osdp_cp_state_e get_next_ok_state(struct osdp_pd *pd)
 		}
 		return OSDP_CP_STATE_ONLINE;
 	case OSDP_CP_STATE_OFFLINE:
-		if (osdp_millis_since(pd->tstamp) > pd->wait_ms) {
+		if (osdp_millis_since(pd->tstamp) > pd->wait_ms &&
+		    osdp_millis_now() >= cp_probe_gate(pd)) {
 			return OSDP_CP_STATE_INIT;
 		}
 		return OSDP_CP_STATE_OFFLINE;
@@ -1172,6 +2358,8 @@ static enum osdp_cp_state_e get_next_err_state(struct osdp_pd *pd)
 	case OSDP_CP_STATE_CAPDET:
 		return OSDP_CP_STATE_OFFLINE;
 	case OSDP_CP_STATE_SC_CHLNG:
+		pd->stats.sc_failures++;
+		osdp_flight_recorder_trigger(pd, OSDP_FLIGHT_RECORDER_SC_FAILURE);
 		if (is_enforce_secure(pd)) {
 			LOG_ERR("CHLNG failed. Set PD offline due to "
 				"ENFORCE_SECURE");
@@ -1180,6 +2368,7 @@ static enum osdp_cp_state_e get_next_err_state(struct osdp_pd *pd)
 		if (!ISSET_FLAG(pd, PD_FLAG_SC_USE_SCBKD)) {
 			SET_FLAG(pd, PD_FLAG_SC_USE_SCBKD);
 			LOG_WRN("SC Failed. Retry with SCBK-D");
+			pd->stats.sc_handshakes++;
 			return OSDP_CP_STATE_SC_CHLNG;
 		}
 		CLEAR_FLAG(pd, PD_FLAG_SC_USE_SCBKD);
@@ -1190,6 +2379,8 @@ static enum osdp_cp_state_e get_next_err_state(struct osdp_pd *pd)
 		pd->sc_tstamp = osdp_millis_now();
 		return OSDP_CP_STATE_ONLINE;
 	case OSDP_CP_STATE_SC_SCRYPT:
+		pd->stats.sc_failures++;
+		osdp_flight_recorder_trigger(pd, OSDP_FLIGHT_RECORDER_SC_FAILURE);
 		if (is_enforce_secure(pd)) {
 			LOG_ERR("SCRYPT failed. Set PD offline due to "
 				"ENFORCE_SECURE");
@@ -1227,25 +2418,40 @@ static void cp_state_change(struct osdp_pd *pd, enum osdp_cp_state_e next)
 
 	switch (next) {
 	case OSDP_CP_STATE_INIT:
+		if (cur == OSDP_CP_STATE_OFFLINE) {
+			/* this is a probe; hold off others on this channel */
+			cp_probe_gate_update(pd, osdp_millis_now());
+		}
 		osdp_phy_state_reset(pd, true);
 		break;
 	case OSDP_CP_STATE_ONLINE:
 		LOG_INF("Online; %s SC", sc_is_active(pd) ? "With" : "Without");
+		pd->poll_ms = pd->poll_min_ms;
+		pd->offline_count = 0;
 		notify_pd_status(pd, true);
 		break;
 	case OSDP_CP_STATE_OFFLINE:
 		pd->tstamp = osdp_millis_now();
-		pd->wait_ms = OSDP_ONLINE_RETRY_WAIT_MAX_MS;
+		pd->offline_count += 1;
+		pd->wait_ms = cp_offline_backoff_ms(pd);
 		sc_deactivate(pd);
+		if (pd->offline_count > 1) {
+			LOG_DBG("Still offline; next probe in %u ms",
+				pd->wait_ms);
+			break;
+		}
 		notify_sc_status(pd);
-		LOG_ERR("Going offline for %d seconds; Was in '%s' state",
-			pd->wait_ms / 1000, state_get_name(cur));
+		LOG_ERR("Going offline; Was in '%s' state; next probe in %u ms",
+			state_get_name(cur), pd->wait_ms);
 		notify_pd_status(pd, false);
+		osdp_flight_recorder_trigger(pd, OSDP_FLIGHT_RECORDER_PD_OFFLINE);
 		break;
 	case OSDP_CP_STATE_SC_CHLNG:
+		pd->stats.sc_handshakes++;
 		osdp_sc_setup(pd);
 		break;
 	case OSDP_CP_STATE_DISABLED:
+		pd->offline_count = 0;
 		sc_deactivate(pd);
 		notify_sc_status(pd);
 		notify_pd_status(pd, false);
@@ -1272,7 +2478,7 @@ static void notify_command_status(struct osdp_pd *pd, int status)
 	struct osdp_event evt;
 	struct osdp *ctx = pd_to_osdp(pd);
 
-	if (!ctx->event_callback ||
+	if (!cp_has_event_sink(ctx) ||
 	    !ISSET_FLAG(pd, OSDP_FLAG_ENABLE_NOTIFICATION)) {
 		return;
 	}
@@ -1302,7 +2508,7 @@ static void notify_command_status(struct osdp_pd *pd, int status)
 	evt.notif.arg0 = app_cmd;
 	evt.notif.arg1 = status;
 
-	ctx->event_callback(ctx->event_callback_arg, pd->idx, &evt);
+	cp_dispatch_event(pd, &evt);
 }
 
 static int state_update(struct osdp_pd *pd)
@@ -1371,41 +2577,220 @@ static int state_update(struct osdp_pd *pd)
 	return OSDP_CP_ERR_CAN_YIELD;
 }
 
-static int cp_refresh(struct osdp_pd *pd)
+/**
+ * Returns the time (in ms, same base as osdp_millis_now()) at which
+ * state_update() will have some work to do for this PD or CP_SCHED_NEVER if
+ * nothing is scheduled. The time comparisons in the FSM are strict, hence the
+ * +1s.
+ */
+static int64_t cp_get_next_deadline(struct osdp_pd *pd, int64_t now)
 {
-	int rc;
+	int wait_ms;
+	int64_t deadline;
+
+	switch (pd->phy_state) {
+	case OSDP_CP_PHY_STATE_IDLE:
+		break;
+	case OSDP_CP_PHY_STATE_WAIT:
+		return pd->phy_tstamp + pd->wait_ms;
+	case OSDP_CP_PHY_STATE_REPLY_WAIT:
+		/* Replies can arrive any time; keep looking at the channel */
+		deadline = pd->phy_tstamp + cp_reply_timeout_ms(pd) + 1;
+		if (deadline > now + OSDP_RESP_POLL_MS) {
+			deadline = now + OSDP_RESP_POLL_MS;
+		}
+		return deadline;
+	default:
+		return now;
+	}
+
+	if (pd->request) {
+		return now;
+	}
+
+	switch (pd->state) {
+	case OSDP_CP_STATE_ONLINE:
+		if (pd->cmd_queue_depth || cp_cmd_ring_ready(pd->cmd_ring)) {
+			/* app commands go ahead of routine POLLs */
+			return CP_SCHED_URGENT;
+		}
+		deadline = pd->tstamp + pd->poll_ms + 1;
+		if (deadline < cp_poll_gate(pd)) {
+			deadline = cp_poll_gate(pd);
+		}
+		wait_ms = osdp_file_tx_wait_ms(pd, now);
+		if (wait_ms >= 0 && now + wait_ms < deadline) {
+			deadline = now + wait_ms;
+		}
+		return deadline;
+	case OSDP_CP_STATE_OFFLINE:
+		deadline = pd->tstamp + pd->wait_ms + 1;
+		if (deadline < cp_probe_gate(pd)) {
+			deadline = cp_probe_gate(pd);
+		}
+		return deadline;
+	case OSDP_CP_STATE_DISABLED:
+		return CP_SCHED_NEVER;
+	default:
+		return now;
+	}
+}
+
+static void cp_channel_wake_waiters(struct osdp_pd *pd, int64_t now)
+{
+	int i;
+	struct osdp_pd *waiter;
 	struct osdp *ctx = pd_to_osdp(pd);
+	struct osdp_sched *s = pd_to_sched(pd);
+
+	for (i = 0; i < NUM_PD(ctx) && s->num_chn_waiters; i++) {
+		waiter = osdp_to_pd(ctx, i);
+		if (waiter == NULL || !ISSET_FLAG(waiter, PD_FLAG_CHN_WAIT) ||
+		    waiter->bus != pd->bus) {
+			continue;
+		}
+		CLEAR_FLAG(waiter, PD_FLAG_CHN_WAIT);
+		s->num_chn_waiters--;
+		cp_sched_update(waiter, cp_get_next_deadline(waiter, now));
+	}
+}
+
+static void cp_refresh(struct osdp_pd *pd, int64_t now)
+{
+	int rc;
+	struct osdp_sched *s = pd_to_sched(pd);
+
+	if (ISSET_FLAG(pd, PD_FLAG_CHN_WAIT)) {
+		CLEAR_FLAG(pd, PD_FLAG_CHN_WAIT);
+		s->num_chn_waiters--;
+	}
+
+	cp_cmd_ring_drain(pd);
 
 	if (ISSET_FLAG(pd, PD_FLAG_CHN_SHARED) &&
 	    cp_channel_acquire(pd, NULL)) {
-		/* Channel shared and failed to acquire lock */
-		return 0;
+		/**
+		 * Channel shared and failed to acquire lock; park this PD
+		 * until the current owner releases the channel.
+		 */
+		SET_FLAG(pd, PD_FLAG_CHN_WAIT);
+		s->num_chn_waiters++;
+		pd->sched_deadline = CP_SCHED_NEVER;
+		return;
 	}
 
 	rc = state_update(pd);
+	cp_snapshot_sync_state(pd);
 
-	if (ISSET_FLAG(pd, PD_FLAG_CHN_SHARED)) {
-		if (rc == OSDP_CP_ERR_CAN_YIELD) {
-			cp_channel_release(pd);
-		} else if (ctx->num_channels == 1) {
-			/**
-			 * If there is only one channel, there is no point in
-			 * trying to cp_channel_acquire() on the rest of the
-			 * PDs when we know that can never succeed.
-			 */
-			return -1;
+	if (ISSET_FLAG(pd, PD_FLAG_CHN_SHARED) &&
+	    rc == OSDP_CP_ERR_CAN_YIELD) {
+		cp_channel_release(pd);
+		cp_channel_wake_waiters(pd, now);
+	}
+	pd->sched_deadline = cp_get_next_deadline(pd, now);
+}
+
+/**
+ * App threads cannot touch the heap; they bump the group's posted count after
+ * posting a command instead. Bring the PDs of this group that have posted
+ * commands to the top of the heap. All PDs of the group are in the heap at
+ * this point; collect them in due[] first as updates reorder the heap.
+ */
+static void cp_sched_pick_posted(struct osdp *ctx, struct osdp_sched *s)
+{
+	int i, num_ready = 0;
+	unsigned int posted;
+	struct osdp_pd *pd;
+
+	posted = osdp_atomic_load(&s->posted);
+	if (posted == s->posted_seen) {
+		return;
+	}
+	s->posted_seen = posted;
+
+	for (i = 0; i < s->len; i++) {
+		pd = osdp_to_pd(ctx, s->heap[i]);
+		if (cp_cmd_ring_ready(pd->cmd_ring)) {
+			s->due[num_ready++] = pd->idx;
 		}
 	}
-	return 0;
+	for (i = 0; i < num_ready; i++) {
+		cp_sched_update(osdp_to_pd(ctx, s->due[i]), CP_SCHED_URGENT);
+	}
 }
 
-static int cp_submit_command(struct osdp_pd *pd, const struct osdp_cmd *cmd)
+/**
+ * Make the event callbacks that cp_dispatch_event() held back. Called with the
+ * group lock held (once); it is dropped for the duration of the callbacks.
+ */
+static void cp_sched_flush_events(struct osdp *ctx, struct osdp_sched *s)
 {
-	struct osdp_cmd *p;
-	const uint32_t all_flags = (
-		OSDP_CMD_FLAG_BROADCAST
-	);
+	int i, num_events = s->num_events;
+	struct osdp_event event;
+	int pd_idx;
+
+	if (num_events == 0) {
+		return;
+	}
+	s->num_events = 0;
+	for (i = 0; i < num_events; i++) {
+		/* copied out since a callback can refill events[] */
+		pd_idx = s->events[i].pd;
+		memcpy(&event, &s->events[i].event, sizeof(struct osdp_event));
+		osdp_cp_worker_unlock(s);
+		if (ctx->event_callback) {
+			ctx->event_callback(ctx->event_callback_arg, pd_idx,
+					    &event);
+		}
+		osdp_cp_worker_lock(s);
+	}
+}
+
+/**
+ * Refresh all PDs in this group whose deadline has expired. Returns the next
+ * deadline of this group.
+ */
+int64_t osdp_cp_sched_refresh(struct osdp *ctx, struct osdp_sched *s)
+{
+	int i, num_due = 0;
+	int64_t now;
+	struct osdp_pd *pd;
 
+	cp_sched_pick_posted(ctx, s);
+	now = osdp_millis_now();
+
+	/**
+	 * Pull all PDs that are due out of the heap first so that each one of
+	 * them is refreshed at most once in this cycle.
+	 */
+	while (s->len && cp_sched_key(ctx, s, 0) <= now) {
+		pd = cp_sched_pop(ctx, s);
+		s->due[num_due++] = pd->idx;
+	}
+
+	for (i = 0; i < num_due; i++) {
+		pd = osdp_to_pd(ctx, s->due[i]);
+		/**
+		 * The lock is dropped while making event callbacks, so this
+		 * PD could have been removed (or replaced by a new PD that is
+		 * already scheduled) or moved to another group by then.
+		 */
+		if (pd == NULL || pd->sched_pos >= 0 || pd_to_sched(pd) != s) {
+			continue;
+		}
+		s->refreshing = pd;
+		cp_refresh(pd, now);
+		s->refreshing = NULL;
+		cp_sched_push(pd);
+		cp_sched_flush_events(ctx, s);
+	}
+
+	return cp_sched_next_deadline(ctx, s);
+}
+
+static int cp_check_command_target(struct osdp_pd *pd,
+				   const struct osdp_cmd *cmd)
+{
 	if (pd->state == OSDP_CP_STATE_DISABLED) {
 		LOG_ERR("PD is disabled");
 		return -1;
@@ -1416,11 +2801,72 @@ static int cp_submit_command(struct osdp_pd *pd, const struct osdp_cmd *cmd)
 		return -1;
 	}
 
+	if (cmd->id == OSDP_CMD_KEYSET &&
+	    (cmd->keyset.type != 1 || !sc_is_active(pd))) {
+		LOG_ERR("Invalid keyset request");
+		return -1;
+	}
+
+	return 0;
+}
+
+static inline bool cp_cmd_prio_conflict(const struct osdp_cmd *cmd)
+{
+	const uint32_t prio_flags = (
+		OSDP_CMD_FLAG_PRIO_URGENT |
+		OSDP_CMD_FLAG_PRIO_BACKGROUND
+	);
+
+	return (cmd->flags & prio_flags) == prio_flags;
+}
+
+/**
+ * Post a command to this PD's ring. This is the only part of the command
+ * submission path that app threads run; it takes no locks and never waits on
+ * a refresh that is in progress.
+ */
+static int cp_post_command(struct osdp_pd *pd, const struct osdp_cmd *cmd)
+{
+	struct osdp_sched *s = pd_to_sched(pd);
+
+	if (cp_cmd_reserve(pd)) {
+		return -1;
+	}
+	if (cp_cmd_ring_push(pd->cmd_ring, cmd, cp_cmd_expiry(cmd))) {
+		cp_cmd_unreserve(pd);
+		LOG_WRN("Command ring full; try again later");
+		return -1;
+	}
+	osdp_atomic_add(&s->posted, 1);
+	osdp_cp_worker_wake(s);
+	return 0;
+}
+
+static int cp_submit_command(struct osdp_pd *pd, const struct osdp_cmd *cmd)
+{
+	int rc;
+	struct osdp_sched *s;
+	const uint32_t all_flags = (
+		OSDP_CMD_FLAG_BROADCAST |
+		OSDP_CMD_FLAG_PRIO_URGENT |
+		OSDP_CMD_FLAG_PRIO_BACKGROUND |
+		OSDP_CMD_FLAG_COALESCE
+	);
+
+	if (cp_check_command_target(pd, cmd)) {
+		return -1;
+	}
+
 	if (cmd->flags & ~all_flags) {
 		LOG_ERR("Invalid command flag");
 		return -1;
 	}
 
+	if (cp_cmd_prio_conflict(cmd)) {
+		LOG_ERR("Conflicting command priority flags");
+		return -1;
+	}
+
 	if (cmd->flags & OSDP_CMD_FLAG_BROADCAST) {
 		if (NUM_PD(pd->osdp_ctx) != 1) {
 			LOG_ERR("Command broadcast is allowed only in single"
@@ -1435,88 +2881,217 @@ static int cp_submit_command(struct osdp_pd *pd, const struct osdp_cmd *cmd)
 	}
 
 	if (cmd->id == OSDP_CMD_FILE_TX) {
-		return osdp_file_tx_command(pd, cmd->file_tx.id,
-					    cmd->file_tx.flags);
-	} else if (cmd->id == OSDP_CMD_KEYSET &&
-		   (cmd->keyset.type != 1 || !sc_is_active(pd))) {
-		LOG_ERR("Invalid keyset request");
-		return -1;
+		/* file transfer state is owned by the refresh context */
+		s = cp_pd_lock(pd);
+		cp_sched_kick(pd);
+		rc = osdp_file_tx_command(pd, cmd->file_tx.id,
+					  cmd->file_tx.flags);
+		osdp_cp_worker_unlock(s);
+		return rc;
 	}
 
-	p = cp_cmd_alloc(pd);
-	if (p == NULL) {
-		LOG_ERR("Failed to allocate command");
-		return -1;
+	return cp_post_command(pd, cmd);
+}
+
+/**
+ * Attach this PD to the bus of its channel. PDs with the same channel.id share
+ * a bus (and the RX/packet buffers in it) and take turns on it through the
+ * channel lock (bus->owner); see cp_channel_acquire(). Each bus has a number
+ * (pd->chn_slot) that is used to split the PDs into scheduling groups.
+ *
+ * PDs that are being added along with this one are not in the PD table yet;
+ * they are passed in pending[] so they can share a channel too.
+ */
+static int cp_pd_attach_bus(struct osdp_pd *pd, struct osdp_pd **pending,
+			    int num_pending)
+{
+	int i, slot = 0;
+	uint32_t used[(OSDP_PD_MAX + 31) / 32] = { 0 };
+	struct osdp *ctx = pd_to_osdp(pd);
+	struct osdp_bus *bus = NULL;
+	struct osdp_pd *peer;
+
+	for (i = 0; i < NUM_PD(ctx) + num_pending; i++) {
+		if (i < NUM_PD(ctx)) {
+			peer = osdp_to_pd(ctx, i);
+		} else {
+			peer = pending[i - NUM_PD(ctx)];
+		}
+		if (peer == NULL || peer == pd || peer->bus == NULL) {
+			continue;
+		}
+		if (peer->channel.id == pd->channel.id) {
+			bus = peer->bus;
+			break;
+		}
+		used[peer->chn_slot / 32] |= 1U << (peer->chn_slot % 32);
+	}
+
+	if (bus != NULL) {
+		if (bus->num_pd == 1) {
+			/* the PD that had it to itself may be mid-command */
+			SET_FLAG(peer, PD_FLAG_CHN_SHARED);
+			if (cp_phy_running(peer)) {
+				bus->owner = peer->idx;
+			}
+		}
+		SET_FLAG(pd, PD_FLAG_CHN_SHARED);
+		pd->chn_slot = peer->chn_slot;
+	} else {
+		bus = calloc(1, sizeof(struct osdp_bus));
+		if (bus == NULL) {
+			LOG_PRINT("Failed to allocate osdp bus context");
+			return -1;
+		}
+		bus->owner = -1;
+		while (used[slot / 32] & (1U << (slot % 32))) {
+			slot++;
+		}
+		pd->chn_slot = slot;
+		ctx->num_channels++;
 	}
-	memcpy(p, cmd, sizeof(struct osdp_cmd));
-	cp_cmd_enqueue(pd, p);
+
+	bus->num_pd++;
+	pd->bus = bus;
+	pd->chn_buf = &bus->buf;
 	return 0;
 }
 
-static int cp_detect_connection_topology(struct osdp *ctx)
+/* Undo cp_pd_attach_bus(); the last PD on a channel closes it, if asked to */
+static void cp_pd_detach_bus(struct osdp_pd *pd, bool close_channel)
 {
-	int i, j, num_channels;
-	int *channel_lock = NULL;
-	struct osdp_pd *pd;
-	struct disjoint_set set;
-	int channels[OSDP_PD_MAX] = { 0 };
+	int i;
+	struct osdp *ctx = pd_to_osdp(pd);
+	struct osdp_bus *bus = pd->bus;
+	struct osdp_pd *peer;
 
-	if (disjoint_set_make(&set, NUM_PD(ctx)))
-		return -1;
+	if (bus == NULL) {
+		return;
+	}
+	pd->bus = NULL;
+	pd->chn_buf = NULL;
+	CLEAR_FLAG(pd, PD_FLAG_CHN_SHARED);
 
-	for (i = 0; i < NUM_PD(ctx); i++) {
-		pd = osdp_to_pd(ctx, i);
-		for (j = 0; j < i; j++) {
-			if (channels[j] == pd->channel.id) {
-				SET_FLAG(osdp_to_pd(ctx, j), PD_FLAG_CHN_SHARED);
-				SET_FLAG(pd, PD_FLAG_CHN_SHARED);
-				disjoint_set_union(&set, i, j);
-			}
+	if (--bus->num_pd == 0) {
+		if (close_channel && pd->channel.close) {
+			pd->channel.close(pd->channel.data);
 		}
-		channels[i] = pd->channel.id;
+		ctx->num_channels--;
+		free(bus);
+		return;
 	}
 
-	num_channels = disjoint_set_num_roots(&set);
-	if (num_channels != NUM_PD(ctx)) {
-		channel_lock = calloc(1, sizeof(int) * NUM_PD(ctx));
-		if (channel_lock == NULL) {
-			LOG_PRINT("Failed to allocate osdp channel locks");
-			return -1;
+	if (bus->num_pd == 1) {
+		/* the PD left behind has the channel to itself again */
+		for (i = 0; i < NUM_PD(ctx); i++) {
+			peer = osdp_to_pd(ctx, i);
+			if (peer != NULL && peer != pd && peer->bus == bus) {
+				CLEAR_FLAG(peer, PD_FLAG_CHN_SHARED);
+			}
 		}
+		bus->owner = -1;
+	} else if (bus->owner == pd->idx) {
+		bus->owner = -1;
 	}
+}
 
-	safe_free(ctx->channel_lock);
-	ctx->num_channels = num_channels;
-	ctx->channel_lock = channel_lock;
-	return 0;
+/* Free a PD that is no longer in the PD table */
+static void cp_pd_free(struct osdp_pd *pd)
+{
+	if (is_capture_enabled(pd) && pd->packet_capture_ctx) {
+		osdp_packet_capture_finish(pd);
+	}
+	safe_free(pd->file);
+	safe_free(pd->cmd_ring);
+	safe_free(pd->latency);
+	free(pd);
+}
+
+/* Take the locks of all groups; for changes to the PD table and buses */
+static void cp_lock_all(struct osdp *ctx, int num_sched)
+{
+	int i;
+
+	for (i = 0; i < num_sched; i++) {
+		osdp_cp_worker_lock(ctx->sched[i]);
+	}
+}
+
+static void cp_unlock_all(struct osdp *ctx, int num_sched)
+{
+	int i;
+
+	for (i = num_sched - 1; i >= 0; i--) {
+		osdp_cp_worker_unlock(ctx->sched[i]);
+	}
+}
+
+/**
+ * Wait for the app threads that got hold of this PD through osdp_pd_get()
+ * before it was taken out of the PD table to be done with it. Must be called
+ * without any group locks held since those threads may be waiting for one.
+ */
+static void cp_pd_quiesce(struct osdp *ctx, struct osdp_pd *pd)
+{
+	osdp_atomic_fence();
+	while (osdp_atomic_load(&ctx->pd_lookups) != 0 ||
+	       osdp_atomic_load(&pd->refs) != 0) {
+		osdp_cp_yield();
+	}
 }
 
+/**
+ * Add PDs to the free offsets of the PD table (the lowest ones first). The
+ * table is sized for OSDP_PD_MAX PDs once, so existing PDs never move.
+ *
+ * The new PDs are put in the table only once nothing else can fail, so app
+ * threads never get to see a PD that is then taken away. Called with the
+ * locks of all groups held; the new PDs join the groups of their channels.
+ */
 static int cp_add_pd(struct osdp *ctx, int num_pd, const osdp_pd_info_t *info_list)
 {
-	int i, old_num_pd;
-	struct osdp_pd *old_pd_array, *new_pd_array, *pd;
+	int i, pos, count = 0;
+	struct osdp_pd **new_pd, *pd;
 	const osdp_pd_info_t *info;
 	char name[24] = { 0 };
 
-	assert(num_pd);
+	assert(num_pd > 0);
 	assert(info_list);
-	old_num_pd = ctx->_num_pd;
-	old_pd_array = ctx->pd;
 
-	new_pd_array = calloc(old_num_pd + num_pd, sizeof(struct osdp_pd));
-	if (new_pd_array == NULL) {
-		LOG_PRINT("Failed to allocate new osdp_pd[] context");
+	for (pos = 0; pos < OSDP_PD_MAX && count < num_pd; pos++) {
+		if (ctx->pd[pos] == NULL) {
+			count++;
+		}
+	}
+	if (count < num_pd) {
+		LOG_PRINT("Cannot have more than %d PDs", OSDP_PD_MAX);
+		return -1;
+	}
+
+	/* the first PDs need a group to go into */
+	if (ctx->num_sched == 0 && cp_sched_init(ctx, 1)) {
 		return -1;
 	}
 
-	ctx->pd = new_pd_array;
-	ctx->_num_pd = old_num_pd + num_pd;
-	memcpy(new_pd_array, old_pd_array, sizeof(struct osdp_pd) * old_num_pd);
+	new_pd = calloc(num_pd, sizeof(struct osdp_pd *));
+	if (new_pd == NULL) {
+		LOG_PRINT("Failed to allocate new osdp_pd[] table");
+		return -1;
+	}
 
+	pos = 0;
 	for (i = 0; i < num_pd; i++) {
 		info = info_list + i;
-		pd = osdp_to_pd(ctx, i + old_num_pd);
-		pd->idx = i;
+		while (ctx->pd[pos] != NULL) {
+			pos++;
+		}
+		pd = calloc(1, sizeof(struct osdp_pd));
+		if (pd == NULL) {
+			LOG_PRINT("Failed to allocate osdp_pd context");
+			goto error;
+		}
+		new_pd[i] = pd;
+		pd->idx = pos++;
 		pd->osdp_ctx = ctx;
 		if (info->name) {
 			strncpy(pd->name, info->name, OSDP_PD_NAME_MAXLEN - 1);
@@ -1524,9 +3099,14 @@ static int cp_add_pd(struct osdp *ctx, int num_pd, const osdp_pd_info_t *info_li
 			snprintf(pd->name, OSDP_PD_NAME_MAXLEN, "PD-%d", info->address);
 		}
 		pd->baud_rate = info->baud_rate;
+		pd->poll_min_ms = OSDP_PD_POLL_TIMEOUT_MS;
+		pd->poll_max_ms = OSDP_PD_POLL_MAX_MS;
+		pd->poll_ms = pd->poll_min_ms;
+		pd->srtt = -1;
 		pd->address = info->address;
 		pd->flags = info->flags;
 		pd->seq_number = -1;
+		pd->snapshot.view.enabled = true;
 		SET_FLAG(pd, PD_FLAG_SC_DISABLED);
 		/* Default to CRC-16 until we know PD capabilities */
 		SET_FLAG(pd, PD_FLAG_CP_USE_CRC);
@@ -1543,6 +3123,12 @@ static int cp_add_pd(struct osdp *ctx, int num_pd, const osdp_pd_info_t *info_li
 		if (cp_cmd_queue_init(pd)) {
 			goto error;
 		}
+		pd->latency = calloc(OSDP_CMD_LATENCY_SENTINEL,
+				     sizeof(struct osdp_latency_hist));
+		if (pd->latency == NULL) {
+			LOG_PRINT("Failed to allocate latency histograms");
+			goto error;
+		}
 		if (IS_ENABLED(OPT_OSDP_SKIP_MARK_BYTE)) {
 			SET_FLAG(pd, PD_FLAG_PKT_SKIP_MARK);
 		}
@@ -1554,24 +3140,73 @@ static int cp_add_pd(struct osdp *ctx, int num_pd, const osdp_pd_info_t *info_li
 		if (is_capture_enabled(pd)) {
 			osdp_packet_capture_init(pd);
 		}
+
+		if (cp_pd_attach_bus(pd, new_pd, i)) {
+			goto error;
+		}
+	}
+
+	for (i = 0; i < num_pd; i++) {
+		pd = new_pd[i];
+		ctx->pd[pd->idx] = pd;
+		if (pd->idx >= ctx->_num_pd) {
+			ctx->_num_pd = pd->idx + 1;
+		}
+		pd->sched_id = pd->chn_slot % ctx->num_sched;
+		pd->sched_deadline = 0;
+		cp_sched_push(pd);
+		osdp_cp_worker_wake(pd_to_sched(pd));
+	}
+
+	if (GET_CURRENT_PD(ctx) == NULL) {
+		ctx->_current_pd = new_pd[0];
+	}
+	free(new_pd);
+	return 0;
+
+error:
+	for (i = num_pd - 1; i >= 0; i--) {
+		if (new_pd[i] != NULL) {
+			cp_pd_detach_bus(new_pd[i], false);
+			cp_pd_free(new_pd[i]);
+		}
 	}
+	free(new_pd);
+	return -1;
+}
+
+/**
+ * Take a PD out of the PD table and its group. It is freed by the caller once
+ * app threads are done with it (see cp_pd_quiesce()).
+ */
+static int cp_remove_pd(struct osdp_pd *pd)
+{
+	struct osdp *ctx = pd_to_osdp(pd);
+	struct osdp_sched *s = pd_to_sched(pd);
 
-	if (cp_detect_connection_topology(ctx)) {
-		LOG_PRINT("Failed to detect connection topology");
-		goto error;
+	if (s->refreshing == pd) {
+		LOG_ERR("Cannot remove a PD while it is being refreshed");
+		return -1;
 	}
 
-	SET_CURRENT_PD(ctx, 0);
-	if (old_num_pd) {
-		free(old_pd_array);
+	/* not in the heap if it is due in a refresh that is in progress */
+	if (pd->sched_pos >= 0) {
+		cp_sched_remove(pd);
+	}
+	if (ISSET_FLAG(pd, PD_FLAG_CHN_WAIT)) {
+		s->num_chn_waiters--;
+	}
+	ctx->pd[pd->idx] = NULL;
+	cp_pd_mask_assign(ctx->online_mask, pd->idx, false);
+	cp_pd_mask_assign(ctx->sc_mask, pd->idx, false);
+	if (ISSET_FLAG(pd, PD_FLAG_CHN_SHARED) && pd->bus->owner == pd->idx) {
+		cp_channel_release(pd);
+		cp_channel_wake_waiters(pd, osdp_millis_now());
+	}
+	if (GET_CURRENT_PD(ctx) == pd) {
+		ctx->_current_pd = NULL;
 	}
 	return 0;
-
-error:
-	ctx->pd = old_pd_array;
-	ctx->_num_pd = old_num_pd;
-	free(new_pd_array);
-	return -1;
 }
 
 /* --- Exported Methods --- */
@@ -1587,6 +3222,21 @@ osdp_t *osdp_cp_setup(int num_pd, const osdp_pd_info_t *info)
 	}
 
 	input_check_init(ctx);
+	ctx->pd = calloc(OSDP_PD_MAX, sizeof(struct osdp_pd *));
+	if (ctx->pd == NULL) {
+		LOG_PRINT("Failed to allocate osdp_pd table");
+		goto error;
+	}
+	ctx->sched = calloc(OSDP_PD_MAX, sizeof(struct osdp_sched *));
+	if (ctx->sched == NULL) {
+		LOG_PRINT("Failed to allocate PD scheduler table");
+		goto error;
+	}
+	osdp_atomic_store(&ctx->cmd_pool.max, OSDP_CP_CMD_POOL_MAX);
+	if (osdp_cp_pool_lock_init(ctx)) {
+		LOG_PRINT("Failed to create command pool lock");
+		goto error;
+	}
 
 	if (num_pd && cp_add_pd(ctx, num_pd, info)) {
 		goto error;
@@ -1607,58 +3257,169 @@ int osdp_cp_add_pd(osdp_t *ctx, int num_pd, const osdp_pd_info_t *info)
 	assert(num_pd);
 	assert(info);
 
-	if(cp_add_pd(ctx, num_pd, info)) {
+	struct osdp *p = TO_OSDP(ctx);
+	int rc, num_sched = p->num_sched;
+
+	cp_lock_all(p, num_sched);
+	rc = cp_add_pd(p, num_pd, info);
+	cp_unlock_all(p, num_sched);
+
+	if (rc) {
 		LOG_PRINT("Failed to add PDs");
 		return -1;
 	}
 
-	LOG_PRINT("Added %d PDs; TotalPDs:%d Channels:%d",
-		  num_pd, ((struct osdp *)ctx)->_num_pd,
+	LOG_PRINT("Added %d PDs; Channels:%d", num_pd,
 		  ((struct osdp *)ctx)->num_channels);
 	return 0;
 }
 
+int osdp_cp_remove_pd(osdp_t *ctx, int pd_idx)
+{
+	input_check(ctx, pd_idx);
+	int rc = -1, num_sched;
+	struct osdp *p = TO_OSDP(ctx);
+	struct osdp_pd *pd;
+
+	/* the PD table and channel tables are shared by all groups */
+	num_sched = p->num_sched;
+	cp_lock_all(p, num_sched);
+	pd = osdp_to_pd(ctx, pd_idx);
+	if (pd != NULL) {
+		rc = cp_remove_pd(pd);
+	}
+	cp_unlock_all(p, num_sched);
+	if (rc != 0) {
+		return rc;
+	}
+
+	/* no new lookups can find it now; wait out the ones in flight */
+	//cp_pd_quiesce(p, pd);
+	cp_cmd_flush(pd);
+
+	cp_lock_all(p, num_sched);
+	cp_pd_detach_bus(pd, true);
+	cp_unlock_all(p, num_sched);
+
+	cp_pd_free(pd);
+	LOG_PRINT("Removed PD %d", pd_idx);
+	return 0;
+}
+
 void osdp_cp_teardown(osdp_t *ctx)
 {
 	input_check(ctx);
 	int i;
 	struct osdp_pd *pd;
 
+	osdp_cp_stop_workers(ctx);
+	osdp_capture_writer_stop(TO_OSDP(ctx));
+
 	for (i = 0; i < NUM_PD(ctx); i++) {
 		pd = osdp_to_pd(ctx, i);
-		if (is_capture_enabled(pd)) {
-			osdp_packet_capture_finish(pd);
-		}
-		safe_free(pd->file);
-		if (pd->channel.close) {
-			pd->channel.close(pd->channel.data);
+		if (pd == NULL) {
+			continue;
 		}
+		TO_OSDP(ctx)->pd[i] = NULL;
+		cp_pd_detach_bus(pd, true);
+		cp_pd_free(pd);
 	}
 
-	safe_free(osdp_to_pd(ctx, 0));
-	safe_free(TO_OSDP(ctx)->channel_lock);
+	safe_free(TO_OSDP(ctx)->pd);
+	cp_cmd_pool_destroy(&TO_OSDP(ctx)->cmd_pool);
+	osdp_cp_pool_lock_destroy(TO_OSDP(ctx));
+	safe_free(TO_OSDP(ctx)->event_ring);
+	safe_free(TO_OSDP(ctx)->recorder_buf);
+	for (i = 0; TO_OSDP(ctx)->sched && i < OSDP_PD_MAX; i++) {
+		if (TO_OSDP(ctx)->sched[i] != NULL) {
+			cp_sched_free(TO_OSDP(ctx)->sched[i]);
+		}
+	}
+	safe_free(TO_OSDP(ctx)->sched);
 	safe_free(ctx);
 }
 
 void osdp_cp_refresh(osdp_t *ctx)
 {
 	input_check(ctx);
-	int next_pd_idx, refresh_count = 0;
-	struct osdp_pd *pd;
+	int i;
+	struct osdp *p = TO_OSDP(ctx);
 
-	while(refresh_count < NUM_PD(ctx)) {
-		pd = GET_CURRENT_PD(ctx);
+	if (osdp_cp_workers_running(p)) {
+		return;
+	}
 
-		if (cp_refresh(pd) < 0)
-			break;
+	for (i = 0; i < p->num_sched; i++) {
+		osdp_cp_worker_lock(p->sched[i]);
+		osdp_cp_sched_refresh(p, p->sched[i]);
+		osdp_cp_worker_unlock(p->sched[i]);
+	}
+}
+
+int osdp_cp_next_deadline_ms(const osdp_t *ctx)
+{
+	input_check(ctx);
+	int i;
+	int64_t now, deadline, next = CP_SCHED_NEVER;
+	struct osdp *p = TO_OSDP(ctx);
 
-		next_pd_idx = pd->idx + 1;
-		if (next_pd_idx >= NUM_PD(ctx)) {
-			next_pd_idx = 0;
+	for (i = 0; i < p->num_sched; i++) {
+		osdp_cp_worker_lock(p->sched[i]);
+		deadline = cp_sched_next_deadline(p, p->sched[i]);
+		osdp_cp_worker_unlock(p->sched[i]);
+		if (deadline < next) {
+			next = deadline;
 		}
-		SET_CURRENT_PD(ctx, next_pd_idx);
-		refresh_count++;
 	}
+
+	if (next == CP_SCHED_NEVER) {
+		return -1;
+	}
+
+	now = osdp_millis_now();
+	return (next <= now) ? 0 : (int)(next - now);
+}
+
+int osdp_cp_start_workers(osdp_t *ctx, int num_workers)
+{
+	input_check(ctx);
+	struct osdp *p = TO_OSDP(ctx);
+
+	if (!IS_ENABLED(OPT_OSDP_CP_WORKERS)) {
+		LOG_PRINT("Worker threads need OPT_OSDP_CP_WORKERS");
+		return -1;
+	}
+
+	if (num_workers < 1 || NUM_PD(ctx) == 0 ||
+	    osdp_cp_workers_running(p)) {
+		return -1;
+	}
+
+	if (cp_sched_init(p, num_workers)) {
+		return -1;
+	}
+
+	if (osdp_cp_workers_start(p)) {
+		LOG_PRINT("Failed to start CP worker threads");
+		osdp_cp_workers_stop(p);
+		return -1;
+	}
+
+	LOG_PRINT("Started %d CP workers for %d channels",
+		  p->num_sched, p->num_channels);
+	return 0;
+}
+
+void osdp_cp_stop_workers(osdp_t *ctx)
+{
+	input_check(ctx);
+	struct osdp *p = TO_OSDP(ctx);
+
+	if (!osdp_cp_workers_running(p)) {
+		return;
+	}
+
+	osdp_cp_workers_stop(p);
 }
 
 void osdp_cp_set_event_callback(osdp_t *ctx, cp_event_callback_t cb, void *arg)
@@ -1669,42 +3430,216 @@ void osdp_cp_set_event_callback(osdp_t *ctx, cp_event_callback_t cb, void *arg)
 	TO_OSDP(ctx)->event_callback_arg = arg;
 }
 
+int osdp_cp_set_event_queue(osdp_t *ctx, int size,
+			    enum osdp_event_overflow_e policy)
+{
+	input_check(ctx);
+	struct osdp *p = TO_OSDP(ctx);
+	struct cp_event_ring *r = NULL;
+
+	if (size < 0 || (policy != OSDP_EVENT_OVERFLOW_DROP_NEWEST &&
+			 policy != OSDP_EVENT_OVERFLOW_DROP_OLDEST)) {
+		LOG_PRINT("Invalid event queue size/policy");
+		return -1;
+	}
+	if (osdp_cp_workers_running(p)) {
+		LOG_PRINT("Cannot change event queue while workers are running");
+		return -1;
+	}
+
+	if (size) {
+		r = cp_event_ring_alloc(size, policy);
+		if (r == NULL) {
+			LOG_PRINT("Failed to allocate event queue");
+			return -1;
+		}
+	}
+	safe_free(p->event_ring);
+	p->event_ring = r;
+	return 0;
+}
+
+int osdp_cp_get_events(osdp_t *ctx, struct osdp_cp_event *events, int max)
+{
+	input_check(ctx);
+	struct cp_event_ring *r = TO_OSDP(ctx)->event_ring;
+	int count = 0;
+
+	if (r == NULL) {
+		return -1;
+	}
+	while (count < max &&
+	       cp_event_ring_pop(r, &events[count].pd,
+				 &events[count].event) == 0) {
+		count++;
+	}
+	return count;
+}
+
+int osdp_cp_get_event_queue_status(const osdp_t *ctx, int *depth,
+				   uint32_t *dropped)
+{
+	input_check(ctx);
+	struct cp_event_ring *r = TO_OSDP(ctx)->event_ring;
+	unsigned int head, tail;
+
+	if (r == NULL) {
+		return -1;
+	}
+	if (depth) {
+		tail = osdp_atomic_load(&r->tail);
+		head = osdp_atomic_load(&r->head);
+		*depth = (int)(head - tail);
+	}
+	if (dropped) {
+		*dropped = osdp_atomic_load(&r->dropped);
+	}
+	return 0;
+}
+
 int osdp_cp_send_command(osdp_t *ctx, int pd_idx, const struct osdp_cmd *cmd)
+{
+	return osdp_cp_submit_command(ctx, pd_idx, cmd);
+}
+
+int osdp_cp_submit_command(osdp_t *ctx, int pd_idx, const struct osdp_cmd *cmd)
 {
 	input_check(ctx, pd_idx);
-	struct osdp_pd *pd = osdp_to_pd(ctx, pd_idx);
+	int rc;
+	struct osdp_pd *pd = osdp_pd_get(ctx, pd_idx);
 
-	return cp_submit_command(pd, cmd);
+	if (pd == NULL) {
+		return -1;
+	}
+	rc = cp_submit_command(pd, cmd);
+	osdp_pd_put(pd);
+	return rc;
 }
 
-int osdp_cp_submit_command(osdp_t *ctx, int pd_idx, const struct osdp_cmd *cmd)
+int osdp_cp_submit_command_batch(osdp_t *ctx, const uint8_t *pd_mask,
+				 const struct osdp_cmd *cmd)
+{
+	input_check(ctx);
+	int i, count = 0;
+	struct osdp_pd *pd;
+
+	if (cmd->flags & OSDP_CMD_FLAG_BROADCAST) {
+		LOG_PRINT("Broadcast is not allowed in batch submission");
+		return -1;
+	}
+	if (cmd->flags & ~(OSDP_CMD_FLAG_PRIO_URGENT |
+			   OSDP_CMD_FLAG_PRIO_BACKGROUND |
+			   OSDP_CMD_FLAG_COALESCE) ||
+	    cp_cmd_prio_conflict(cmd)) {
+		LOG_PRINT("Invalid command flags");
+		return -1;
+	}
+	if (cmd->id == OSDP_CMD_FILE_TX) {
+		LOG_PRINT("File transfer cannot be submitted in batch");
+		return -1;
+	}
+
+	for (i = 0; i < NUM_PD(ctx); i++) {
+		if (!(pd_mask[i / 8] & (1 << (i % 8)))) {
+			continue;
+		}
+		pd = osdp_pd_get(ctx, i);
+		if (pd == NULL) {
+			continue;
+		}
+		if (cp_check_command_target(pd, cmd) == 0 &&
+		    cp_post_command(pd, cmd) == 0) {
+			count++;
+		}
+		osdp_pd_put(pd);
+	}
+	return count;
+}
+
+int osdp_cp_set_command_pool_size(osdp_t *ctx, int max_cmds)
+{
+	input_check(ctx);
+	struct osdp *p = TO_OSDP(ctx);
+
+	if (max_cmds < OSDP_CP_CMD_POOL_SIZE) {
+		LOG_PRINT("Command pool must hold at least %d commands",
+			  OSDP_CP_CMD_POOL_SIZE);
+		return -1;
+	}
+
+	osdp_atomic_store(&p->cmd_pool.max, max_cmds);
+	return 0;
+}
+
+int osdp_cp_set_command_quota(osdp_t *ctx, int pd_idx, int quota)
+{
+	input_check(ctx, pd_idx);
+	struct osdp_pd *pd;
+
+	if (quota <= 0) {
+		LOG_PRINT("Invalid command quota %d", quota);
+		return -1;
+	}
+
+	pd = osdp_pd_get(ctx, pd_idx);
+	if (pd == NULL) {
+		return -1;
+	}
+	osdp_atomic_store(&pd->cmd_quota, quota);
+	osdp_pd_put(pd);
+	return 0;
+}
+
+int osdp_cp_get_command_queue_status(const osdp_t *ctx, int pd_idx,
+				     int *depth, int *headroom)
 {
 	input_check(ctx, pd_idx);
-	struct osdp_pd *pd = osdp_to_pd(ctx, pd_idx);
+	struct osdp_pd *pd = osdp_pd_get(ctx, pd_idx);
+	int room;
 
-	return cp_submit_command(pd, cmd);
+	if (pd == NULL) {
+		return -1;
+	}
+	room = cp_cmd_headroom(pd);
+	if (depth) {
+		*depth = (int)osdp_atomic_load(&pd->cmd_pending);
+	}
+	if (headroom) {
+		*headroom = (room > 0) ? room : 0;
+	}
+	osdp_pd_put(pd);
+	return 0;
 }
 
 int osdp_cp_flush_commands(osdp_t *ctx, int pd_idx)
 {
 	input_check(ctx, pd_idx);
-	struct osdp_pd *pd = osdp_to_pd(ctx, pd_idx);
-	struct osdp_cmd *cmd;
-	int count = 0;
+	struct osdp_pd *pd = osdp_pd_get(ctx, pd_idx);
+	struct osdp_sched *s;
+	int count;
 
-	while (cp_cmd_dequeue(pd, &cmd) == 0) {
-		cp_cmd_free(pd, cmd);
-		count++;
+	if (pd == NULL) {
+		return -1;
 	}
+	s = cp_pd_lock(pd);
+	count = cp_cmd_flush(pd);
+	osdp_cp_worker_unlock(s);
+	osdp_pd_put(pd);
 	return count;
 }
 
 int osdp_cp_get_pd_id(const osdp_t *ctx, int pd_idx, struct osdp_pd_id *id)
 {
 	input_check(ctx, pd_idx);
-	struct osdp_pd *pd = osdp_to_pd(ctx, pd_idx);
+	struct osdp_pd *pd = osdp_pd_get(ctx, pd_idx);
+	struct osdp_pd_snapshot view;
 
-	memcpy(id, &pd->id, sizeof(struct osdp_pd_id));
+	if (pd == NULL) {
+		return -1;
+	}
+	cp_snapshot_read(pd, &view);
+	osdp_pd_put(pd);
+	memcpy(id, &view.id, sizeof(struct osdp_pd_id));
 	return 0;
 }
 
@@ -1712,15 +3647,137 @@ int osdp_cp_get_capability(const osdp_t *ctx, int pd_idx, struct osdp_pd_cap *ca
 {
 	input_check(ctx, pd_idx);
 	int fc;
-	struct osdp_pd *pd = osdp_to_pd(ctx, pd_idx);
+	struct osdp_pd *pd;
+	struct osdp_pd_snapshot view;
 
 	fc = cap->function_code;
 	if (fc <= OSDP_PD_CAP_UNUSED || fc >= OSDP_PD_CAP_SENTINEL) {
 		return -1;
 	}
 
-	cap->compliance_level = pd->cap[fc].compliance_level;
-	cap->num_items = pd->cap[fc].num_items;
+	pd = osdp_pd_get(ctx, pd_idx);
+	if (pd == NULL) {
+		return -1;
+	}
+	cp_snapshot_read(pd, &view);
+	osdp_pd_put(pd);
+	cap->compliance_level = view.cap[fc].compliance_level;
+	cap->num_items = view.cap[fc].num_items;
+	return 0;
+}
+
+int osdp_cp_get_pd_snapshot(const osdp_t *ctx, int pd_idx,
+			    struct osdp_pd_snapshot *snapshot)
+{
+	input_check(ctx, pd_idx);
+	int64_t last_seen;
+	struct osdp_pd *pd = osdp_pd_get(ctx, pd_idx);
+
+	if (pd == NULL) {
+		return -1;
+	}
+	last_seen = cp_snapshot_read(pd, snapshot);
+	osdp_pd_put(pd);
+	snapshot->last_seen_ms = -1;
+	if (last_seen) {
+		snapshot->last_seen_ms = (int)osdp_millis_since(last_seen);
+	}
+	return 0;
+}
+
+int osdp_cp_get_channel_owner(const osdp_t *ctx, int pd_idx, int *owner)
+{
+	input_check(ctx, pd_idx);
+	struct osdp_pd *pd = osdp_pd_get(ctx, pd_idx);
+	struct osdp_sched *s;
+
+	if (pd == NULL) {
+		return -1;
+	}
+	s = cp_pd_lock(pd);
+	if (ISSET_FLAG(pd, PD_FLAG_CHN_SHARED)) {
+		*owner = pd->bus->owner;
+	} else {
+		*owner = pd_idx; /* dedicated channel */
+	}
+	osdp_cp_worker_unlock(s);
+	osdp_pd_put(pd);
+	return 0;
+}
+
+int osdp_cp_set_poll_interval(osdp_t *ctx, int pd_idx, int min_ms, int max_ms)
+{
+	input_check(ctx, pd_idx);
+	struct osdp_pd *pd;
+	struct osdp_sched *s;
+
+	if (min_ms <= 0 || min_ms > max_ms || max_ms >= OSDP_PD_ONLINE_TOUT_MS) {
+		LOG_PRINT("Invalid poll interval %d-%d ms", min_ms, max_ms);
+		return -1;
+	}
+
+	pd = osdp_pd_get(ctx, pd_idx);
+	if (pd == NULL) {
+		return -1;
+	}
+	s = cp_pd_lock(pd);
+	pd->poll_min_ms = min_ms;
+	pd->poll_max_ms = max_ms;
+	pd->poll_ms = min_ms;
+	cp_sched_kick(pd);
+	osdp_cp_worker_unlock(s);
+	osdp_pd_put(pd);
+	return 0;
+}
+
+int osdp_cp_get_cmd_latency(const osdp_t *ctx, int pd_idx, int type,
+			    struct osdp_cmd_latency *latency)
+{
+	input_check(ctx, pd_idx);
+	struct osdp_pd *pd;
+	struct osdp_sched *s;
+	struct osdp_latency_hist h;
+
+	if (type < 0 || type >= OSDP_CMD_LATENCY_SENTINEL || !latency) {
+		LOG_PRINT("Invalid latency query");
+		return -1;
+	}
+
+	pd = osdp_pd_get(ctx, pd_idx);
+	if (pd == NULL) {
+		return -1;
+	}
+	s = cp_pd_lock(pd);
+	memcpy(&h, &pd->latency[type], sizeof(h));
+	osdp_cp_worker_unlock(s);
+	osdp_pd_put(pd);
+
+	latency->count = h.count;
+	latency->max_ms = h.max_ms;
+	latency->p50_ms = h.count ? latency_percentile(&h, 50) : 0;
+	latency->p99_ms = h.count ? latency_percentile(&h, 99) : 0;
+	return 0;
+}
+
+int osdp_cp_set_slow_cmd_threshold(osdp_t *ctx, int pd_idx, int threshold_ms)
+{
+	input_check(ctx, pd_idx);
+	struct osdp_pd *pd;
+	struct osdp_sched *s;
+
+	if (threshold_ms < 0) {
+		LOG_PRINT("Invalid slow command threshold %d ms", threshold_ms);
+		return -1;
+	}
+
+	pd = osdp_pd_get(ctx, pd_idx);
+	if (pd == NULL) {
+		return -1;
+	}
+	s = cp_pd_lock(pd);
+	pd->slow_cmd_ms = (uint32_t)threshold_ms;
+	osdp_cp_worker_unlock(s);
+	osdp_pd_put(pd);
 	return 0;
 }
 
@@ -1732,60 +3789,86 @@ int osdp_cp_modify_flag(osdp_t *ctx, int pd_idx, uint32_t flags, bool do_set)
 		OSDP_FLAG_INSTALL_MODE |
 		OSDP_FLAG_IGN_UNSOLICITED
 	);
-	struct osdp_pd *pd = osdp_to_pd(ctx, pd_idx);
+	struct osdp_pd *pd;
+	struct osdp_sched *s;
 
 	if (flags & ~all_flags) {
 		return -1;
 	}
 
+	pd = osdp_pd_get(ctx, pd_idx);
+	if (pd == NULL) {
+		return -1;
+	}
+	s = cp_pd_lock(pd);
 	do_set ? SET_FLAG(pd, flags) : CLEAR_FLAG(pd, flags);
+	osdp_cp_worker_unlock(s);
+	osdp_pd_put(pd);
 	return 0;
 }
 
 int osdp_cp_disable_pd(osdp_t *ctx, int pd_idx)
 {
 	input_check(ctx, pd_idx);
-	struct osdp_pd *pd = osdp_to_pd(ctx, pd_idx);
+	int rc = -1;
+	struct osdp_pd *pd = osdp_pd_get(ctx, pd_idx);
+	struct osdp_sched *s;
 
-	if (pd->state == OSDP_CP_STATE_DISABLED) {
-		LOG_DBG("PD is already disabled");
+	if (pd == NULL) {
 		return -1;
 	}
-
-	if (test_request(pd, CP_REQ_DISABLE)) {
+	s = cp_pd_lock(pd);
+	if (pd->state == OSDP_CP_STATE_DISABLED) {
+		LOG_DBG("PD is already disabled");
+	} else if (test_request(pd, CP_REQ_DISABLE)) {
 		LOG_DBG("PD disable request already pending");
-		return -1;
+	} else {
+		make_request(pd, CP_REQ_DISABLE);
+		cp_sched_kick(pd);
+		rc = 0;
 	}
-
-	make_request(pd, CP_REQ_DISABLE);
-	return 0;
+	osdp_cp_worker_unlock(s);
+	osdp_pd_put(pd);
+	return rc;
 }
 
 int osdp_cp_enable_pd(osdp_t *ctx, int pd_idx)
 {
 	input_check(ctx, pd_idx);
-	struct osdp_pd *pd = osdp_to_pd(ctx, pd_idx);
+	int rc = -1;
+	struct osdp_pd *pd = osdp_pd_get(ctx, pd_idx);
+	struct osdp_sched *s;
 
-	if (pd->state != OSDP_CP_STATE_DISABLED) {
-		LOG_DBG("PD is already enabled");
+	if (pd == NULL) {
 		return -1;
 	}
-
-	if (test_request(pd, CP_REQ_ENABLE)) {
+	s = cp_pd_lock(pd);
+	if (pd->state != OSDP_CP_STATE_DISABLED) {
+		LOG_DBG("PD is already enabled");
+	} else if (test_request(pd, CP_REQ_ENABLE)) {
 		LOG_DBG("PD enable request already pending");
-		return -1;
+	} else {
+		make_request(pd, CP_REQ_ENABLE);
+		cp_sched_kick(pd);
+		rc = 0;
 	}
-
-	make_request(pd, CP_REQ_ENABLE);
-	return 0;
+	osdp_cp_worker_unlock(s);
+	osdp_pd_put(pd);
+	return rc;
 }
 
 bool osdp_cp_is_pd_enabled(const osdp_t *ctx, int pd_idx)
 {
 	input_check(ctx, pd_idx);
-	struct osdp_pd *pd = osdp_to_pd(ctx, pd_idx);
+	struct osdp_pd *pd = osdp_pd_get(ctx, pd_idx);
+	struct osdp_pd_snapshot view;
 
-	return pd->state != OSDP_CP_STATE_DISABLED;
+	if (pd == NULL) {
+		return false;
+	}
+	cp_snapshot_read(pd, &view);
+	osdp_pd_put(pd);
+	return view.enabled;
 }
 
 #ifdef UNIT_TESTING
@@ -1793,8 +3876,8 @@ bool osdp_cp_is_pd_enabled(const osdp_t *ctx, int pd_idx)
 /**
  * Force export some private methods for testing.
  */
-void (*test_cp_cmd_enqueue)(struct osdp_pd *,
-                            struct osdp_cmd *) = cp_cmd_enqueue;
+void (*test_cp_cmd_enqueue)(struct osdp_pd *, struct osdp_cmd *,
+                            int64_t) = cp_cmd_enqueue;
 struct osdp_cmd *(*test_cp_cmd_alloc)(struct osdp_pd *) = cp_cmd_alloc;
 int (*test_cp_phy_state_update)(struct osdp_pd *) = cp_phy_state_update;
 int (*test_state_update)(struct osdp_pd *) = state_update;
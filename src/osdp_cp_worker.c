@@ -0,0 +1,304 @@
+/*
+ * Copyright (c) 2025 Siddharth Chandrasekaran <sidcha.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "osdp_cp_worker.h"
+
+/**
+ * Each osdp_sched (group of PDs that share no channel with other groups) is
+ * serviced by a dedicated thread. The group lock is held by the worker while
+ * it refreshes the group and by the exported CP methods while they touch a PD
+ * in this group. It is recursive since the app can call back into LibOSDP
+ * from callbacks that are made with the lock held (flight recorder).
+ *
+ * The worker sleeps on cond with wait_lock (not the group lock) held, so that
+ * app threads can wake it up without waiting for a refresh to finish. wake is
+ * set by them so that a wake up that comes in before the worker goes to sleep
+ * is not lost.
+ *
+ * App threads can be holding (or waiting for) the group lock at any time, so
+ * once created, a worker (and its lock) lives as long as its group; stopping
+ * the workers only ends their threads.
+ */
+struct osdp_cp_worker {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_mutex_t wait_lock;
+	pthread_cond_t cond;
+	bool wake;
+	bool stop;
+	bool running;
+	struct osdp *ctx;
+	struct osdp_sched *sched;
+};
+
+/**
+ * Deadlines come from osdp_millis_now() so the wait must not be affected by
+ * changes to the wall clock. macOS has no pthread_condattr_setclock(); use a
+ * relative wait there instead.
+ */
+static void worker_timed_wait(struct osdp_cp_worker *w, int64_t wait_ms)
+{
+	struct timespec ts;
+
+#ifdef __APPLE__
+	ts.tv_sec = wait_ms / 1000;
+	ts.tv_nsec = (wait_ms % 1000) * 1000000;
+	pthread_cond_timedwait_relative_np(&w->cond, &w->wait_lock, &ts);
+#else
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ts.tv_sec += wait_ms / 1000;
+	ts.tv_nsec += (wait_ms % 1000) * 1000000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec += 1;
+		ts.tv_nsec -= 1000000000;
+	}
+	pthread_cond_timedwait(&w->cond, &w->wait_lock, &ts);
+#endif
+}
+
+static int worker_cond_init(pthread_cond_t *cond)
+{
+#ifdef __APPLE__
+	return pthread_cond_init(cond, NULL);
+#else
+	int rc;
+	pthread_condattr_t attr;
+
+	if (pthread_condattr_init(&attr)) {
+		return -1;
+	}
+	rc = pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	if (rc == 0) {
+		rc = pthread_cond_init(cond, &attr);
+	}
+	pthread_condattr_destroy(&attr);
+	return rc;
+#endif
+}
+
+static void *worker_thread(void *arg)
+{
+	struct osdp_cp_worker *w = arg;
+	int64_t next, wait_ms;
+	bool stop, slept;
+
+	do {
+		pthread_mutex_lock(&w->lock);
+		next = osdp_cp_sched_refresh(w->ctx, w->sched);
+		pthread_mutex_unlock(&w->lock);
+
+		slept = false;
+		pthread_mutex_lock(&w->wait_lock);
+		if (!w->wake && !w->stop) {
+			wait_ms = next - osdp_millis_now();
+			if (next == CP_SCHED_NEVER) {
+				pthread_cond_wait(&w->cond, &w->wait_lock);
+				slept = true;
+			} else if (wait_ms > 0) {
+				worker_timed_wait(w, wait_ms);
+				slept = true;
+			}
+		}
+		w->wake = false;
+		stop = w->stop;
+		pthread_mutex_unlock(&w->wait_lock);
+
+		if (!slept) {
+			/* let app threads waiting on the group lock run */
+			sched_yield();
+		}
+	} while (!stop);
+	return NULL;
+}
+
+static void worker_destroy(struct osdp_cp_worker *w)
+{
+	pthread_cond_destroy(&w->cond);
+	pthread_mutex_destroy(&w->wait_lock);
+	pthread_mutex_destroy(&w->lock);
+	free(w);
+}
+
+static struct osdp_cp_worker *worker_create(struct osdp *ctx,
+					    struct osdp_sched *s)
+{
+	struct osdp_cp_worker *w;
+	pthread_mutexattr_t attr;
+
+	w = calloc(1, sizeof(struct osdp_cp_worker));
+	if (w == NULL) {
+		return NULL;
+	}
+	w->ctx = ctx;
+	w->sched = s;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	if (pthread_mutex_init(&w->lock, &attr)) {
+		pthread_mutexattr_destroy(&attr);
+		free(w);
+		return NULL;
+	}
+	pthread_mutexattr_destroy(&attr);
+
+	if (pthread_mutex_init(&w->wait_lock, NULL)) {
+		pthread_mutex_destroy(&w->lock);
+		free(w);
+		return NULL;
+	}
+
+	if (worker_cond_init(&w->cond)) {
+		pthread_mutex_destroy(&w->wait_lock);
+		pthread_mutex_destroy(&w->lock);
+		free(w);
+		return NULL;
+	}
+	return w;
+}
+
+static void worker_join(struct osdp_cp_worker *w)
+{
+	pthread_mutex_lock(&w->wait_lock);
+	w->stop = true;
+	pthread_cond_signal(&w->cond);
+	pthread_mutex_unlock(&w->wait_lock);
+	pthread_join(w->thread, NULL);
+	w->running = false;
+}
+
+int osdp_cp_workers_start(struct osdp *ctx)
+{
+	int i;
+	struct osdp_cp_worker *w;
+	struct osdp_sched *s;
+
+	for (i = 0; i < ctx->num_sched; i++) {
+		s = ctx->sched[i];
+		if (s->worker == NULL) {
+			s->worker = worker_create(ctx, s);
+			if (s->worker == NULL) {
+				goto error;
+			}
+		}
+		w = s->worker;
+		w->stop = false;
+		if (pthread_create(&w->thread, NULL, worker_thread, w)) {
+			goto error;
+		}
+		w->running = true;
+	}
+	ctx->num_workers = ctx->num_sched;
+	return 0;
+error:
+	osdp_cp_workers_stop(ctx);
+	return -1;
+}
+
+void osdp_cp_workers_stop(struct osdp *ctx)
+{
+	int i;
+	struct osdp_cp_worker *w;
+
+	/* groups past num_sched can still have a worker from an earlier start */
+	for (i = 0; i < OSDP_PD_MAX && ctx->sched[i] != NULL; i++) {
+		w = ctx->sched[i]->worker;
+		if (w != NULL && w->running) {
+			worker_join(w);
+		}
+	}
+	ctx->num_workers = 0;
+}
+
+void osdp_cp_worker_free(struct osdp_sched *s)
+{
+	if (s->worker != NULL) {
+		worker_destroy(s->worker);
+		s->worker = NULL;
+	}
+}
+
+void osdp_cp_worker_lock(struct osdp_sched *s)
+{
+	struct osdp_cp_worker *w = s->worker;
+
+	if (w != NULL) {
+		pthread_mutex_lock(&w->lock);
+	}
+}
+
+void osdp_cp_worker_unlock(struct osdp_sched *s)
+{
+	struct osdp_cp_worker *w = s->worker;
+
+	if (w != NULL) {
+		pthread_mutex_unlock(&w->lock);
+	}
+}
+
+void osdp_cp_worker_wake(struct osdp_sched *s)
+{
+	struct osdp_cp_worker *w = s->worker;
+
+	if (w != NULL) {
+		pthread_mutex_lock(&w->wait_lock);
+		w->wake = true;
+		pthread_cond_signal(&w->cond);
+		pthread_mutex_unlock(&w->wait_lock);
+	}
+}
+
+/**
+ * The command pool is shared by all groups. Its lock is set up along with the
+ * context (rather than with the workers) so that it is there for as long as
+ * any thread can get to the pool.
+ */
+int osdp_cp_pool_lock_init(struct osdp *ctx)
+{
+	pthread_mutex_t *lock;
+
+	lock = calloc(1, sizeof(pthread_mutex_t));
+	if (lock == NULL) {
+		return -1;
+	}
+	if (pthread_mutex_init(lock, NULL)) {
+		free(lock);
+		return -1;
+	}
+	ctx->cmd_pool.lock = lock;
+	return 0;
+}
+
+void osdp_cp_pool_lock_destroy(struct osdp *ctx)
+{
+	if (ctx->cmd_pool.lock != NULL) {
+		pthread_mutex_destroy(ctx->cmd_pool.lock);
+		free(ctx->cmd_pool.lock);
+		ctx->cmd_pool.lock = NULL;
+	}
+}
+
+void osdp_cp_pool_lock(struct osdp *ctx)
+{
+	if (ctx->cmd_pool.lock != NULL) {
+		pthread_mutex_lock(ctx->cmd_pool.lock);
+	}
+}
+
+void osdp_cp_pool_unlock(struct osdp *ctx)
+{
+	if (ctx->cmd_pool.lock != NULL) {
+		pthread_mutex_unlock(ctx->cmd_pool.lock);
+	}
+}
+
+void osdp_cp_yield(void)
+{
+	sched_yield();
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2025 Siddharth Chandrasekaran <sidcha.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _OSDP_CP_WORKER_H_
+#define _OSDP_CP_WORKER_H_
+
+#include "osdp_common.h"
+
+/* from osdp_cp.c */
+int64_t osdp_cp_sched_refresh(struct osdp *ctx, struct osdp_sched *s);
+
+#if defined(OPT_OSDP_CP_WORKERS)
+
+int osdp_cp_workers_start(struct osdp *ctx);
+void osdp_cp_workers_stop(struct osdp *ctx);
+void osdp_cp_worker_free(struct osdp_sched *s);
+void osdp_cp_worker_lock(struct osdp_sched *s);
+void osdp_cp_worker_unlock(struct osdp_sched *s);
+void osdp_cp_worker_wake(struct osdp_sched *s);
+int osdp_cp_pool_lock_init(struct osdp *ctx);
+void osdp_cp_pool_lock_destroy(struct osdp *ctx);
+void osdp_cp_pool_lock(struct osdp *ctx);
+void osdp_cp_pool_unlock(struct osdp *ctx);
+void osdp_cp_yield(void);
+
+static inline bool osdp_cp_workers_running(struct osdp *ctx)
+{
+	return ctx->num_workers != 0;
+}
+
+#else
+
+static inline int osdp_cp_workers_start(struct osdp *ctx)
+{
+	ARG_UNUSED(ctx);
+	return -1;
+}
+
+static inline void osdp_cp_workers_stop(struct osdp *ctx)
+{
+	ARG_UNUSED(ctx);
+}
+
+static inline void osdp_cp_worker_free(struct osdp_sched *s)
+{
+	ARG_UNUSED(s);
+}
+
+static inline void osdp_cp_worker_lock(struct osdp_sched *s)
+{
+	ARG_UNUSED(s);
+}
+
+static inline void osdp_cp_worker_unlock(struct osdp_sched *s)
+{
+	ARG_UNUSED(s);
+}
+
+static inline void osdp_cp_worker_wake(struct osdp_sched *s)
+{
+	ARG_UNUSED(s);
+}
+
+static inline int osdp_cp_pool_lock_init(struct osdp *ctx)
+{
+	ARG_UNUSED(ctx);
+	return 0;
+}
+
+static inline void osdp_cp_pool_lock_destroy(struct osdp *ctx)
+{
+	ARG_UNUSED(ctx);
+}
+
+static inline void osdp_cp_pool_lock(struct osdp *ctx)
+{
+	ARG_UNUSED(ctx);
+}
+
+static inline void osdp_cp_pool_unlock(struct osdp *ctx)
+{
+	ARG_UNUSED(ctx);
+}
+
+static inline void osdp_cp_yield(void)
+{
+}
+
+static inline bool osdp_cp_workers_running(struct osdp *ctx)
+{
+	ARG_UNUSED(ctx);
+	return false;
+}
+
+#endif
+
+#endif /* _OSDP_CP_WORKER_H_ */
@@ -57,7 +57,8 @@ static void write_file_tx_header(struct osdp_file *f, uint8_t *buf)
 
 int osdp_file_cmd_tx_build(struct osdp_pd *pd, uint8_t *buf, int max_len)
 {
-	int buf_available;
+	int buf_available, data_len;
+	const void *chunk;
 	struct osdp_file *f = TO_FILE(pd);
 	uint8_t *data = buf + FILE_TRANSFER_HEADER_SIZE;
 
@@ -95,7 +96,19 @@ int osdp_file_cmd_tx_build(struct osdp_pd *pd, uint8_t *buf, int max_len)
 	 */
 	buf_available = max_len - FILE_TRANSFER_HEADER_SIZE - 16;
 
-	f->length = f->ops.read(f->ops.arg, data, buf_available, f->offset);
+	if (f->ops.map && osdp_phy_can_gather(pd)) {
+		/* zero-copy: phy sends the chunk straight from app memory */
+		f->length = f->ops.map(f->ops.arg, &chunk, buf_available,
+				       f->offset);
+		if (f->length > 0) {
+			osdp_phy_packet_set_payload(pd, chunk, f->length);
+		}
+		data_len = 0;
+	} else {
+		f->length = f->ops.read(f->ops.arg, data, buf_available,
+					f->offset);
+		data_len = f->length;
+	}
 	if (f->length < 0) {
 		LOG_ERR("TX_Build: user read failed! rc:%d len:%d off:%d",
 			f->length, buf_available, f->offset);
@@ -109,7 +122,7 @@ int osdp_file_cmd_tx_build(struct osdp_pd *pd, uint8_t *buf, int max_len)
 	/* fill the packet buffer (layout: struct osdp_cmd_file_xfer) */
 	write_file_tx_header(f, buf);
 
-	return FILE_TRANSFER_HEADER_SIZE + f->length;
+	return FILE_TRANSFER_HEADER_SIZE + data_len;
 
 reply_abort:
 	LOG_ERR("TX_Build: Aborting file transfer due to unrecoverable error!");
@@ -364,6 +377,30 @@ int osdp_file_tx_get_command(struct osdp_pd *pd)
 	return CMD_FILETRANSFER;
 }
 
+/**
+ * Returns the number of milliseconds until osdp_file_tx_get_command() can
+ * produce the next command or -1 if no transfer is in progress.
+ */
+int osdp_file_tx_wait_ms(struct osdp_pd *pd, int64_t now)
+{
+	int64_t elapsed;
+	struct osdp_file *f = TO_FILE(pd);
+
+	if (!f || f->state == OSDP_FILE_IDLE || f->state == OSDP_FILE_DONE) {
+		return -1;
+	}
+
+	if (f->errors > OSDP_FILE_ERROR_RETRY_MAX || f->cancel_req) {
+		return 0;
+	}
+
+	elapsed = now - f->tstamp;
+	if (f->wait_time_ms && elapsed < f->wait_time_ms) {
+		return (int)(f->wait_time_ms - elapsed);
+	}
+	return 0;
+}
+
 /**
  * Entry point based on command OSDP_CMD_FILE to kick off a new file transfer.
  */
@@ -421,18 +458,23 @@ int osdp_file_register_ops(osdp_t *ctx, int pd_idx,
 			   const struct osdp_file_ops *ops)
 {
 	input_check(ctx, pd_idx);
-	struct osdp_pd *pd = osdp_to_pd(ctx, pd_idx);
+	struct osdp_pd *pd = osdp_pd_get(ctx, pd_idx);
 
+	if (pd == NULL) {
+		return -1;
+	}
 	if (!pd->file) {
 		pd->file = calloc(1, sizeof(struct osdp_file));
 		if (pd->file == NULL) {
 			LOG_PRINT("Failed to alloc struct osdp_file");
+			osdp_pd_put(pd);
 			return -1;
 		}
 	}
 
 	memcpy(&pd->file->ops, ops, sizeof(struct osdp_file_ops));
 	file_state_reset(pd->file);
+	osdp_pd_put(pd);
 	return 0;
 }
 
@@ -440,14 +482,21 @@ int osdp_get_file_tx_status(const osdp_t *ctx, int pd_idx,
 			    int *size, int *offset)
 {
 	input_check(ctx, pd_idx);
-	struct osdp_file *f = TO_FILE(osdp_to_pd(ctx, pd_idx));
+	int rc = -1;
+	struct osdp_file *f;
+	struct osdp_pd *pd = osdp_pd_get(ctx, pd_idx);
 
+	if (pd == NULL) {
+		return -1;
+	}
+	f = TO_FILE(pd);
 	if (f->state != OSDP_FILE_INPROG && f->state != OSDP_FILE_DONE) {
 		LOG_PRINT("File TX not in progress");
-		return -1;
+	} else {
+		*size = f->size;
+		*offset = f->offset;
+		rc = 0;
 	}
-
-	*size = f->size;
-	*offset = f->offset;
-	return 0;
+	osdp_pd_put(pd);
+	return rc;
 }
\ No newline at end of file
@@ -92,6 +92,7 @@ int osdp_file_cmd_stat_decode(struct osdp_pd *pd, uint8_t *buf, int len);
 int osdp_file_cmd_stat_build(struct osdp_pd *pd, uint8_t *buf, int max_len);
 int osdp_file_tx_command(struct osdp_pd *pd, int file_id, uint32_t flags);
 int osdp_file_tx_get_command(struct osdp_pd *pd);
+int osdp_file_tx_wait_ms(struct osdp_pd *pd, int64_t now);
 void osdp_file_tx_abort(struct osdp_pd *pd);
 
 #endif /* _OSDP_FILE_H_ */
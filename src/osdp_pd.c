@@ -7,6 +7,7 @@
 #include "osdp_common.h"
 #include "osdp_file.h"
 #include "osdp_diag.h"
+#include "osdp_capture.h"
 
 #ifndef OPT_OSDP_STATIC_PD
 #include <stdlib.h>
@@ -87,9 +88,10 @@ struct pd_event_node {
 
 static int pd_event_queue_init(struct osdp_pd *pd)
 {
-	if (slab_init(&pd->app_data.slab, sizeof(struct pd_event_node),
-		      pd->app_data.slab_blob,
-		      sizeof(pd->app_data.slab_blob)) < 0) {
+	struct osdp_app_data_pool *app_data = &pd_to_osdp(pd)->app_data;
+
+	if (slab_init(&app_data->slab, sizeof(struct pd_event_node),
+		      app_data->slab_blob, sizeof(app_data->slab_blob)) < 0) {
 		LOG_ERR("Failed to initialize command slab");
 		return -1;
 	}
@@ -101,7 +103,7 @@ static struct osdp_event *pd_event_alloc(struct osdp_pd *pd)
 {
 	struct pd_event_node *event = NULL;
 
-	if (slab_alloc(&pd->app_data.slab, (void **)&event)) {
+	if (slab_alloc(&pd_to_osdp(pd)->app_data.slab, (void **)&event)) {
 		LOG_ERR("Event slab allocation failed");
 		return NULL;
 	}
@@ -114,7 +116,7 @@ static void pd_event_free(struct osdp_pd *pd, struct osdp_event *event)
 	struct pd_event_node *n;
 
 	n = CONTAINER_OF(event, struct pd_event_node, object);
-	slab_free(&pd->app_data.slab, n);
+	slab_free(&pd_to_osdp(pd)->app_data.slab, n);
 }
 
 static void pd_event_enqueue(struct osdp_pd *pd, struct osdp_event *event)
@@ -528,7 +530,7 @@ static int pd_decode_command(struct osdp_pd *pd, uint8_t *buf, int len)
 		cmd.comset.baud_rate = buf[pos++];
 		cmd.comset.baud_rate |= buf[pos++] << 8;
 		cmd.comset.baud_rate |= buf[pos++] << 16;
-		cmd.comset.baud_rate |= buf[pos++] << 24;
+		cmd.comset.baud_rate |= (uint32_t)buf[pos++] << 24;
 		if (cmd.comset.address >= 0x7F) {
 			LOG_ERR("COMSET Failed! command discarded");
 			cmd.comset.address = pd->address;
@@ -658,6 +660,7 @@ static int pd_decode_command(struct osdp_pd *pd, uint8_t *buf, int len)
 		}
 		sc_deactivate(pd);
 		osdp_sc_setup(pd);
+		pd->stats.sc_handshakes++;
 		memcpy(pd->sc.cp_random, buf + pos, 8);
 		pd->reply_id = REPLY_CCRYPT;
 		ret = OSDP_PD_ERR_NONE;
@@ -863,6 +866,9 @@ static int pd_build_reply(struct osdp_pd *pd, uint8_t *buf, int max_len)
 		assert_buf_len(REPLY_NAK_LEN, max_len);
 		buf[len++] = pd->reply_id;
 		buf[len++] = pd->ephemeral_data[0];
+		if (pd->ephemeral_data[0] < OSDP_PD_NAK_SENTINEL) {
+			pd->stats.naks[pd->ephemeral_data[0]]++;
+		}
 		ret = OSDP_PD_ERR_NONE;
 		break;
 	case REPLY_MFGREP:
@@ -925,6 +931,9 @@ static int pd_build_reply(struct osdp_pd *pd, uint8_t *buf, int max_len)
 			}
 		} else {
 			smb[2] = 0;  /* CP auth failed */
+			pd->stats.sc_failures++;
+			osdp_flight_recorder_trigger(pd,
+				OSDP_FLIGHT_RECORDER_SC_FAILURE);
 			LOG_WRN("failed to verify CP_crypt");
 		}
 		ret = OSDP_PD_ERR_NONE;
@@ -944,6 +953,7 @@ static int pd_build_reply(struct osdp_pd *pd, uint8_t *buf, int max_len)
 		assert_buf_len(REPLY_NAK_LEN, max_len);
 		buf[0] = REPLY_NAK;
 		buf[1] = OSDP_PD_NAK_RECORD;
+		pd->stats.naks[OSDP_PD_NAK_RECORD]++;
 		len = 2;
 	}
 
@@ -952,23 +962,24 @@ static int pd_build_reply(struct osdp_pd *pd, uint8_t *buf, int max_len)
 
 static int pd_send_reply(struct osdp_pd *pd)
 {
+	struct osdp_chn_buf *cbuf = pd->chn_buf;
 	int ret, packet_buf_size = get_tx_buf_size(pd);
 
 	/* init packet buf with header */
-	ret = osdp_phy_packet_init(pd, pd->packet_buf, packet_buf_size);
+	ret = osdp_phy_packet_init(pd, cbuf->packet_buf, packet_buf_size);
 	if (ret < 0) {
 		return OSDP_PD_ERR_GENERIC;
 	}
-	pd->packet_buf_len = ret;
+	cbuf->packet_buf_len = ret;
 
 	/* fill reply data */
-	ret = pd_build_reply(pd, pd->packet_buf, packet_buf_size);
+	ret = pd_build_reply(pd, cbuf->packet_buf, packet_buf_size);
 	if (ret <= 0) {
 		return OSDP_PD_ERR_GENERIC;
 	}
-	pd->packet_buf_len += ret;
+	cbuf->packet_buf_len += ret;
 
-	ret = osdp_phy_send_packet(pd, pd->packet_buf, pd->packet_buf_len,
+	ret = osdp_phy_send_packet(pd, cbuf->packet_buf, cbuf->packet_buf_len,
 				   packet_buf_size);
 	if (ret < 0) {
 		return OSDP_PD_ERR_GENERIC;
@@ -1136,26 +1147,44 @@ osdp_t *osdp_pd_setup(const osdp_pd_info_t *info)
 		return NULL;
 	}
 
-	ctx->pd = calloc(1, sizeof(struct osdp_pd));
+	ctx->pd = calloc(1, sizeof(struct osdp_pd *));
 	if (ctx->pd == NULL) {
+		LOG_PRINT("Failed to allocate osdp_pd table");
+		free(ctx);
+		return NULL;
+	}
+
+	ctx->pd[0] = calloc(1, sizeof(struct osdp_pd));
+	ctx->bus = calloc(1, sizeof(struct osdp_bus));
+	if (ctx->pd[0] == NULL || ctx->bus == NULL) {
 		LOG_PRINT("Failed to allocate osdp_pd context");
-		goto error;
+		safe_free(ctx->pd[0]);
+		safe_free(ctx->bus);
+		free(ctx->pd);
+		free(ctx);
+		return NULL;
 	}
 #else
 	static struct osdp g_osdp_ctx;
 	static struct osdp_pd g_osdp_pd_ctx;
+	static struct osdp_pd *g_osdp_pd_table[1] = { &g_osdp_pd_ctx };
+	static struct osdp_bus g_osdp_bus;
 
 	ctx = &g_osdp_ctx;
-	ctx->pd = &g_osdp_pd_ctx;
+	ctx->pd = g_osdp_pd_table;
+	ctx->bus = &g_osdp_bus;
 #endif
 
 	input_check_init(ctx);
 	ctx->_num_pd = 1;
+	ctx->num_channels = 1;
 
 	SET_CURRENT_PD(ctx, 0);
 	pd = osdp_to_pd(ctx, 0);
 
 	pd->osdp_ctx = ctx;
+	pd->bus = &ctx->bus[0];
+	pd->chn_buf = &pd->bus->buf;
 	pd->idx = 0;
 	if (info->name) {
 		strncpy(pd->name, info->name, OSDP_PD_NAME_MAXLEN - 1);
@@ -1213,6 +1242,7 @@ void osdp_pd_teardown(osdp_t *ctx)
 	assert(ctx);
 	struct osdp_pd *pd = osdp_to_pd(ctx, 0);
 
+	osdp_capture_writer_stop(TO_OSDP(ctx));
 	if (is_capture_enabled(pd)) {
 		osdp_packet_capture_finish(pd);
 	}
@@ -1220,10 +1250,13 @@ void osdp_pd_teardown(osdp_t *ctx)
 	if (pd->channel.close) {
 		pd->channel.close(pd->channel.data);
 	}
+	safe_free(TO_OSDP(ctx)->recorder_buf);
 
 #ifndef OPT_OSDP_STATIC_PD
 	safe_free(pd->file);
 	safe_free(pd);
+	safe_free(TO_OSDP(ctx)->bus);
+	safe_free(TO_OSDP(ctx)->pd);
 	safe_free(ctx);
 #endif
 }
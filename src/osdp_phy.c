@@ -6,6 +6,7 @@
 
 #include "osdp_common.h"
 #include "osdp_diag.h"
+#include "osdp_capture.h"
 
 #define OSDP_PKT_MARK                  0xFF
 #define OSDP_PKT_SOM                   0x53
@@ -28,68 +29,108 @@ static inline bool packet_has_mark(struct osdp_pd *pd)
 	return ISSET_FLAG(pd, PD_FLAG_PKT_HAS_MARK);
 }
 
-static int osdp_channel_send(struct osdp_pd *pd, uint8_t *buf, int len)
+static int osdp_channel_send(struct osdp_pd *pd, struct osdp_iovec *iov,
+			     int iovcnt)
 {
-	int sent, total_sent = 0;
+	int i, sent, len, total_sent = 0;
 
 	/* flush rx to remove any invalid data. */
 	if (pd->channel.flush) {
 		pd->channel.flush(pd->channel.data);
 	}
 
-	do { /* send can block; so be greedy */
-		sent = pd->channel.send(pd->channel.data,
-					buf + total_sent, len - total_sent);
-		if (sent <= 0) {
-			break;
+	if (pd->channel.sendv) {
+		while (iovcnt) { /* on short writes, skip what already went out */
+			sent = pd->channel.sendv(pd->channel.data, iov, iovcnt);
+			if (sent <= 0) {
+				break;
+			}
+			total_sent += sent;
+			while (iovcnt && sent >= iov->len) {
+				sent -= iov->len;
+				iov++;
+				iovcnt--;
+			}
+			if (iovcnt) {
+				iov->buf += sent;
+				iov->len -= sent;
+			}
 		}
-		total_sent += sent;
-	} while (total_sent < len);
+		return total_sent;
+	}
+
+	for (i = 0; i < iovcnt; i++) {
+		len = 0;
+		do { /* send can block; so be greedy */
+			sent = pd->channel.send(pd->channel.data,
+						iov[i].buf + len,
+						iov[i].len - len);
+			if (sent <= 0) {
+				return total_sent;
+			}
+			len += sent;
+			total_sent += sent;
+		} while (len < iov[i].len);
+	}
 
 	return total_sent;
 }
 
 static int osdp_channel_receive(struct osdp_pd *pd)
 {
-	uint8_t buf[64];
-	int recv, total_recv = 0;
+	struct osdp_rb *rb = &pd->chn_buf->rx_rb;
+	struct osdp_iovec iov[2];
+	int recv, free_len, total_recv = 0;
 
 #ifdef UNIT_TESTING
 	/**
 	 * Some unit tests don't define pd->channel.recv and directly fill
-	 * pd->packet_buf to test if everything else work correctly.
+	 * pd->chn_buf to test if everything else work correctly.
 	 */
-	if (!pd->channel.recv) {
+	if (!pd->channel.recv && !pd->channel.recvv) {
 		return 0;
 	}
 #endif
 
+	/* Bytes are received straight into the free space of the RX ring */
 	do {
-		recv = pd->channel.recv(pd->channel.data, buf, sizeof(buf));
+		iov[0].len = osdp_rb_write_view(rb, 0, &iov[0].buf);
+		iov[1].len = osdp_rb_write_view(rb, iov[0].len, &iov[1].buf);
+		if (iov[0].len == 0) {
+			if (total_recv) {
+				break; /* pick up the rest in the next refresh */
+			}
+			LOG_EM("RX ring buffer overflow!");
+			pd->stats.rx_overflows++;
+			return -1;
+		}
+		if (pd->channel.recvv) {
+			free_len = iov[0].len + iov[1].len;
+			recv = pd->channel.recvv(pd->channel.data, iov,
+						 iov[1].len ? 2 : 1);
+		} else {
+			free_len = iov[0].len;
+			recv = pd->channel.recv(pd->channel.data,
+						iov[0].buf, iov[0].len);
+		}
 		if (recv <= 0) {
 			break;
 		}
-		if (osdp_rb_push_buf(&pd->rx_rb, buf, recv) != recv) {
-			LOG_EM("RX ring buffer overflow!");
+		if (recv > free_len) {
+			LOG_ERR("Channel recv returned more than asked for!");
 			return -1;
 		}
+		osdp_rb_commit(rb, recv);
+		pd->stats.rx_bytes += recv;
 		total_recv += recv;
-	} while (recv == sizeof(buf));
+	} while (recv == free_len);
 
 	return total_recv;
 }
 
-static uint8_t osdp_compute_checksum(uint8_t *msg, int length)
+static inline uint8_t phy_checksum_final(uint8_t sum)
 {
-	uint8_t checksum = 0;
-	int i, whole_checksum;
-
-	whole_checksum = 0;
-	for (i = 0; i < length; i++) {
-		whole_checksum += msg[i];
-		checksum = ~(0xff & whole_checksum) + 1;
-	}
-	return checksum;
+	return (uint8_t)(0x100 - sum); /* two's complement of the byte sum */
 }
 
 static inline int phy_get_next_seq_number(struct osdp_pd *pd)
@@ -141,6 +182,36 @@ uint8_t *osdp_phy_packet_get_smb(struct osdp_pd *pd, const uint8_t *buf)
 	return (pkt->control & PKT_CONTROL_SCB) ? pkt->data : NULL;
 }
 
+/* The flight recorder keeps only the first few bytes; stitch just those */
+static void phy_record_gather(struct osdp_pd *pd,
+			      const struct osdp_iovec *iov, int iovcnt, int len)
+{
+	uint8_t snap[OSDP_FLIGHT_RECORDER_SNAPLEN];
+	int i, n, pos = 0;
+
+	for (i = 0; i < iovcnt && pos < (int)sizeof(snap); i++) {
+		n = (int)sizeof(snap) - pos;
+		if (n > iov[i].len) {
+			n = iov[i].len;
+		}
+		memcpy(snap + pos, iov[i].buf, n);
+		pos += n;
+	}
+	osdp_flight_recorder_add(pd, snap, len);
+}
+
+static void phy_capture_packet(struct osdp_pd *pd, const uint8_t *buf, int len)
+{
+	int offset;
+
+	osdp_flight_recorder_add(pd, buf, len);
+	if (pd->capture) {
+		offset = osdp_phy_packet_get_data_offset(pd, buf);
+		osdp_capture_writer_add(pd, buf, len,
+					(offset < len) ? buf[offset] : -1);
+	}
+}
+
 int osdp_phy_in_sc_handshake(int is_reply, int id)
 {
 	if (is_reply) {
@@ -159,6 +230,7 @@ int osdp_phy_packet_init(struct osdp_pd *pd, uint8_t *buf, int max_len)
 		LOG_ERR("packet_init: packet size too small");
 		return OSDP_ERR_PKT_FMT;
 	}
+	osdp_phy_packet_set_payload(pd, NULL, 0);
 
 	/**
 	 * In PD mode just follow what we received from CP. In CP mode, as we
@@ -210,6 +282,8 @@ static int phy_packet_finalize(struct osdp_pd *pd, uint8_t *buf,
 			       int len, int max_len)
 {
 	uint16_t crc16;
+	uint8_t sum;
+	struct osdp_iovec *payload = &pd->chn_buf->tx_payload;
 	struct osdp_packet_header *pkt;
 	uint8_t *data;
 	int data_len, checksum_len;
@@ -238,10 +312,17 @@ static int phy_packet_finalize(struct osdp_pd *pd, uint8_t *buf,
 		return OSDP_ERR_PKT_FMT;
 	}
 
-	/* len: with CRC (2 bytes) or checksum (1 byte) */
+	/* payload is sent as is; it can't be encrypted or MAC-ed in place */
+	if (payload->len && sc_is_active(pd)) {
+		LOG_ERR("PKT_F: External payload in secure channel! ID: 0x%02x",
+			is_cp_mode(pd) ? pd->cmd_id : pd->reply_id);
+		return OSDP_ERR_PKT_FMT;
+	}
+
+	/* len: with payload; with CRC (2 bytes) or checksum (1 byte) */
 	checksum_len = (pkt->control & PKT_CONTROL_CRC) ? 2 : 1;
-	pkt->len_lsb = BYTE_0(len + checksum_len);
-	pkt->len_msb = BYTE_1(len + checksum_len);
+	pkt->len_lsb = BYTE_0(len + payload->len + checksum_len);
+	pkt->len_msb = BYTE_1(len + payload->len + checksum_len);
 
 	if (is_data_trace_enabled(pd)) {
 		uint8_t control;
@@ -310,6 +391,10 @@ static int phy_packet_finalize(struct osdp_pd *pd, uint8_t *buf,
 			goto out_of_space_error;
 		}
 		crc16 = osdp_compute_crc16(buf, len);
+		if (payload->len) {
+			crc16 = osdp_crc16_update(crc16, payload->buf,
+						  payload->len);
+		}
 		buf[len + 0] = BYTE_0(crc16);
 		buf[len + 1] = BYTE_1(crc16);
 		len += 2;
@@ -317,7 +402,12 @@ static int phy_packet_finalize(struct osdp_pd *pd, uint8_t *buf,
 		if (len + 1 > max_len) {
 			goto out_of_space_error;
 		}
-		buf[len] = osdp_compute_checksum(buf, len);
+		sum = osdp_checksum_update(0, buf, len);
+		if (payload->len) {
+			sum = osdp_checksum_update(sum, payload->buf,
+						   payload->len);
+		}
+		buf[len] = phy_checksum_final(sum);
 		len += 1;
 	}
 
@@ -331,7 +421,8 @@ out_of_space_error:
 int osdp_phy_send_packet(struct osdp_pd *pd, uint8_t *buf,
 			 int len, int max_len)
 {
-	int ret;
+	struct osdp_iovec iov[3], *payload = &pd->chn_buf->tx_payload;
+	int ret, iovcnt = 1, head_len = len;
 
 	/* finalize packet */
 	len = phy_packet_finalize(pd, buf, len, max_len);
@@ -339,121 +430,218 @@ int osdp_phy_send_packet(struct osdp_pd *pd, uint8_t *buf,
 		return OSDP_ERR_PKT_BUILD;
 	}
 
-	if (is_packet_trace_enabled(pd)) {
-		osdp_capture_packet(pd, buf, len);
+	/**
+	 * An external payload goes out between the head of the packet and
+	 * the trailer (CRC/checksum) that finalize appended to it in buf.
+	 */
+	iov[0].buf = buf;
+	iov[0].len = len;
+	if (payload->len) {
+		iov[0].len = head_len;
+		iov[1] = *payload;
+		iov[2].buf = buf + head_len;
+		iov[2].len = len - head_len;
+		iovcnt = 3;
+		len += payload->len;
+		phy_record_gather(pd, iov, iovcnt, len);
+	} else {
+		phy_capture_packet(pd, buf, len);
+		if (is_packet_trace_enabled(pd)) {
+			osdp_capture_packet(pd, buf, len);
+		}
 	}
 
-	ret = osdp_channel_send(pd, buf, len);
+	ret = osdp_channel_send(pd, iov, iovcnt);
 	if (ret != len) {
 		LOG_ERR("Channel send for %d bytes failed! ret: %d",
 			len, ret);
 		return OSDP_ERR_PKT_BUILD;
 	}
+	pd->stats.tx_packets++;
+	pd->stats.tx_bytes += len;
 
 	return OSDP_ERR_PKT_NONE;
 }
 
-static bool phy_rescan_packet_buf(struct osdp_pd *pd)
+bool osdp_phy_can_gather(struct osdp_pd *pd)
 {
-	unsigned long j = packet_has_mark(pd);
-	unsigned long i = j + 1; /* +1 to skip current SoM */
+	/**
+	 * Data that has to be encrypted/MAC-ed, or handed to packet trace or
+	 * the capture writer, must be in packet_buf.
+	 */
+	return pd->channel.sendv && !sc_is_active(pd) &&
+	       !is_capture_enabled(pd) && !pd->capture;
+}
+
+void osdp_phy_packet_set_payload(struct osdp_pd *pd, const uint8_t *buf,
+				 int len)
+{
+	pd->chn_buf->tx_payload.buf = (uint8_t *)buf;
+	pd->chn_buf->tx_payload.len = len;
+}
+
+/* Number of bytes in buf that are not MARK (idle line fill) */
+static uint32_t phy_count_noise(const uint8_t *buf, int len)
+{
+	uint32_t count = 0;
+	int i;
 
-	while (i < pd->packet_buf_len && pd->packet_buf[i] != OSDP_PKT_SOM) {
-		i++;
+	for (i = 0; i < len; i++) { /* branch free; compilers vectorize it */
+		count += (buf[i] != OSDP_PKT_MARK);
 	}
+	return count;
+}
 
-	if (i < pd->packet_buf_len) {
-		/* found another SoM; move the rest of the bytes down */
-		if (i && pd->packet_buf[i - 1] == OSDP_PKT_MARK) {
-			pd->packet_buf[0] = OSDP_PKT_MARK;
-			j = 1;
-			SET_FLAG(pd, PD_FLAG_PKT_HAS_MARK);
-		} else {
-			j = 0;
-			CLEAR_FLAG(pd, PD_FLAG_PKT_HAS_MARK);
-		}
-		while (i < pd->packet_buf_len) {
-			pd->packet_buf[j++] = pd->packet_buf[i++];
+/**
+ * Drop bytes from the RX ring until it starts with a SoM (or a MARK followed
+ * by SoM). A trailing MARK is left behind as its SoM may not be here yet.
+ */
+static int phy_scan_som(struct osdp_pd *pd)
+{
+	struct osdp_chn_buf *cbuf = pd->chn_buf;
+	struct osdp_rb *rb = &cbuf->rx_rb;
+	uint8_t *buf, prev_byte = 0;
+	int n, som, end, offset = 0;
+
+	som = osdp_rb_find(rb, 0, OSDP_PKT_SOM);
+	end = (som < 0) ? osdp_rb_len(rb) : som;
+
+	/* account for the garbage in front of the SoM */
+	while (offset < end && (n = osdp_rb_read_view(rb, offset, &buf)) > 0) {
+		if (n > end - offset) {
+			n = end - offset;
 		}
-		pd->packet_buf_len = j;
-		return true;
+		cbuf->packet_scan_skip += phy_count_noise(buf, n);
+		prev_byte = buf[n - 1];
+		offset += n;
+	}
+
+	if (prev_byte == OSDP_PKT_MARK) {
+		end -= 1;
+	}
+	osdp_rb_consume(rb, end);
+
+	if (som < 0) {
+		return -1;
+	}
+	if (prev_byte == OSDP_PKT_MARK) {
+		SET_FLAG(pd, PD_FLAG_PKT_HAS_MARK);
+	} else {
+		CLEAR_FLAG(pd, PD_FLAG_PKT_HAS_MARK);
 	}
+	return 0;
+}
 
-	/* nothing found, discarded all */
-	pd->packet_buf_len = 0;
-	return false;
+/**
+ * Claim up to len bytes at the tail of the RX ring for the current packet.
+ * Returns true when all of them have arrived.
+ */
+static bool phy_rx_claim(struct osdp_chn_buf *cbuf, unsigned long len)
+{
+	unsigned long avail = osdp_rb_len(&cbuf->rx_rb);
+
+	cbuf->rx_held = (avail < len) ? avail : len;
+	cbuf->packet_buf_len = cbuf->rx_held;
+	return cbuf->rx_held == len;
 }
 
 static int phy_check_header(struct osdp_pd *pd)
 {
+	struct osdp_chn_buf *cbuf = pd->chn_buf;
 	unsigned long pkt_len;
-	int len;
+	int hdr_len;
+	bool resync = false;
 	struct osdp_packet_header *pkt;
-	uint8_t cur_byte = 0, prev_byte = 0;
-	uint8_t *buf = pd->packet_buf;
-
-	/* Scan for packet start */
-	while (pd->packet_buf_len == 0) {
-		if (osdp_rb_pop(&pd->rx_rb, &cur_byte)) {
-			return OSDP_ERR_PKT_NO_DATA;
-		}
-		if (cur_byte == OSDP_PKT_SOM) {
-			if (prev_byte == OSDP_PKT_MARK) {
-				buf[0] = OSDP_PKT_MARK;
-				buf[1] = OSDP_PKT_SOM;
-				pd->packet_buf_len = 2;
-				SET_FLAG(pd, PD_FLAG_PKT_HAS_MARK);
-			} else {
-				buf[0] = OSDP_PKT_SOM;
-				pd->packet_buf_len = 1;
-				CLEAR_FLAG(pd, PD_FLAG_PKT_HAS_MARK);
-			}
-			break;
-		}
-		if (cur_byte != OSDP_PKT_MARK) {
-			pd->packet_scan_skip++;
-		}
-		prev_byte = cur_byte;
-	}
+	uint8_t *buf;
 
-	/* Found start of a new packet; wait until we have atleast the header */
-	len = osdp_rb_pop_buf(&pd->rx_rb, buf + pd->packet_buf_len,
-			      sizeof(struct osdp_packet_header) - 1);
-	pd->packet_buf_len += len;
-	if (pd->packet_buf_len < sizeof(struct osdp_packet_header)) {
-		return OSDP_ERR_PKT_WAIT;
-	}
+	while (true) {
+		/* Scan for packet start */
+		if (cbuf->rx_held == 0 && phy_scan_som(pd)) {
+			return resync ? OSDP_ERR_PKT_WAIT :
+					OSDP_ERR_PKT_NO_DATA;
+		}
 
-	pkt = (struct osdp_packet_header *)(buf + packet_has_mark(pd));
+		/* Found start of a new packet; wait for atleast the header */
+		hdr_len = packet_has_mark(pd) + sizeof(struct osdp_packet_header);
+		if (!phy_rx_claim(cbuf, hdr_len)) {
+			return OSDP_ERR_PKT_WAIT;
+		}
+		buf = osdp_rb_peek(&cbuf->rx_rb, 0, cbuf->packet_buf, hdr_len);
+		pkt = (struct osdp_packet_header *)(buf + packet_has_mark(pd));
 
-	/* validate packet header */
-	if (pkt->som != OSDP_PKT_SOM) {
-		LOG_ERR("Invalid SOM 0x%02x", pkt->som);
-		return OSDP_ERR_PKT_FMT;
-	}
+		/* validate packet */
+		pkt_len = (pkt->len_msb << 8) | pkt->len_lsb;
+		if (pkt_len <= OSDP_PACKET_BUF_SIZE &&
+		    pkt_len >= sizeof(struct osdp_packet_header) + 1 &&
+		    (is_pd_mode(pd) || (pkt->pd_address & 0x80)) &&
+		    (is_cp_mode(pd) || !(pkt->pd_address & 0x80))) {
+			break;
+		}
 
-	/* validate packet */
-	pkt_len = (pkt->len_msb << 8) | pkt->len_lsb;
-	if (pkt_len > OSDP_PACKET_BUF_SIZE ||
-	    pkt_len < sizeof(struct osdp_packet_header) + 1 ||
-	    (is_cp_mode(pd) && !(pkt->pd_address & 0x80)) ||
-	    (is_pd_mode(pd) &&  (pkt->pd_address & 0x80))) {
 		/*
 		 * Since SoM byte was encountered and the packet structure is
-		 * invalid, we cannot just discard all bytes extracted so far
+		 * invalid, we cannot just discard all bytes received so far
 		 * as there may another valid SoM in the subsequent stream. So
-		 * we need to re-scan rest of the extracted bytes for another
-		 * SoM before we can discard the extracted bytes.
+		 * we drop just this SoM and scan again from the byte after
+		 * it. The rest is still in the ring, so this is linear in the
+		 * number of bytes dropped.
 		 */
-		if (phy_rescan_packet_buf(pd)) {
-			LOG_DBG("Found nested SoM in re-scan; re-parsing");
-		}
-		return OSDP_ERR_PKT_WAIT;
+		osdp_rb_consume(&cbuf->rx_rb, packet_has_mark(pd) + 1);
+		cbuf->rx_held = 0;
+		cbuf->packet_buf_len = 0;
+		resync = true;
+	}
+
+	if (resync) {
+		LOG_DBG("Found nested SoM in re-scan; re-parsing");
 	}
 
+	/* CRC/checksum covers everything after the MARK, but the trailer */
+	cbuf->rx_check_pos = packet_has_mark(pd);
+	cbuf->rx_check_end = packet_has_mark(pd) + pkt_len;
+	if (pkt->control & PKT_CONTROL_CRC) {
+		cbuf->rx_check = OSDP_CRC16_SEED;
+		cbuf->rx_check_end -= 2;
+	} else {
+		cbuf->rx_check = 0;
+		cbuf->rx_check_end -= 1;
+	}
 	return pkt_len + packet_has_mark(pd);
 }
 
+/**
+ * Fold the bytes of the current packet that arrived since the last call into
+ * the running CRC/checksum; by the time the last byte lands, only a compare
+ * is left to do.
+ */
+static void phy_rx_check_update(struct osdp_chn_buf *cbuf)
+{
+	unsigned long end = cbuf->rx_check_end;
+	bool is_crc = (cbuf->packet_len - end) == 2;
+	uint8_t *buf;
+	int n;
+
+	if (cbuf->rx_held < end) {
+		end = cbuf->rx_held;
+	}
+
+	while (cbuf->rx_check_pos < end &&
+	       (n = osdp_rb_read_view(&cbuf->rx_rb, cbuf->rx_check_pos,
+				      &buf)) > 0) {
+		if ((unsigned long)n > end - cbuf->rx_check_pos) {
+			n = end - cbuf->rx_check_pos;
+		}
+		if (is_crc) {
+			cbuf->rx_check = osdp_crc16_update(cbuf->rx_check,
+							   buf, n);
+		} else {
+			cbuf->rx_check = osdp_checksum_update(cbuf->rx_check,
+							      buf, n);
+		}
+		cbuf->rx_check_pos += n;
+	}
+}
+
 static int phy_check_packet(struct osdp_pd *pd, uint8_t *buf, int pkt_len)
 {
 	int pd_addr;
@@ -466,21 +654,23 @@ static int phy_check_packet(struct osdp_pd *pd, uint8_t *buf, int pkt_len)
 	}
 	pkt = (struct osdp_packet_header *)buf;
 
-	/* validate CRC/checksum */
+	/* validate CRC/checksum; computed while the packet was received */
 	if (pkt->control & PKT_CONTROL_CRC) {
 		pkt_len -= 2; /* consume CRC */
 		cur = (buf[pkt_len + 1] << 8) | buf[pkt_len];
-		comp = osdp_compute_crc16(buf, pkt_len);
+		comp = pd->chn_buf->rx_check;
 		if (comp != cur) {
 			LOG_ERR("Invalid crc 0x%04x/0x%04x", comp, cur);
+			pd->stats.crc_errors++;
 			return OSDP_ERR_PKT_FMT;
 		}
 	} else {
 		pkt_len -= 1; /* consume checksum */
 		cur = buf[pkt_len];
-		comp = osdp_compute_checksum(buf, pkt_len);
+		comp = phy_checksum_final((uint8_t)pd->chn_buf->rx_check);
 		if (comp != cur) {
 			LOG_ERR("Invalid checksum %02x/%02x", comp, cur);
+			pd->stats.checksum_errors++;
 			return OSDP_ERR_PKT_FMT;
 		}
 	}
@@ -558,6 +748,7 @@ static int phy_check_packet(struct osdp_pd *pd, uint8_t *buf, int pkt_len)
 
 int osdp_phy_check_packet(struct osdp_pd *pd)
 {
+	struct osdp_chn_buf *cbuf = pd->chn_buf;
 	int ret = OSDP_ERR_PKT_FMT;
 
 	ret = osdp_channel_receive(pd); /* always pull new bytes first */
@@ -567,42 +758,53 @@ int osdp_phy_check_packet(struct osdp_pd *pd)
 	 * from CP, we need to capture the timestamp so we can timeout and
 	 * clear the buffer on errors and stray RX data.
 	 */
-	if (is_pd_mode(pd) && pd->packet_buf_len == 0 && ret > 0) {
+	if (is_pd_mode(pd) && cbuf->packet_buf_len == 0 && ret > 0) {
 		pd->tstamp = osdp_millis_now();
 	}
 
-	if (pd->packet_len == 0) {
+	if (cbuf->packet_len == 0) {
 		ret = phy_check_header(pd);
 		if (ret < 0) {
 			return ret;
 		}
-		pd->packet_len = ret;
-		if (pd->packet_scan_skip) {
+		cbuf->packet_len = ret;
+		if (cbuf->packet_scan_skip) {
 			LOG_DBG("Packet scan skipped:%u mark:%d",
-				pd->packet_scan_skip,
+				cbuf->packet_scan_skip,
 				ISSET_FLAG(pd, PD_FLAG_PKT_HAS_MARK));
-			pd->packet_scan_skip = 0;
+			pd->stats.scan_skip_bytes += cbuf->packet_scan_skip;
+			cbuf->packet_scan_skip = 0;
 		}
 	}
 
-	/* We have a valid header, collect one full packet */
-	ret = osdp_rb_pop_buf(&pd->rx_rb, pd->packet_buf + pd->packet_buf_len,
-				pd->packet_len - pd->packet_buf_len);
-	pd->packet_buf_len += ret;
-	if (pd->packet_buf_len != pd->packet_len)
+	/* We have a valid header, wait for one full packet */
+	ret = phy_rx_claim(cbuf, cbuf->packet_len);
+	phy_rx_check_update(cbuf);
+	if (!ret) {
 		return OSDP_ERR_PKT_WAIT;
+	}
+
+	/**
+	 * The packet is parsed right where it lies in the RX ring. It is
+	 * copied to packet_buf only when it wraps around the end of the ring.
+	 * Either way, it stays valid until osdp_phy_state_reset().
+	 */
+	cbuf->rx_pkt = osdp_rb_peek(&cbuf->rx_rb, 0, cbuf->packet_buf,
+				    cbuf->packet_len);
+	pd->stats.rx_packets++;
+	phy_capture_packet(pd, cbuf->rx_pkt, cbuf->packet_len);
 
 	if (is_packet_trace_enabled(pd)) {
-		osdp_capture_packet(pd, pd->packet_buf, pd->packet_buf_len);
+		osdp_capture_packet(pd, cbuf->rx_pkt, cbuf->packet_len);
 	}
 
-	return phy_check_packet(pd, pd->packet_buf, pd->packet_len);
+	return phy_check_packet(pd, cbuf->rx_pkt, cbuf->packet_len);
 }
 
 int osdp_phy_decode_packet(struct osdp_pd *pd, uint8_t **pkt_start)
 {
-	uint8_t *data, *mac, *buf = pd->packet_buf;
-	int mac_offset, is_cmd, len = pd->packet_buf_len;
+	uint8_t *data, *mac, *buf = pd->chn_buf->rx_pkt;
+	int mac_offset, is_cmd, len = pd->chn_buf->packet_len;
 	struct osdp_packet_header *pkt;
 	bool is_sc_active = sc_is_active(pd);
 
@@ -691,6 +893,7 @@ int osdp_phy_decode_packet(struct osdp_pd *pd, uint8_t **pkt_start)
 		mac = is_cmd ? pd->sc.c_mac : pd->sc.r_mac;
 		if (memcmp(buf + mac_offset, mac, 4) != 0) {
 			LOG_ERR("Invalid MAC; discarding SC");
+			pd->stats.mac_failures++;
 			sc_deactivate(pd);
 			pd->reply_id = REPLY_NAK;
 			pd->ephemeral_data[0] = OSDP_PD_NAK_SC_COND;
@@ -771,8 +974,16 @@ int osdp_phy_decode_packet(struct osdp_pd *pd, uint8_t **pkt_start)
 
 void osdp_phy_state_reset(struct osdp_pd *pd, bool is_error)
 {
-	pd->packet_buf_len = 0;
-	pd->packet_len = 0;
+	struct osdp_chn_buf *cbuf = pd->chn_buf;
+
+	/* Release the bytes of the current packet back to the RX ring */
+	osdp_rb_consume(&cbuf->rx_rb, cbuf->rx_held);
+	cbuf->rx_held = 0;
+	cbuf->rx_pkt = NULL;
+	cbuf->tx_payload.buf = NULL;
+	cbuf->tx_payload.len = 0;
+	cbuf->packet_buf_len = 0;
+	cbuf->packet_len = 0;
 	pd->phy_state = 0;
 	if (is_error) {
 		pd->phy_retry_count = 0;
@@ -789,6 +1000,11 @@ void osdp_phy_progress_sequence(struct osdp_pd *pd)
 }
 
 #ifdef UNIT_TESTING
+static uint8_t osdp_compute_checksum(uint8_t *msg, int length)
+{
+	return phy_checksum_final(osdp_checksum_update(0, msg, length));
+}
+
 int (*test_osdp_phy_packet_finalize)(struct osdp_pd *pd, uint8_t *buf,
 			int len, int max_len) = phy_packet_finalize;
 
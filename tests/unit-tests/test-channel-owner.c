@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2025 Siddharth Chandrasekaran <sidcha.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <osdp.h>
+#include "test.h"
+
+static bool test_idle_owners(struct test_cp_env *env)
+{
+	int owner[3];
+
+	printf(SUB_2 "testing owners of idle channels\n");
+
+	osdp_cp_get_channel_owner(env->cp, 0, &owner[0]);
+	osdp_cp_get_channel_owner(env->cp, 1, &owner[1]);
+	osdp_cp_get_channel_owner(env->cp, 2, &owner[2]);
+
+	/* a channel with a single PD always belongs to it */
+	if (owner[0] != -1 || owner[1] != -1 || owner[2] != 2) {
+		printf(SUB_2 "unexpected idle owners %d/%d/%d\n",
+		       owner[0], owner[1], owner[2]);
+		return false;
+	}
+	return true;
+}
+
+static bool test_busy_owner(struct test_cp_env *env)
+{
+	int i, owner[2] = { -1, -1 };
+
+	printf(SUB_2 "testing owner of a channel waiting for a reply\n");
+
+	/* only the CP runs; whichever PD sends first holds the bus */
+	for (i = 0; i < 10 && owner[0] == -1; i++) {
+		osdp_cp_refresh(env->cp);
+		osdp_cp_get_channel_owner(env->cp, 0, &owner[0]);
+		usleep(1000);
+	}
+	osdp_cp_get_channel_owner(env->cp, 1, &owner[1]);
+	if (owner[0] < 0 || owner[0] > 1 || owner[1] != owner[0]) {
+		printf(SUB_2 "unexpected busy owners %d/%d\n",
+		       owner[0], owner[1]);
+		return false;
+	}
+	return true;
+}
+
+static bool test_shared_channel_online(struct test_cp_env *env)
+{
+	printf(SUB_2 "testing PDs on a shared channel come online\n");
+
+	if (!test_cp_env_wait_online(env, -1, 5000)) {
+		printf(SUB_2 "PDs failed to come online\n");
+		return false;
+	}
+	return true;
+}
+
+void run_channel_owner_tests(struct test *t)
+{
+	bool result = true;
+	struct test_cp_env env = { 0 };
+	const int bus[] = { 0, 0, 1 }; /* PD-0 and PD-1 share a bus */
+
+	printf("\nBegin channel owner tests\n");
+
+	if (test_cp_env_setup(t, &env, 3, bus)) {
+		TEST_REPORT(t, false);
+		return;
+	}
+
+	result &= test_idle_owners(&env);
+	result &= test_busy_owner(&env);
+	result &= test_shared_channel_online(&env);
+
+	test_cp_env_teardown(&env);
+
+	printf(SUB_1 "channel owner tests %s\n",
+	       result ? "succeeded" : "failed");
+	TEST_REPORT(t, result);
+}
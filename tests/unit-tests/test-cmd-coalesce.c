@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2025 Siddharth Chandrasekaran <sidcha.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <osdp.h>
+#include "test.h"
+
+static bool test_led_coalesce(struct test_cp_env *env)
+{
+	struct osdp_cmd cmd = {
+		.id = OSDP_CMD_LED,
+		.flags = OSDP_CMD_FLAG_COALESCE,
+		.led = {
+			.reader = 0,
+			.led_number = 1,
+			.permanent = { .control_code = 1, .on_count = 1 },
+		},
+	};
+
+	printf(SUB_2 "testing LED commands to the same LED collapse\n");
+
+	/* 3 updates to LED 1 collapse into one; LED 2 gets its own slot */
+	cmd.led.permanent.on_color = OSDP_LED_COLOR_RED;
+	osdp_cp_submit_command(env->cp, 0, &cmd);
+	cmd.led.permanent.on_color = OSDP_LED_COLOR_GREEN;
+	osdp_cp_submit_command(env->cp, 0, &cmd);
+	cmd.led.led_number = 2;
+	osdp_cp_submit_command(env->cp, 0, &cmd);
+	cmd.led.led_number = 1;
+	cmd.led.permanent.on_color = OSDP_LED_COLOR_BLUE;
+	osdp_cp_submit_command(env->cp, 0, &cmd);
+
+	/* without the flag, commands queue up as usual */
+	cmd.flags = 0;
+	osdp_cp_submit_command(env->cp, 0, &cmd);
+
+	env->num_cmds = 0;
+	test_cp_env_run(env, 300);
+
+	if (env->num_cmds != 3) {
+		printf(SUB_2 "expected 3 commands at the PD; got %d\n",
+		       env->num_cmds);
+		return false;
+	}
+	/* the first slot (LED 1) must carry the latest state */
+	if (env->cmds[0].led.led_number != 1 ||
+	    env->cmds[0].led.permanent.on_color != OSDP_LED_COLOR_BLUE ||
+	    env->cmds[1].led.led_number != 2 ||
+	    env->cmds[2].led.led_number != 1) {
+		printf(SUB_2 "queued command was not replaced\n");
+		return false;
+	}
+	return true;
+}
+
+static bool test_led_merge(struct test_cp_env *env)
+{
+	struct osdp_cmd_led *led;
+	struct osdp_cmd cmd = {
+		.id = OSDP_CMD_LED,
+		.flags = OSDP_CMD_FLAG_COALESCE,
+		.led = {
+			.led_number = 0,
+			.temporary = { .control_code = 2, .on_count = 1,
+				       .on_color = OSDP_LED_COLOR_RED,
+				       .timer_count = 10 },
+			.permanent = { .control_code = 1, .on_count = 1,
+				       .on_color = OSDP_LED_COLOR_GREEN },
+		},
+	};
+
+	printf(SUB_2 "testing LED parts are merged, not replaced\n");
+
+	osdp_cp_submit_command(env->cp, 0, &cmd);
+
+	/* only changes the permanent state; the queued flash must stay */
+	memset(&cmd.led.temporary, 0, sizeof(cmd.led.temporary));
+	cmd.led.permanent.on_color = OSDP_LED_COLOR_BLUE;
+	osdp_cp_submit_command(env->cp, 0, &cmd);
+
+	env->num_cmds = 0;
+	test_cp_env_run(env, 300);
+
+	led = &env->cmds[0].led;
+	if (env->num_cmds != 1 || led->temporary.control_code != 2 ||
+	    led->temporary.on_color != OSDP_LED_COLOR_RED ||
+	    led->permanent.control_code != 1 ||
+	    led->permanent.on_color != OSDP_LED_COLOR_BLUE) {
+		printf(SUB_2 "unexpected LED state at the PD (%d cmds) "
+		       "temp:%d/%d perm:%d/%d\n", env->num_cmds,
+		       led->temporary.control_code, led->temporary.on_color,
+		       led->permanent.control_code, led->permanent.on_color);
+		return false;
+	}
+	return true;
+}
+
+static void submit_text(struct test_cp_env *env, int control_code,
+			const char *str)
+{
+	struct osdp_cmd cmd = {
+		.id = OSDP_CMD_TEXT,
+		.flags = OSDP_CMD_FLAG_COALESCE,
+		.text = {
+			.control_code = control_code,
+			.temp_time = 5,
+			.offset_row = 1,
+			.offset_col = 1,
+			.length = strlen(str),
+		},
+	};
+
+	memcpy(cmd.text.data, str, cmd.text.length);
+	osdp_cp_submit_command(env->cp, 0, &cmd);
+}
+
+static bool test_text_merge(struct test_cp_env *env)
+{
+	printf(SUB_2 "testing TEXT is only replaced by the same kind\n");
+
+	/* temporary text does not replace permanent text (or vice versa) */
+	submit_text(env, 1, "hello");
+	submit_text(env, 3, "alert");
+	/* this one covers all of the queued text */
+	submit_text(env, 3, "ALERT");
+	/* shorter text would leave the tail of the queued text on screen */
+	submit_text(env, 3, "hi");
+
+	env->num_cmds = 0;
+	test_cp_env_run(env, 300);
+
+	if (env->num_cmds != 3 ||
+	    memcmp(env->cmds[0].text.data, "hello", 5) ||
+	    memcmp(env->cmds[1].text.data, "ALERT", 5) ||
+	    memcmp(env->cmds[2].text.data, "hi", 2)) {
+		printf(SUB_2 "unexpected TEXT commands at the PD (%d)\n",
+		       env->num_cmds);
+		return false;
+	}
+	return true;
+}
+
+void run_cmd_coalesce_tests(struct test *t)
+{
+	bool result = false;
+	struct test_cp_env env = { 0 };
+
+	printf("\nBegin command coalescing tests\n");
+
+	if (test_cp_env_setup(t, &env, 1, NULL)) {
+		TEST_REPORT(t, false);
+		return;
+	}
+
+	if (!test_cp_env_wait_online(&env, 0, 5000)) {
+		printf(SUB_2 "PD failed to come online\n");
+	} else {
+		result = test_led_coalesce(&env);
+		result &= test_led_merge(&env);
+		result &= test_text_merge(&env);
+	}
+
+	test_cp_env_teardown(&env);
+
+	printf(SUB_1 "command coalescing tests %s\n",
+	       result ? "succeeded" : "failed");
+	TEST_REPORT(t, result);
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2025 Siddharth Chandrasekaran <sidcha.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <osdp.h>
+#include "test.h"
+
+static const struct osdp_cmd g_buzzer_cmd = {
+	.id = OSDP_CMD_BUZZER,
+	.buzzer = { .control_code = 1 },
+};
+
+static bool test_pd_quota(struct test_cp_env *env)
+{
+	int i, depth, headroom;
+
+	printf(SUB_2 "testing per-PD command quota\n");
+
+	/* the CP is not refreshed; submitted commands stay queued */
+	osdp_cp_set_command_quota(env->cp, 0, 6);
+	for (i = 0; i < 6; i++) {
+		if (osdp_cp_submit_command(env->cp, 0, &g_buzzer_cmd)) {
+			printf(SUB_2 "submit %d failed within quota\n", i);
+			return false;
+		}
+	}
+	if (osdp_cp_get_command_queue_status(env->cp, 0, &depth, &headroom) ||
+	    depth != 6 || headroom != 0 ||
+	    osdp_cp_submit_command(env->cp, 0, &g_buzzer_cmd) == 0) {
+		printf(SUB_2 "quota not enforced (depth:%d headroom:%d)\n",
+		       depth, headroom);
+		return false;
+	}
+	return true;
+}
+
+static bool test_pool_limit(struct test_cp_env *env)
+{
+	int depth, headroom;
+
+	printf(SUB_2 "testing shared pool limit\n");
+
+	/* shrink the pool below what is in use; flush makes room again */
+	osdp_cp_set_command_quota(env->cp, 0, 16);
+	osdp_cp_set_command_pool_size(env->cp, 4);
+	osdp_cp_get_command_queue_status(env->cp, 0, NULL, &headroom);
+	if (headroom != 0 ||
+	    osdp_cp_submit_command(env->cp, 0, &g_buzzer_cmd) == 0) {
+		printf(SUB_2 "pool limit not enforced\n");
+		return false;
+	}
+	osdp_cp_flush_commands(env->cp, 0);
+	osdp_cp_get_command_queue_status(env->cp, 0, &depth, &headroom);
+	if (depth != 0 || headroom != 4) {
+		printf(SUB_2 "unexpected status after flush %d/%d\n",
+		       depth, headroom);
+		return false;
+	}
+	return true;
+}
+
+static bool test_pool_release(struct test_cp_env *env)
+{
+	int i, depth, headroom;
+
+	printf(SUB_2 "testing pool slots are released once sent\n");
+
+	env->num_cmds = 0;
+	for (i = 0; i < 4; i++) {
+		osdp_cp_submit_command(env->cp, 0, &g_buzzer_cmd);
+	}
+	test_cp_env_run(env, 200);
+	osdp_cp_get_command_queue_status(env->cp, 0, &depth, &headroom);
+	if (env->num_cmds != 4 || depth != 0 || headroom != 4) {
+		printf(SUB_2 "PD got %d commands; status %d/%d\n",
+		       env->num_cmds, depth, headroom);
+		return false;
+	}
+	return true;
+}
+
+void run_cmd_pool_tests(struct test *t)
+{
+	bool result = false;
+	struct test_cp_env env = { 0 };
+
+	printf("\nBegin command pool tests\n");
+
+	if (test_cp_env_setup(t, &env, 1, NULL)) {
+		TEST_REPORT(t, false);
+		return;
+	}
+
+	if (!test_cp_env_wait_online(&env, 0, 5000)) {
+		printf(SUB_2 "PD failed to come online\n");
+	} else {
+		result = test_pd_quota(&env);
+		result &= test_pool_limit(&env);
+		result &= test_pool_release(&env);
+	}
+
+	test_cp_env_teardown(&env);
+
+	printf(SUB_1 "command pool tests %s\n",
+	       result ? "succeeded" : "failed");
+	TEST_REPORT(t, result);
+}
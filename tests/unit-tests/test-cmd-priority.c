@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2025 Siddharth Chandrasekaran <sidcha.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <osdp.h>
+#include "test.h"
+
+static int g_expired_cmd_id;
+
+static int test_prio_event_callback(void *arg, int pd, struct osdp_event *ev)
+{
+	ARG_UNUSED(arg);
+	ARG_UNUSED(pd);
+
+	if (ev->type == OSDP_EVENT_NOTIFICATION &&
+	    ev->notif.type == OSDP_EVENT_NOTIFICATION_COMMAND_EXPIRED) {
+		g_expired_cmd_id = ev->notif.arg0;
+	}
+	return 0;
+}
+
+static bool test_conflicting_priority(struct test_cp_env *env)
+{
+	struct osdp_cmd bad = {
+		.id = OSDP_CMD_LED,
+		.flags = OSDP_CMD_FLAG_PRIO_URGENT | OSDP_CMD_FLAG_PRIO_BACKGROUND,
+	};
+
+	printf(SUB_2 "testing conflicting priorities are rejected\n");
+
+	if (osdp_cp_submit_command(env->cp, 0, &bad) == 0) {
+		printf(SUB_2 "conflicting priorities accepted\n");
+		return false;
+	}
+	return true;
+}
+
+static bool test_priority_order(struct test_cp_env *env)
+{
+	int i, depth;
+	struct osdp_cmd cmd[] = {
+		{
+			.id = OSDP_CMD_LED,
+			.flags = OSDP_CMD_FLAG_PRIO_BACKGROUND,
+			.led.permanent = { .control_code = 1, .on_count = 1,
+					   .on_color = OSDP_LED_COLOR_GREEN },
+		},
+		{
+			.id = OSDP_CMD_TEXT,
+			.text = { .control_code = 1, .offset_row = 1,
+				  .offset_col = 1, .length = 2, .data = "hi" },
+		},
+		{
+			.id = OSDP_CMD_BUZZER,
+			.buzzer = { .control_code = 1 },
+			.ttl_ms = 1,
+		},
+		{
+			.id = OSDP_CMD_OUTPUT,
+			.flags = OSDP_CMD_FLAG_PRIO_URGENT,
+			.output = { .output_no = 0, .control_code = 1 },
+		},
+	};
+	const enum osdp_cmd_e expected[] = {
+		OSDP_CMD_OUTPUT, OSDP_CMD_TEXT, OSDP_CMD_LED
+	};
+
+	printf(SUB_2 "testing commands are sent in priority order\n");
+
+	/* queue everything before the CP gets to send any of it */
+	for (i = 0; i < (int)ARRAY_SIZE(cmd); i++) {
+		if (osdp_cp_submit_command(env->cp, 0, &cmd[i])) {
+			printf(SUB_2 "submit %d failed\n", i);
+			return false;
+		}
+	}
+	usleep(5 * 1000); /* let the BUZZER command expire */
+
+	env->num_cmds = 0;
+	g_expired_cmd_id = 0;
+	test_cp_env_run(env, 300);
+
+	if (env->num_cmds != (int)ARRAY_SIZE(expected)) {
+		printf(SUB_2 "PD got %d commands\n", env->num_cmds);
+		return false;
+	}
+	for (i = 0; i < (int)ARRAY_SIZE(expected); i++) {
+		if (env->cmds[i].id != expected[i]) {
+			printf(SUB_2 "expected cmd %d at %d; got %d\n",
+			       expected[i], i, env->cmds[i].id);
+			return false;
+		}
+	}
+	osdp_cp_get_command_queue_status(env->cp, 0, &depth, NULL);
+	if (g_expired_cmd_id != OSDP_CMD_BUZZER || depth != 0) {
+		printf(SUB_2 "expired command was not dropped\n");
+		return false;
+	}
+	return true;
+}
+
+void run_cmd_priority_tests(struct test *t)
+{
+	bool result = false;
+	struct test_cp_env env = {
+		.flags = OSDP_FLAG_ENABLE_NOTIFICATION,
+	};
+
+	printf("\nBegin command priority tests\n");
+
+	if (test_cp_env_setup(t, &env, 1, NULL)) {
+		TEST_REPORT(t, false);
+		return;
+	}
+	osdp_cp_set_event_callback(env.cp, test_prio_event_callback, NULL);
+
+	if (!test_cp_env_wait_online(&env, 0, 5000)) {
+		printf(SUB_2 "PD failed to come online\n");
+	} else {
+		result = test_conflicting_priority(&env);
+		result &= test_priority_order(&env);
+	}
+
+	test_cp_env_teardown(&env);
+
+	printf(SUB_1 "command priority tests %s\n",
+	       result ? "succeeded" : "failed");
+	TEST_REPORT(t, result);
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2025 Siddharth Chandrasekaran <sidcha.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <osdp.h>
+#include "test.h"
+
+#define TEST_SUBMIT_THREADS     4
+#define TEST_SUBMIT_PER_THREAD  100
+
+static void *test_submit_thread(void *arg)
+{
+	struct test_cp_env *env = arg;
+	struct osdp_cmd cmd = {
+		.id = OSDP_CMD_BUZZER,
+		.buzzer = { .control_code = 1 },
+	};
+	int n = 0;
+
+	while (n < TEST_SUBMIT_PER_THREAD) {
+		if (osdp_cp_submit_command(env->cp, 0, &cmd) == 0) {
+			n++;
+		} else {
+			sched_yield(); /* ring or quota full; let it drain */
+		}
+	}
+	return NULL;
+}
+
+static bool test_concurrent_submit(struct test_cp_env *env)
+{
+	int i, depth, headroom, start_headroom;
+	int expected = TEST_SUBMIT_THREADS * TEST_SUBMIT_PER_THREAD;
+	int64_t start;
+	pthread_t threads[TEST_SUBMIT_THREADS];
+
+	printf(SUB_2 "testing commands from %d threads reach the PD\n",
+	       TEST_SUBMIT_THREADS);
+
+	osdp_cp_get_command_queue_status(env->cp, 0, NULL, &start_headroom);
+
+	/* app threads submit while this thread refreshes the CP and PD */
+	env->num_cmds = 0;
+	for (i = 0; i < TEST_SUBMIT_THREADS; i++) {
+		pthread_create(&threads[i], NULL, test_submit_thread, env);
+	}
+	start = osdp_millis_now();
+	while (env->num_cmds < expected && osdp_millis_since(start) < 20000) {
+		test_cp_env_refresh(env);
+	}
+	for (i = 0; i < TEST_SUBMIT_THREADS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	test_cp_env_run(env, 50);
+
+	osdp_cp_get_command_queue_status(env->cp, 0, &depth, &headroom);
+	if (env->num_cmds != expected || depth != 0 ||
+	    headroom != start_headroom) {
+		printf(SUB_2 "PD got %d/%d commands; status %d/%d\n",
+		       env->num_cmds, expected, depth, headroom);
+		return false;
+	}
+	return true;
+}
+
+void run_cmd_submit_tests(struct test *t)
+{
+	bool result = false;
+	struct test_cp_env env = { 0 };
+
+	printf("\nBegin concurrent submission tests\n");
+
+	if (test_cp_env_setup(t, &env, 1, NULL)) {
+		TEST_REPORT(t, false);
+		return;
+	}
+
+	if (!test_cp_env_wait_online(&env, 0, 5000)) {
+		printf(SUB_2 "PD failed to come online\n");
+	} else {
+		/* producers are expected to hit a full ring; don't log each */
+		osdp_logger_init("osdp::cp", LOG_EMERG, NULL);
+		result = test_concurrent_submit(&env);
+		osdp_logger_init("osdp::cp", t->loglevel, NULL);
+	}
+
+	test_cp_env_teardown(&env);
+
+	printf(SUB_1 "concurrent submission tests %s\n",
+	       result ? "succeeded" : "failed");
+	TEST_REPORT(t, result);
+}
@@ -237,6 +237,38 @@ static bool test_led_command()
 	return wait_for_command(OSDP_CMD_LED, 5);
 }
 
+static bool test_batch_command()
+{
+	printf(SUB_2 "testing batch command submission\n");
+	reset_test_state();
+
+	uint8_t pd_mask[1] = { 0x01 };
+	struct osdp_cmd cmd = {
+		.id = OSDP_CMD_BUZZER,
+		.buzzer = {
+			.control_code = 1,
+			.on_count = 10,
+			.off_count = 10,
+			.reader = 0,
+			.rep_count = 1,
+		},
+	};
+
+	cmd.flags = OSDP_CMD_FLAG_BROADCAST;
+	if (osdp_cp_submit_command_batch(g_test_ctx.cp_ctx, pd_mask, &cmd) != -1) {
+		printf(SUB_2 "Batch submission with flags was accepted\n");
+		return false;
+	}
+
+	cmd.flags = 0;
+	if (osdp_cp_submit_command_batch(g_test_ctx.cp_ctx, pd_mask, &cmd) != 1) {
+		printf(SUB_2 "Failed to submit batch command\n");
+		return false;
+	}
+
+	return wait_for_command(OSDP_CMD_BUZZER, 5);
+}
+
 static bool test_output_command()
 {
 	printf(SUB_2 "testing output command\n");
@@ -478,6 +510,7 @@ void run_command_tests(struct test *t)
 	overall_result &= test_led_command();
 	overall_result &= test_led_permanent_command();
 	overall_result &= test_output_command();
+	overall_result &= test_batch_command();
 	overall_result &= test_text_command();
 	overall_result &= test_keyset_command();
 	overall_result &= test_mfg_command_simple();
@@ -111,11 +111,115 @@ void test_cp_fsm_teardown(struct test *t)
 	osdp_cp_teardown(t->mock_data);
 }
 
+static bool test_cp_capture_writer(struct osdp *ctx)
+{
+	int i, num_epb = 0;
+	bool result = true;
+	uint32_t block[2];
+	uint8_t data[OSDP_PACKET_BUF_SIZE + 64], *pkt;
+	const uint8_t poll_id = 0x60;
+	struct osdp_capture_config config = {
+		.path = "osdp-test-capture",
+		.max_file_size = 0,
+		.max_file_age_sec = 0,
+	};
+	FILE *f;
+
+	if (osdp_capture_start(ctx, &config) != 0) {
+		if (IS_ENABLED(OPT_OSDP_CAPTURE_WRITER)) {
+			printf(SUB_2 "failed to start capture\n");
+			return false;
+		}
+		printf(SUB_2 "capture writer not built; skipping\n");
+		return true;
+	}
+	if (osdp_capture_start(ctx, &config) == 0 ||
+	    osdp_capture_set_filter(ctx, 0, &poll_id, 1) != 0) {
+		printf(SUB_2 "unexpected capture API behaviour\n");
+		osdp_capture_stop(ctx);
+		return false;
+	}
+	for (i = 0; i < 100; i++) {
+		test_state_update(GET_CURRENT_PD(ctx));
+		usleep(1000);
+	}
+	osdp_capture_stop(ctx);
+	if (osdp_capture_enable(ctx, 0, true) == 0) {
+		printf(SUB_2 "capture still enabled after stop\n");
+		return false;
+	}
+
+	/* Only the POLL commands were captured (replies are filtered out) */
+	f = fopen("osdp-test-capture-0.pcapng", "rb");
+	if (f == NULL) {
+		printf(SUB_2 "capture file not found\n");
+		return false;
+	}
+	while (result && fread(block, sizeof(uint32_t), 2, f) == 2) {
+		if (block[1] < 12 || block[1] - 8 > sizeof(data) ||
+		    fread(data, 1, block[1] - 8, f) != block[1] - 8) {
+			result = false;
+			break;
+		}
+		if (block[0] != 6) {
+			continue;
+		}
+		/* EPB data after 5 words; skip mark byte and 5 byte header */
+		pkt = data + 20 + (data[20] == 0xFF);
+		if (pkt[5] != poll_id) {
+			printf(SUB_2 "unexpected ID %02x in capture\n", pkt[5]);
+			result = false;
+		}
+		num_epb++;
+	}
+	fclose(f);
+	remove("osdp-test-capture-0.pcapng");
+	if (num_epb == 0) {
+		printf(SUB_2 "no packets in capture file\n");
+		result = false;
+	}
+	return result;
+}
+
+static int test_recorder_len;
+
+static void test_recorder_callback(void *arg, int pd, int trigger,
+				   const uint8_t *buf, int len)
+{
+	ARG_UNUSED(arg);
+	ARG_UNUSED(buf);
+
+	if (pd == 0 && trigger == OSDP_FLIGHT_RECORDER_SC_FAILURE) {
+		test_recorder_len = len;
+	}
+}
+
+static uint32_t test_recorder_caplen(struct osdp_pd *pd)
+{
+	int i;
+	uint32_t sum = 0;
+
+	for (i = 0; i < OSDP_FLIGHT_RECORDER_DEPTH; i++) {
+		sum += (pd->recorder.entry[i].len < OSDP_FLIGHT_RECORDER_SNAPLEN) ?
+			pd->recorder.entry[i].len : OSDP_FLIGHT_RECORDER_SNAPLEN;
+	}
+	return sum;
+}
+
 void run_cp_fsm_tests(struct test *t)
 {
-	int result = true;
+	int result = true, deadline;
 	uint32_t count = 0;
+	uint8_t status;
 	struct osdp *ctx;
+	struct osdp_pd *pd;
+	struct osdp_pd_id id;
+	struct osdp_pd_snapshot snapshot;
+	struct osdp_pd_stats stats;
+	struct osdp_cmd_latency latency;
+	uint8_t pcap[OSDP_FLIGHT_RECORDER_PCAP_MAX];
+	uint32_t magic;
+	int len;
 
 	printf("\nStarting CP Phy state tests\n");
 
@@ -141,6 +245,176 @@ void run_cp_fsm_tests(struct test *t)
 
 	TEST_REPORT(t, result);
 
+	printf(SUB_1 "checking adaptive poll interval\n");
+	result = true;
+	pd = GET_CURRENT_PD(ctx);
+	if (pd->poll_ms <= OSDP_PD_POLL_TIMEOUT_MS) {
+		printf(SUB_2 "quiet PD was not backed off (%u ms)\n",
+		       pd->poll_ms);
+		result = false;
+	}
+	if (osdp_cp_set_poll_interval(ctx, 0, 100, 50) == 0 ||
+	    osdp_cp_set_poll_interval(ctx, 0, 20, 400) != 0 ||
+	    pd->poll_ms != 20 || pd->poll_max_ms != 400) {
+		printf(SUB_2 "osdp_cp_set_poll_interval() failed\n");
+		result = false;
+	}
+	printf(SUB_1 "adaptive poll test %s\n",
+	       result ? "succeeded" : "failed");
+
+	TEST_REPORT(t, result);
+
+	printf(SUB_1 "checking reply turnaround estimate\n");
+	result = true;
+	if (pd->srtt < 0 || (pd->srtt >> 3) > OSDP_RESP_TOUT_MIN_MS) {
+		printf(SUB_2 "unexpected srtt %d (x8) rttvar %d (x4)\n",
+		       pd->srtt, pd->rttvar);
+		result = false;
+	}
+	printf(SUB_1 "reply turnaround test %s\n",
+	       result ? "succeeded" : "failed");
+
+	TEST_REPORT(t, result);
+
+	printf(SUB_1 "checking PD protocol counters\n");
+	result = true;
+	if (osdp_get_pd_stats(ctx, 0, &stats, true) != 0 ||
+	    stats.tx_packets == 0 || stats.rx_packets != stats.tx_packets ||
+	    stats.tx_bytes < 8 * stats.tx_packets ||
+	    stats.rx_bytes < 8 * stats.rx_packets ||
+	    stats.crc_errors || stats.checksum_errors || stats.timeouts) {
+		printf(SUB_2 "unexpected counters tx:%u/%u rx:%u/%u "
+		       "crc:%u cksum:%u tout:%u\n", stats.tx_packets,
+		       stats.tx_bytes, stats.rx_packets, stats.rx_bytes,
+		       stats.crc_errors, stats.checksum_errors, stats.timeouts);
+		result = false;
+	}
+	osdp_get_pd_stats(ctx, 0, &stats, false);
+	if (stats.tx_packets || stats.rx_bytes ||
+	    osdp_get_pd_stats(ctx, 1, &stats, false) == 0) {
+		printf(SUB_2 "counters were not reset\n");
+		result = false;
+	}
+	printf(SUB_1 "PD protocol counters test %s\n",
+	       result ? "succeeded" : "failed");
+
+	TEST_REPORT(t, result);
+
+	printf(SUB_1 "checking packet flight recorder\n");
+	result = true;
+	len = osdp_get_flight_recorder(ctx, 0, pcap, sizeof(pcap));
+	memcpy(&magic, pcap, sizeof(magic));
+	count = pd->recorder.count;
+	if (count > OSDP_FLIGHT_RECORDER_DEPTH) {
+		count = OSDP_FLIGHT_RECORDER_DEPTH;
+	}
+	if (count < 2 || magic != 0xa1b2c3d4 ||
+	    len != 24 + (int)(count * 16 + test_recorder_caplen(pd))) {
+		printf(SUB_2 "unexpected recorder image len:%d magic:%08x n:%u\n",
+		       len, magic, pd->recorder.count);
+		result = false;
+	}
+	if (osdp_get_flight_recorder(ctx, 0, pcap, 24) != -1) {
+		printf(SUB_2 "recorder overflowed a short buffer\n");
+		result = false;
+	}
+	test_recorder_len = 0;
+	osdp_set_flight_recorder_callback(ctx, test_recorder_callback, NULL);
+	osdp_flight_recorder_trigger(pd, OSDP_FLIGHT_RECORDER_SC_FAILURE);
+	osdp_set_flight_recorder_callback(ctx, NULL, NULL);
+	osdp_flight_recorder_trigger(pd, OSDP_FLIGHT_RECORDER_PD_OFFLINE);
+	if (test_recorder_len != len) {
+		printf(SUB_2 "recorder callback got %d bytes\n",
+		       test_recorder_len);
+		result = false;
+	}
+	printf(SUB_1 "packet flight recorder test %s\n",
+	       result ? "succeeded" : "failed");
+
+	TEST_REPORT(t, result);
+
+	printf(SUB_1 "checking capture writer\n");
+	result = test_cp_capture_writer(ctx);
+	printf(SUB_1 "capture writer test %s\n",
+	       result ? "succeeded" : "failed");
+
+	TEST_REPORT(t, result);
+
+	printf(SUB_1 "checking command latency histograms\n");
+	result = true;
+	if (osdp_cp_get_cmd_latency(ctx, 0, OSDP_CMD_LATENCY_POLL,
+				    &latency) != 0 ||
+	    latency.count == 0 || latency.p50_ms > latency.p99_ms ||
+	    latency.p99_ms > latency.max_ms) {
+		printf(SUB_2 "unexpected POLL latency n:%u %u/%u/%u ms\n",
+		       latency.count, latency.p50_ms, latency.p99_ms,
+		       latency.max_ms);
+		result = false;
+	}
+	if (osdp_cp_get_cmd_latency(ctx, 0, OSDP_CMD_LATENCY_FILE_TX,
+				    &latency) != 0 || latency.count != 0 ||
+	    osdp_cp_get_cmd_latency(ctx, 0, OSDP_CMD_LATENCY_SENTINEL,
+				    &latency) == 0 ||
+	    osdp_cp_set_slow_cmd_threshold(ctx, 0, -1) == 0 ||
+	    osdp_cp_set_slow_cmd_threshold(ctx, 0, 0) != 0) {
+		printf(SUB_2 "unexpected latency API behaviour\n");
+		result = false;
+	}
+	printf(SUB_1 "command latency histograms test %s\n",
+	       result ? "succeeded" : "failed");
+
+	TEST_REPORT(t, result);
+
+	printf(SUB_1 "checking PD state snapshot\n");
+	result = true;
+	osdp_cp_refresh(ctx);
+	osdp_get_status_mask(ctx, &status);
+	osdp_cp_get_pd_id(ctx, 0, &id);
+	if (osdp_cp_get_pd_snapshot(ctx, 0, &snapshot) != 0 ||
+	    !snapshot.online || !snapshot.enabled || snapshot.sc_active ||
+	    snapshot.version == 0 || snapshot.last_seen_ms < 0 ||
+	    status != 0x01) {
+		printf(SUB_2 "unexpected state v%u %d/%d/%d %d ms mask:%02x\n",
+		       snapshot.version, snapshot.online, snapshot.enabled,
+		       snapshot.sc_active, snapshot.last_seen_ms, status);
+		result = false;
+	}
+	if (snapshot.id.vendor_code != 0xa3a2a1 ||
+	    snapshot.id.serial_number != 0xd4d3d2d1 ||
+	    memcmp(&id, &snapshot.id, sizeof(id)) != 0 ||
+	    snapshot.cap[OSDP_PD_CAP_READER_LED_CONTROL].compliance_level != 4 ||
+	    snapshot.cap[OSDP_PD_CAP_READER_LED_CONTROL].num_items != 1) {
+		printf(SUB_2 "unexpected ID/capabilities in snapshot\n");
+		result = false;
+	}
+	printf(SUB_1 "PD state snapshot test %s\n",
+	       result ? "succeeded" : "failed");
+
+	TEST_REPORT(t, result);
+
+	printf(SUB_1 "checking osdp_cp_next_deadline_ms()\n");
+	result = true;
+	osdp_cp_refresh(ctx);
+	deadline = osdp_cp_next_deadline_ms(ctx);
+	if (deadline < 0 || deadline > (int)pd->poll_max_ms + 1) {
+		printf(SUB_2 "unexpected online deadline %d\n", deadline);
+		result = false;
+	}
+	osdp_cp_disable_pd(ctx, 0);
+	count = 0;
+	while (osdp_cp_is_pd_enabled(ctx, 0) && count++ < 300) {
+		osdp_cp_refresh(ctx);
+		usleep(1000);
+	}
+	deadline = osdp_cp_next_deadline_ms(ctx);
+	if (deadline != -1) {
+		printf(SUB_2 "unexpected disabled deadline %d\n", deadline);
+		result = false;
+	}
+	printf(SUB_1 "next deadline test %s\n", result ? "succeeded" : "failed");
+
+	TEST_REPORT(t, result);
+
 	test_cp_fsm_teardown(t);
 }
 
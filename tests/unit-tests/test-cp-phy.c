@@ -169,7 +169,7 @@ int test_phy_decode_packet_ack(struct osdp *ctx)
 		return -1;
 	}
 
-	osdp_rb_push_buf(&p->rx_rb, packet, pkt_len);
+	osdp_rb_push_buf(&p->chn_buf->rx_rb, packet, pkt_len);
 	err = osdp_phy_check_packet(p);
 	if (err) {
 		printf("check failed with error %d!\n", err);
@@ -220,7 +220,7 @@ int test_phy_decode_packet_ignore_leading_mark_bytes(struct osdp *ctx)
 		packet[i] = 0xff;
 	}
 
-	osdp_rb_push_buf(&p->rx_rb, packet, 8 + pkt_len + 8);
+	osdp_rb_push_buf(&p->chn_buf->rx_rb, packet, 8 + pkt_len + 8);
 	err = osdp_phy_check_packet(p);
 	if (err) {
 		printf("check failed with error %d!\n", err);
@@ -323,7 +323,7 @@ int test_phy_decode_packet_nak(struct osdp *ctx)
 		return -1;
 	}
 
-	osdp_rb_push_buf(&p->rx_rb, packet, pkt_len);
+	osdp_rb_push_buf(&p->chn_buf->rx_rb, packet, pkt_len);
 	err = osdp_phy_check_packet(p);
 	if (err) {
 		printf("check failed with error %d!\n", err);
@@ -358,7 +358,7 @@ int test_phy_decode_packet_busy(struct osdp *ctx)
 		return -1;
 	}
 
-	osdp_rb_push_buf(&p->rx_rb, packet, pkt_len);
+	osdp_rb_push_buf(&p->chn_buf->rx_rb, packet, pkt_len);
 	err = osdp_phy_check_packet(p);
 	if (err != OSDP_ERR_PKT_BUSY) {
 		printf("failed! Expected BUSY error\n");
@@ -381,7 +381,7 @@ int test_phy_decode_packet_invalid_checksum(struct osdp *ctx)
 	};
 
 	printf(SUB_1 "Testing phy_decode_packet with invalid checksum -- ");
-	osdp_rb_push_buf(&p->rx_rb, packet, sizeof(packet));
+	osdp_rb_push_buf(&p->chn_buf->rx_rb, packet, sizeof(packet));
 	err = osdp_phy_check_packet(p);
 	if (err != OSDP_ERR_PKT_FMT) {
 		printf("failed! Expected format error\n");
@@ -404,7 +404,7 @@ int test_phy_decode_packet_invalid_crc(struct osdp *ctx)
 	};
 
 	printf(SUB_1 "Testing phy_decode_packet with invalid CRC -- ");
-	osdp_rb_push_buf(&p->rx_rb, packet, sizeof(packet));
+	osdp_rb_push_buf(&p->chn_buf->rx_rb, packet, sizeof(packet));
 	err = osdp_phy_check_packet(p);
 	if (err != OSDP_ERR_PKT_FMT) {
 		printf("failed! Expected format error\n");
@@ -431,7 +431,7 @@ int test_phy_decode_packet_wrong_address(struct osdp *ctx)
 		return -1;
 	}
 
-	osdp_rb_push_buf(&p->rx_rb, packet, pkt_len);
+	osdp_rb_push_buf(&p->chn_buf->rx_rb, packet, pkt_len);
 	err = osdp_phy_check_packet(p);
 	if (err != OSDP_ERR_PKT_CHECK) {
 		printf("failed! Expected address check error\n");
@@ -462,7 +462,7 @@ int test_phy_decode_packet_sequence_mismatch(struct osdp *ctx)
 		return -1;
 	}
 
-	osdp_rb_push_buf(&p->rx_rb, packet, pkt_len);
+	osdp_rb_push_buf(&p->chn_buf->rx_rb, packet, pkt_len);
 	err = osdp_phy_check_packet(p);
 	if (err != OSDP_ERR_PKT_NACK) {
 		printf("failed! Expected OSDP_ERR_PKT_NACK, got %d\n", err);
@@ -485,7 +485,7 @@ int test_phy_decode_packet_invalid_som(struct osdp *ctx)
 	};
 
 	printf(SUB_1 "Testing phy_decode_packet with invalid SOM -- ");
-	osdp_rb_push_buf(&p->rx_rb, packet, sizeof(packet));
+	osdp_rb_push_buf(&p->chn_buf->rx_rb, packet, sizeof(packet));
 	err = osdp_phy_check_packet(p);
 	/* Invalid SOM can trigger various errors: format, wait, or no_data */
 	if (err != OSDP_ERR_PKT_FMT && err != OSDP_ERR_PKT_WAIT && err != OSDP_ERR_PKT_NO_DATA) {
@@ -519,7 +519,7 @@ int test_phy_decode_packet_broadcast(struct osdp *ctx)
 		return -1;
 	}
 
-	osdp_rb_push_buf(&p->rx_rb, packet, pkt_len);
+	osdp_rb_push_buf(&p->chn_buf->rx_rb, packet, pkt_len);
 	err = osdp_phy_check_packet(p);
 
 	/* For broadcast packets, OSDP_ERR_PKT_WAIT might be expected behavior */
@@ -572,7 +572,7 @@ int test_phy_packet_too_large(struct osdp *ctx)
 	};
 
 	printf(SUB_1 "Testing phy_decode_packet with oversized length -- ");
-	osdp_rb_push_buf(&p->rx_rb, packet, sizeof(packet));
+	osdp_rb_push_buf(&p->chn_buf->rx_rb, packet, sizeof(packet));
 	err = osdp_phy_check_packet(p);
 	if (err != OSDP_ERR_PKT_WAIT) {
 		printf("failed! Expected wait for re-scan\n");
@@ -595,7 +595,7 @@ int test_phy_packet_too_small(struct osdp *ctx)
 	};
 
 	printf(SUB_1 "Testing phy_decode_packet with undersized length -- ");
-	osdp_rb_push_buf(&p->rx_rb, packet, sizeof(packet));
+	osdp_rb_push_buf(&p->chn_buf->rx_rb, packet, sizeof(packet));
 	err = osdp_phy_check_packet(p);
 	/* Undersized packets might trigger wait for re-scan or format error */
 	if (err != OSDP_ERR_PKT_WAIT && err != OSDP_ERR_PKT_FMT) {
@@ -784,15 +784,15 @@ int test_phy_state_reset_functionality(struct osdp *ctx)
 	printf(SUB_1 "Testing PHY state reset functionality -- ");
 
 	/* Simulate some packet state */
-	p->packet_buf_len = 10;
-	p->packet_len = 20;
+	p->chn_buf->packet_buf_len = 10;
+	p->chn_buf->packet_len = 20;
 	p->phy_state = 5;
 
 	/* Reset state */
 	osdp_phy_state_reset(p, true);
 
 	/* Verify reset */
-	if (p->packet_buf_len != 0 || p->packet_len != 0 || p->phy_state != 0) {
+	if (p->chn_buf->packet_buf_len != 0 || p->chn_buf->packet_len != 0 || p->phy_state != 0) {
 		printf("failed! State not properly reset\n");
 		return -1;
 	}
@@ -801,6 +801,402 @@ int test_phy_state_reset_functionality(struct osdp *ctx)
 	return 0;
 }
 
+int test_rb_views(struct osdp *ctx)
+{
+	struct osdp_rb rb = { 0 };
+	uint8_t in[64], out[64], tmp[64], *ptr;
+	int i, len, size = sizeof(rb.buffer);
+
+	ARG_UNUSED(ctx);
+	printf(SUB_1 "Testing ring buffer views and wrap around -- ");
+
+	for (i = 0; i < (int)sizeof(in); i++) {
+		in[i] = (uint8_t)i;
+	}
+
+	/* park head/tail near the end so the data below wraps around */
+	rb.head = rb.tail = size - 10;
+	if (osdp_rb_push_buf(&rb, in, 40) != 40 || osdp_rb_len(&rb) != 40) {
+		printf("push_buf failed!\n");
+		return -1;
+	}
+	if (osdp_rb_read_view(&rb, 0, &ptr) != 10 || ptr[0] != 0 ||
+	    osdp_rb_read_view(&rb, 10, &ptr) != 30 || ptr[0] != 10) {
+		printf("read_view failed!\n");
+		return -1;
+	}
+	if (osdp_rb_peek(&rb, 12, tmp, 8) != rb.buffer + 2 ||
+	    osdp_rb_peek(&rb, 0, tmp, 40) != tmp ||
+	    memcmp(tmp, in, 40) != 0 ||
+	    osdp_rb_peek(&rb, 1, tmp, 40) != NULL) {
+		printf("peek failed!\n");
+		return -1;
+	}
+	len = osdp_rb_write_view(&rb, 0, &ptr);
+	if (ptr != rb.buffer + 30 || len != size - 10 - 30 - 1 ||
+	    osdp_rb_write_view(&rb, len, &ptr) != 0) {
+		printf("write_view failed!\n");
+		return -1;
+	}
+	osdp_rb_consume(&rb, 5);
+	if (osdp_rb_pop_buf(&rb, out, sizeof(out)) != 35 ||
+	    memcmp(out, in + 5, 35) != 0 || osdp_rb_len(&rb) != 0) {
+		printf("pop_buf failed!\n");
+		return -1;
+	}
+
+	/* a full ring leaves one slot free */
+	rb.head = rb.tail = 0;
+	for (i = 0; i < size / (int)sizeof(in); i++) {
+		osdp_rb_push_buf(&rb, in, sizeof(in));
+	}
+	if (osdp_rb_len(&rb) != size - 1 ||
+	    osdp_rb_write_view(&rb, 0, &ptr) != 0 || osdp_rb_push(&rb, 0) == 0) {
+		printf("full ring check failed!\n");
+		return -1;
+	}
+
+	printf("success!\n");
+	return 0;
+}
+
+int test_phy_decode_packet_wrapped(struct osdp *ctx)
+{
+	uint8_t *buf;
+	int len, err, pkt_len;
+	struct osdp_pd *p = GET_CURRENT_PD(ctx);
+	struct osdp_rb *rb = &p->chn_buf->rx_rb;
+	reset_pd_packet_state(p);
+	uint8_t reply_data[] = { REPLY_ACK };
+	uint8_t packet[32];
+	uint8_t expected[] = { REPLY_ACK };
+
+	printf(SUB_1 "Testing phy_decode_packet with a wrapped packet -- ");
+
+	SET_FLAG(p, PD_FLAG_SKIP_SEQ_CHECK);
+	pkt_len = test_osdp_create_packet(0xe5, 0x05, reply_data, 1,
+					  packet, sizeof(packet));
+
+	/* packet straddles the end of the ring; header itself is split */
+	rb->head = rb->tail = sizeof(rb->buffer) - 3;
+	osdp_rb_push_buf(rb, packet, pkt_len);
+	err = osdp_phy_check_packet(p);
+	CLEAR_FLAG(p, PD_FLAG_SKIP_SEQ_CHECK);
+	if (err) {
+		printf("check failed with error %d!\n", err);
+		return -1;
+	}
+	if (p->chn_buf->rx_pkt != p->chn_buf->packet_buf) {
+		printf("expected a stitched copy!\n");
+		return -1;
+	}
+	if ((len = osdp_phy_decode_packet(p, &buf)) < 0) {
+		printf("decode failed!\n");
+		return -1;
+	}
+	CHECK_ARRAY(buf, len, expected);
+
+	/* reset must hand the packet's bytes back to the ring */
+	osdp_phy_state_reset(p, false);
+	if (osdp_rb_len(rb) != 0) {
+		printf("ring not drained after reset!\n");
+		return -1;
+	}
+	printf("success!\n");
+	return 0;
+}
+
+int test_phy_resync_after_noise(struct osdp *ctx)
+{
+	int i, err, pkt_len, len = 0;
+	struct osdp_pd *p = GET_CURRENT_PD(ctx);
+	struct osdp_rb *rb = &p->chn_buf->rx_rb;
+	reset_pd_packet_state(p);
+	uint8_t reply_data[] = { REPLY_ACK };
+	uint8_t stream[256];
+	uint32_t skipped;
+
+	printf(SUB_1 "Testing phy resync over noise with false SoMs -- ");
+
+	/**
+	 * 40 groups of a SoM with a bogus header (CP expects the PD address
+	 * to have MSB set) and 4 noise bytes. The 0xff at the end of each
+	 * group doubles as a MARK for the next false SoM.
+	 */
+	for (i = 0; i < 40; i++) {
+		stream[len++] = 0x53;
+		stream[len++] = 0x01;
+		stream[len++] = 0x02;
+		stream[len++] = 0x03;
+		stream[len++] = 0x04;
+		stream[len++] = 0xff;
+	}
+	pkt_len = test_osdp_create_packet(0xe5, 0x05, reply_data, 1,
+					  stream + len, sizeof(stream) - len);
+	len += pkt_len;
+
+	rb->head = rb->tail = 0;
+	p->chn_buf->packet_scan_skip = 0;
+	skipped = p->stats.scan_skip_bytes;
+	osdp_rb_push_buf(rb, stream, len);
+
+	SET_FLAG(p, PD_FLAG_SKIP_SEQ_CHECK);
+	err = osdp_phy_check_packet(p);
+	CLEAR_FLAG(p, PD_FLAG_SKIP_SEQ_CHECK);
+	if (err) {
+		printf("check failed with error %d!\n", err);
+		return -1;
+	}
+	skipped = p->stats.scan_skip_bytes - skipped;
+	if (skipped != 40 * 4) {
+		printf("expected %d skipped bytes; got %u\n", 40 * 4, skipped);
+		return -1;
+	}
+	osdp_phy_state_reset(p, false);
+	if (osdp_rb_len(rb) != 0) {
+		printf("ring not drained!\n");
+		return -1;
+	}
+	printf("success!\n");
+	return 0;
+}
+
+static uint16_t test_crc16_bitwise(const uint8_t *buf, int len)
+{
+	uint16_t crc = 0x1D0F;
+	int i, j;
+
+	for (i = 0; i < len; i++) {
+		crc ^= (uint16_t)buf[i] << 8;
+		for (j = 0; j < 8; j++) {
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+		}
+	}
+	return crc;
+}
+
+int test_crc16_engine(struct osdp *ctx)
+{
+	uint8_t buf[300];
+	uint16_t crc;
+	int i, len, split;
+
+	ARG_UNUSED(ctx);
+	printf(SUB_1 "Testing CRC-16 engine against bitwise reference -- ");
+
+	for (i = 0; i < (int)sizeof(buf); i++) {
+		buf[i] = (uint8_t)(i * 167 + 13);
+	}
+
+	for (len = 0; len <= (int)sizeof(buf); len++) {
+		crc = test_crc16_bitwise(buf, len);
+		if (test_osdp_compute_crc16(buf, len) != crc) {
+			printf("one-shot mismatch at len %d\n", len);
+			return -1;
+		}
+		/* streaming in two chunks must give the same result */
+		split = len / 3;
+		if (osdp_crc16_update(osdp_compute_crc16(buf, split),
+				      buf + split, len - split) != crc) {
+			printf("streaming mismatch at len %d\n", len);
+			return -1;
+		}
+	}
+
+	printf("success!\n");
+	return 0;
+}
+
+int test_phy_check_packet_streaming(struct osdp *ctx)
+{
+	int i, n, err = OSDP_ERR_PKT_NO_DATA, pkt_len;
+	struct osdp_pd *p = GET_CURRENT_PD(ctx);
+	struct osdp_rb *rb = &p->chn_buf->rx_rb;
+	uint8_t reply_data[] = { REPLY_PDID, 0x01, 0x02, 0x03, 0x04, 0x05,
+				 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c };
+	uint8_t packet[64];
+
+	printf(SUB_1 "Testing phy_check_packet with byte by byte arrival -- ");
+
+	/* once with CRC and once with checksum; packet wraps the ring */
+	for (i = 0; i < 2; i++) {
+		reset_pd_packet_state(p);
+		pkt_len = test_osdp_create_packet(0xe5, i == 0 ? 0x05 : 0x01,
+						  reply_data, sizeof(reply_data),
+						  packet, sizeof(packet));
+		rb->head = rb->tail = sizeof(rb->buffer) - 7;
+		SET_FLAG(p, PD_FLAG_SKIP_SEQ_CHECK);
+		for (n = 0; n < pkt_len; n++) {
+			osdp_rb_push(rb, packet[n]);
+			err = osdp_phy_check_packet(p);
+			if (n < pkt_len - 1 && err != OSDP_ERR_PKT_WAIT &&
+			    err != OSDP_ERR_PKT_NO_DATA) {
+				break;
+			}
+		}
+		CLEAR_FLAG(p, PD_FLAG_SKIP_SEQ_CHECK);
+		if (err != OSDP_ERR_PKT_NONE) {
+			printf("failed at byte %d/%d (%s) err:%d\n", n, pkt_len,
+			       i == 0 ? "crc" : "checksum", err);
+			return -1;
+		}
+
+		/* a corrupted byte must still be caught */
+		reset_pd_packet_state(p);
+		packet[pkt_len - 4] ^= 0x10;
+		osdp_rb_push_buf(rb, packet, pkt_len);
+		err = osdp_phy_check_packet(p);
+		if (err != OSDP_ERR_PKT_FMT) {
+			printf("corruption not detected (%s)\n",
+			       i == 0 ? "crc" : "checksum");
+			return -1;
+		}
+	}
+	reset_pd_packet_state(p);
+	printf("success!\n");
+	return 0;
+}
+
+static struct {
+	uint8_t buf[64];
+	int len;
+	int calls;
+	int iovcnt;
+} test_recvv_data;
+
+static int test_recvv_fn(void *data, const struct osdp_iovec *iov, int iovcnt)
+{
+	int i, n, total = 0;
+
+	ARG_UNUSED(data);
+	test_recvv_data.calls++;
+	test_recvv_data.iovcnt = iovcnt;
+	for (i = 0; i < iovcnt && total < test_recvv_data.len; i++) {
+		n = test_recvv_data.len - total;
+		if (n > iov[i].len)
+			n = iov[i].len;
+		memcpy(iov[i].buf, test_recvv_data.buf + total, n);
+		total += n;
+	}
+	test_recvv_data.len = 0;
+	return total;
+}
+
+int test_phy_channel_recvv(struct osdp *ctx)
+{
+	uint8_t *buf;
+	int len, err;
+	struct osdp_pd *p = GET_CURRENT_PD(ctx);
+	struct osdp_rb *rb = &p->chn_buf->rx_rb;
+	reset_pd_packet_state(p);
+	uint8_t reply_data[] = { REPLY_ACK };
+	uint8_t expected[] = { REPLY_ACK };
+
+	printf(SUB_1 "Testing phy receive with channel recvv -- ");
+
+	test_recvv_data.len = test_osdp_create_packet(0xe5, 0x05, reply_data, 1,
+						      test_recvv_data.buf,
+						      sizeof(test_recvv_data.buf));
+	test_recvv_data.calls = 0;
+
+	/* free space of the ring wraps; transport must get both regions */
+	rb->head = rb->tail = sizeof(rb->buffer) - 4;
+	p->channel.recvv = test_recvv_fn;
+	SET_FLAG(p, PD_FLAG_SKIP_SEQ_CHECK);
+	err = osdp_phy_check_packet(p);
+	CLEAR_FLAG(p, PD_FLAG_SKIP_SEQ_CHECK);
+	p->channel.recvv = NULL;
+	if (err) {
+		printf("check failed with error %d!\n", err);
+		return -1;
+	}
+	if (test_recvv_data.calls != 1 || test_recvv_data.iovcnt != 2) {
+		printf("expected one recvv call with 2 regions; got %d/%d\n",
+		       test_recvv_data.calls, test_recvv_data.iovcnt);
+		return -1;
+	}
+	if ((len = osdp_phy_decode_packet(p, &buf)) < 0) {
+		printf("decode failed!\n");
+		return -1;
+	}
+	CHECK_ARRAY(buf, len, expected);
+	printf("success!\n");
+	return 0;
+}
+
+static struct {
+	uint8_t buf[128];
+	int len;
+	int iovcnt;
+} test_sendv_data;
+
+static int test_sendv_fn(void *data, const struct osdp_iovec *iov, int iovcnt)
+{
+	int i, total = 0;
+
+	ARG_UNUSED(data);
+	test_sendv_data.iovcnt = iovcnt;
+	for (i = 0; i < iovcnt; i++) {
+		memcpy(test_sendv_data.buf + test_sendv_data.len,
+		       iov[i].buf, iov[i].len);
+		test_sendv_data.len += iov[i].len;
+		total += iov[i].len;
+	}
+	return total;
+}
+
+int test_phy_send_packet_gather(struct osdp *ctx)
+{
+	int i, len, err;
+	struct osdp_pd *p = GET_CURRENT_PD(ctx);
+	reset_pd_packet_state(p);
+	const uint8_t payload[] = "file chunk sent from app memory";
+	uint8_t head[] = { CMD_FILETRANSFER, 0x01, 0x02, 0x03 };
+	uint8_t buf[128], expected[128];
+	bool use_crc = ISSET_FLAG(p, PD_FLAG_CP_USE_CRC);
+
+	printf(SUB_1 "Testing phy send with an external payload -- ");
+
+	p->channel.sendv = test_sendv_fn;
+	for (i = 0; i < 2; i++) {
+		/* once with CRC and once with checksum */
+		SET_FLAG_V(p, PD_FLAG_CP_USE_CRC, i == 0);
+
+		/* reference: the same packet built entirely in one buffer */
+		memcpy(expected, head, sizeof(head));
+		memcpy(expected + sizeof(head), payload, sizeof(payload));
+		len = test_cp_build_and_send_packet(p, expected,
+			sizeof(head) + sizeof(payload), sizeof(expected));
+
+		test_sendv_data.len = 0;
+		err = osdp_phy_packet_init(p, buf, sizeof(buf));
+		memcpy(buf + err, head, sizeof(head));
+		osdp_phy_packet_set_payload(p, payload, sizeof(payload));
+		err = osdp_phy_send_packet(p, buf, err + sizeof(head),
+					   sizeof(buf));
+		if (err || test_sendv_data.iovcnt != 3) {
+			printf("send failed! err:%d iovcnt:%d\n", err,
+			       test_sendv_data.iovcnt);
+			err = -1;
+			goto out;
+		}
+		if (len < 0 || test_sendv_data.len != len ||
+		    memcmp(test_sendv_data.buf, expected, len) != 0) {
+			printf("gathered packet mismatch (%s)!\n",
+			       i == 0 ? "crc" : "checksum");
+			err = -1;
+			goto out;
+		}
+	}
+	printf("success!\n");
+	err = 0;
+out:
+	p->channel.sendv = NULL;
+	osdp_phy_state_reset(p, false);
+	SET_FLAG_V(p, PD_FLAG_CP_USE_CRC, use_crc);
+	return err;
+}
+
 int test_cp_phy_setup(struct test *t)
 {
 	/* mock application data */
@@ -859,6 +1255,13 @@ void run_cp_phy_tests(struct test *t)
 	DO_TEST(t, test_phy_packet_data_offset);
 	DO_TEST(t, test_phy_packet_different_commands);
 	DO_TEST(t, test_phy_state_reset_functionality);
+	DO_TEST(t, test_rb_views);
+	DO_TEST(t, test_phy_decode_packet_wrapped);
+	DO_TEST(t, test_phy_channel_recvv);
+	DO_TEST(t, test_phy_send_packet_gather);
+	DO_TEST(t, test_phy_resync_after_noise);
+	DO_TEST(t, test_crc16_engine);
+	DO_TEST(t, test_phy_check_packet_streaming);
 
 	printf(SUB_1 "cp_phy tests %s\n", t->failure == 0 ? "succeeded" : "failed");
 
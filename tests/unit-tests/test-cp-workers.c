@@ -0,0 +1,227 @@
+/*
+ * Copyright (c) 2025 Siddharth Chandrasekaran <sidcha.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <sched.h>
+
+#include <osdp.h>
+#include "test.h"
+
+#define TEST_WORKERS_NUM_PD    4
+#define TEST_WORKERS_CMDS      8
+
+struct test_workers_ctx {
+	osdp_t *cp_ctx;
+	osdp_t *pd_ctx;
+	int pd_runner;
+	volatile bool cmd_seen;
+	volatile int last_cmd_id;
+};
+
+static struct test_workers_ctx g_test_ctx;
+
+static int test_workers_command_callback(void *arg, struct osdp_cmd *cmd)
+{
+	struct test_workers_ctx *ctx = arg;
+
+	ctx->last_cmd_id = cmd->id;
+	ctx->cmd_seen = true;
+	return 0;
+}
+
+static bool wait_for_online(int timeout_sec)
+{
+	uint8_t status = 0;
+	int rc = 0;
+
+	while (rc++ < timeout_sec * 10) {
+		osdp_get_status_mask(g_test_ctx.cp_ctx, &status);
+		if (status & 1)
+			return true;
+		usleep(100 * 1000);
+	}
+	return false;
+}
+
+static bool wait_for_command(int expected_cmd_id, int timeout_sec)
+{
+	int rc = 0;
+
+	while (rc++ < timeout_sec * 10) {
+		if (g_test_ctx.cmd_seen &&
+		    g_test_ctx.last_cmd_id == expected_cmd_id)
+			return true;
+		usleep(100 * 1000);
+	}
+	return false;
+}
+
+static bool test_workers_led_command()
+{
+	struct osdp_cmd cmd = {
+		.id = OSDP_CMD_LED,
+		.led = {
+			.reader = 0,
+			.led_number = 0,
+			.permanent = {
+				.control_code = 1,
+				.on_count = 10,
+				.off_count = 10,
+				.on_color = OSDP_LED_COLOR_RED,
+				.off_color = OSDP_LED_COLOR_NONE,
+			},
+		},
+	};
+
+	printf(SUB_2 "testing LED command through worker\n");
+	g_test_ctx.cmd_seen = false;
+	if (osdp_cp_submit_command(g_test_ctx.cp_ctx, 0, &cmd)) {
+		printf(SUB_2 "failed to submit command\n");
+		return false;
+	}
+	return wait_for_command(OSDP_CMD_LED, 5);
+}
+
+static volatile int g_cmd_done[TEST_WORKERS_NUM_PD];
+
+/**
+ * Each PD is on a bus of its own so, with 2 workers, PDs 0 and 2 are in one
+ * group and PDs 1 and 3 are in the other. For every completed command, call
+ * a method that takes the lock of the next PD (which is in the other group).
+ * Both workers do this at the same time; they must not deadlock.
+ */
+static int test_workers_event_callback(void *arg, int pd,
+				       struct osdp_event *ev)
+{
+	struct test_cp_env *env = arg;
+	struct osdp_cmd_latency latency;
+
+	if (ev->type != OSDP_EVENT_NOTIFICATION ||
+	    ev->notif.type != OSDP_EVENT_NOTIFICATION_COMMAND ||
+	    ev->notif.arg0 != OSDP_CMD_BUZZER) {
+		return 0;
+	}
+	osdp_cp_get_cmd_latency(env->cp, (pd + 1) % TEST_WORKERS_NUM_PD,
+				OSDP_CMD_LATENCY_OTHER, &latency);
+	g_cmd_done[pd]++;
+	return 0;
+}
+
+static bool test_workers_multi_channel(struct test *t)
+{
+	int i, n, done;
+	int64_t start;
+	bool result = false;
+	const int bus[TEST_WORKERS_NUM_PD] = { 0, 1, 2, 3 };
+	struct test_cp_env env = {
+		.flags = OSDP_FLAG_ENABLE_NOTIFICATION,
+	};
+	struct osdp_cmd cmd = {
+		.id = OSDP_CMD_BUZZER,
+		.buzzer = { .control_code = 1 },
+	};
+
+	printf(SUB_2 "testing %d channels with event callbacks across groups\n",
+	       TEST_WORKERS_NUM_PD);
+
+	if (test_cp_env_setup(t, &env, TEST_WORKERS_NUM_PD, bus)) {
+		return false;
+	}
+	memset((void *)g_cmd_done, 0, sizeof(g_cmd_done));
+	osdp_cp_set_event_callback(env.cp, test_workers_event_callback, &env);
+	if (osdp_cp_start_workers(env.cp, 2)) {
+		printf(SUB_2 "failed to start workers\n");
+		goto out;
+	}
+
+	if (!test_cp_env_wait_online(&env, -1, 5000)) {
+		printf(SUB_2 "PDs failed to come online\n");
+		goto out;
+	}
+
+	for (i = 0; i < TEST_WORKERS_NUM_PD; i++) {
+		n = 0;
+		while (n < TEST_WORKERS_CMDS) {
+			if (osdp_cp_submit_command(env.cp, i, &cmd) == 0) {
+				n++;
+			} else {
+				sched_yield(); /* ring full; let it drain */
+			}
+		}
+	}
+
+	start = osdp_millis_now();
+	do {
+		test_cp_env_refresh(&env);
+		usleep(1000);
+		for (i = 0, done = 0; i < TEST_WORKERS_NUM_PD; i++) {
+			done += g_cmd_done[i];
+		}
+	} while (done < TEST_WORKERS_NUM_PD * TEST_WORKERS_CMDS &&
+		 osdp_millis_since(start) < 10000);
+
+	result = (done == TEST_WORKERS_NUM_PD * TEST_WORKERS_CMDS &&
+		  env.num_cmds == TEST_WORKERS_NUM_PD * TEST_WORKERS_CMDS);
+	if (!result) {
+		printf(SUB_2 "commands done:%d received:%d\n",
+		       done, env.num_cmds);
+	}
+out:
+	osdp_cp_stop_workers(env.cp);
+	test_cp_env_teardown(&env);
+	return result;
+}
+
+void run_cp_workers_tests(struct test *t)
+{
+	bool result;
+
+	printf("\nBegin CP worker tests\n");
+
+	memset(&g_test_ctx, 0, sizeof(g_test_ctx));
+	if (test_setup_devices(t, &g_test_ctx.cp_ctx, &g_test_ctx.pd_ctx)) {
+		printf(SUB_1 "Failed to setup devices!\n");
+		TEST_REPORT(t, false);
+		return;
+	}
+	osdp_pd_set_command_callback(g_test_ctx.pd_ctx,
+				     test_workers_command_callback,
+				     &g_test_ctx);
+
+	if (osdp_cp_start_workers(g_test_ctx.cp_ctx, 2)) {
+		printf(SUB_1 "CP workers not available; skipping\n");
+		osdp_cp_teardown(g_test_ctx.cp_ctx);
+		osdp_pd_teardown(g_test_ctx.pd_ctx);
+		return;
+	}
+
+	g_test_ctx.pd_runner = async_pd_runner_start(g_test_ctx.pd_ctx);
+	if (g_test_ctx.pd_runner < 0) {
+		printf(SUB_1 "Failed to create PD runner\n");
+		osdp_cp_teardown(g_test_ctx.cp_ctx);
+		osdp_pd_teardown(g_test_ctx.pd_ctx);
+		TEST_REPORT(t, false);
+		return;
+	}
+
+	result = wait_for_online(10);
+	if (!result)
+		printf(SUB_2 "PD failed to come online\n");
+	else
+		result = test_workers_led_command();
+
+	/* refresh is a no-op while workers are running */
+	osdp_cp_refresh(g_test_ctx.cp_ctx);
+
+	osdp_cp_stop_workers(g_test_ctx.cp_ctx);
+	async_pd_runner_stop(g_test_ctx.pd_runner);
+	osdp_cp_teardown(g_test_ctx.cp_ctx);
+	osdp_pd_teardown(g_test_ctx.pd_ctx);
+
+	result &= test_workers_multi_channel(t);
+	TEST_REPORT(t, result);
+
+	printf(SUB_1 "CP worker tests %s\n", result ? "succeeded" : "failed");
+}
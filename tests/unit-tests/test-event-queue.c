@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2025 Siddharth Chandrasekaran <sidcha.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <unistd.h>
+
+#include <osdp.h>
+#include "test.h"
+
+static const int g_ids[] = {
+	OSDP_CMD_OUTPUT, OSDP_CMD_LED, OSDP_CMD_BUZZER,
+	OSDP_CMD_TEXT, OSDP_CMD_COMSET, OSDP_CMD_MFG,
+};
+
+/**
+ * Queue a command of each ID in g_ids that expires before the CP gets to it;
+ * each one yields an expired notification. The PD is muted until a packet is
+ * in flight so that the CP is busy (waiting for the reply) while they expire.
+ */
+static bool test_expire_commands(struct test_cp_env *env)
+{
+	int i;
+	uint32_t tx;
+	int64_t start;
+	struct osdp_pd_stats stats;
+	struct osdp_cmd cmd = { .ttl_ms = 1 };
+
+	env->mute[0] = true;
+	osdp_get_pd_stats(env->cp, 0, &stats, false);
+	tx = stats.tx_packets;
+	start = osdp_millis_now();
+	while (stats.tx_packets == tx) {
+		if (osdp_millis_since(start) > 2000) {
+			env->mute[0] = false;
+			return false;
+		}
+		test_cp_env_refresh(env);
+		usleep(1000);
+		osdp_get_pd_stats(env->cp, 0, &stats, false);
+	}
+
+	for (i = 0; i < (int)ARRAY_SIZE(g_ids); i++) {
+		cmd.id = g_ids[i];
+		osdp_cp_submit_command(env->cp, 0, &cmd);
+	}
+	usleep(5 * 1000);
+	env->mute[0] = false;
+	test_cp_env_run(env, 300);
+	return true;
+}
+
+static bool test_drop_newest(struct test_cp_env *env)
+{
+	int i, n, depth;
+	uint32_t dropped;
+	struct osdp_cp_event events[8];
+
+	printf(SUB_2 "testing a full queue drops the newest events\n");
+
+	if (osdp_cp_get_events(env->cp, events, 8) != -1 ||
+	    osdp_cp_set_event_queue(env->cp, 3,
+				    OSDP_EVENT_OVERFLOW_DROP_NEWEST)) {
+		printf(SUB_2 "unexpected event queue setup result\n");
+		return false;
+	}
+
+	/* size is rounded up to 4; the last 2 of 6 events don't fit */
+	if (!test_expire_commands(env)) {
+		printf(SUB_2 "CP never sent a packet\n");
+		return false;
+	}
+	osdp_cp_get_event_queue_status(env->cp, &depth, &dropped);
+	n = osdp_cp_get_events(env->cp, events, 8);
+	if (depth != 4 || dropped != 2 || n != 4) {
+		printf(SUB_2 "depth:%d dropped:%u n:%d\n", depth, dropped, n);
+		return false;
+	}
+	for (i = 0; i < n; i++) {
+		if (events[i].pd != 0 ||
+		    events[i].event.type != OSDP_EVENT_NOTIFICATION ||
+		    events[i].event.notif.type !=
+			    OSDP_EVENT_NOTIFICATION_COMMAND_EXPIRED ||
+		    events[i].event.notif.arg0 != g_ids[i]) {
+			printf(SUB_2 "unexpected event at %d\n", i);
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool test_drop_oldest(struct test_cp_env *env)
+{
+	int n, depth;
+	uint32_t dropped;
+	struct osdp_cp_event events[8];
+
+	printf(SUB_2 "testing a full queue drops the oldest events\n");
+
+	osdp_cp_set_event_queue(env->cp, 4, OSDP_EVENT_OVERFLOW_DROP_OLDEST);
+	if (!test_expire_commands(env)) {
+		printf(SUB_2 "CP never sent a packet\n");
+		return false;
+	}
+	n = osdp_cp_get_events(env->cp, events, 3);
+	n += osdp_cp_get_events(env->cp, events + n, 8);
+	osdp_cp_get_event_queue_status(env->cp, &depth, &dropped);
+	if (n != 4 || depth != 0 || dropped != 2 ||
+	    events[0].event.notif.arg0 != g_ids[2] ||
+	    events[3].event.notif.arg0 != g_ids[5]) {
+		printf(SUB_2 "n:%d depth:%d dropped:%u\n", n, depth, dropped);
+		return false;
+	}
+	return true;
+}
+
+void run_event_queue_tests(struct test *t)
+{
+	bool result = false;
+	struct test_cp_env env = {
+		.flags = OSDP_FLAG_ENABLE_NOTIFICATION,
+	};
+
+	printf("\nBegin event queue tests\n");
+
+	if (test_cp_env_setup(t, &env, 1, NULL)) {
+		TEST_REPORT(t, false);
+		return;
+	}
+
+	if (!test_cp_env_wait_online(&env, 0, 5000)) {
+		printf(SUB_2 "PD failed to come online\n");
+	} else {
+		osdp_cp_set_poll_interval(env.cp, 0, 20, 50);
+		result = test_drop_newest(&env);
+		result &= test_drop_oldest(&env);
+	}
+
+	test_cp_env_teardown(&env);
+
+	printf(SUB_1 "event queue tests %s\n",
+	       result ? "succeeded" : "failed");
+	TEST_REPORT(t, result);
+}
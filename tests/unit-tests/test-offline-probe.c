@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2025 Siddharth Chandrasekaran <sidcha.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <osdp.h>
+#include "test.h"
+
+static volatile bool g_went_offline;
+
+static int test_probe_event_callback(void *arg, int pd, struct osdp_event *ev)
+{
+	ARG_UNUSED(arg);
+	ARG_UNUSED(pd);
+
+	if (ev->type == OSDP_EVENT_NOTIFICATION &&
+	    ev->notif.type == OSDP_EVENT_NOTIFICATION_PD_STATUS &&
+	    ev->notif.arg0 == 0) {
+		g_went_offline = true;
+	}
+	return 0;
+}
+
+/* Refresh until the CP has sent a command and given up on the reply */
+static bool wait_for_timeout(struct test_cp_env *env, int64_t *tx_at,
+			     int64_t *timeout_at, int timeout_ms)
+{
+	struct osdp_pd_stats stats;
+	int64_t start = osdp_millis_now();
+
+	*tx_at = 0;
+	while (osdp_millis_since(start) < timeout_ms) {
+		test_cp_env_refresh(env);
+		osdp_get_pd_stats(env->cp, 0, &stats, false);
+		if (*tx_at == 0 && stats.tx_packets) {
+			*tx_at = osdp_millis_now();
+		}
+		if (stats.timeouts) {
+			*timeout_at = osdp_millis_now();
+			return true;
+		}
+		usleep(1000);
+	}
+	return false;
+}
+
+static bool test_probe_after_offline(struct test_cp_env *env)
+{
+	int64_t start, tx_at, timeout_at;
+	struct osdp_pd_stats stats;
+
+	printf(SUB_2 "testing probes of an offline PD\n");
+
+	g_went_offline = false;
+	start = osdp_millis_now();
+	while (!g_went_offline && osdp_millis_since(start) < 20 * 1000) {
+		test_cp_env_refresh(env);
+		usleep(1000);
+	}
+	if (!g_went_offline) {
+		printf(SUB_2 "PD did not go offline\n");
+		return false;
+	}
+
+	/* first probe: after a jittered OSDP_PROBE_BACKOFF_MIN_MS */
+	start = osdp_millis_now();
+	osdp_get_pd_stats(env->cp, 0, &stats, true);
+	if (!wait_for_timeout(env, &tx_at, &timeout_at, 5000)) {
+		printf(SUB_2 "PD was not probed\n");
+		return false;
+	}
+	if (tx_at - start < OSDP_PROBE_BACKOFF_MIN_MS / 2 - 10 ||
+	    tx_at - start > OSDP_PROBE_BACKOFF_MIN_MS + 50) {
+		printf(SUB_2 "first probe after %d ms\n", (int)(tx_at - start));
+		return false;
+	}
+	/* a probe is a single command with a short timeout */
+	if (timeout_at - tx_at >= OSDP_RESP_TOUT_MS) {
+		printf(SUB_2 "probe took %d ms\n", (int)(timeout_at - tx_at));
+		return false;
+	}
+	osdp_get_pd_stats(env->cp, 0, &stats, true);
+	if (stats.tx_packets != 1 || stats.retries != 0) {
+		printf(SUB_2 "probe sent %u packets (%u retries)\n",
+		       stats.tx_packets, stats.retries);
+		return false;
+	}
+
+	/* second probe: the backoff has doubled */
+	start = timeout_at;
+	if (!wait_for_timeout(env, &tx_at, &timeout_at, 5000)) {
+		printf(SUB_2 "PD was not probed again\n");
+		return false;
+	}
+	if (tx_at - start < OSDP_PROBE_BACKOFF_MIN_MS - 10 ||
+	    tx_at - start > 2 * OSDP_PROBE_BACKOFF_MIN_MS + 50) {
+		printf(SUB_2 "second probe after %d ms\n",
+		       (int)(tx_at - start));
+		return false;
+	}
+	return true;
+}
+
+void run_offline_probe_tests(struct test *t)
+{
+	bool result;
+	struct test_cp_env env = {
+		.flags = OSDP_FLAG_ENABLE_NOTIFICATION,
+	};
+
+	printf("\nBegin offline probe tests\n");
+
+	env.mute[0] = true; /* nothing answers */
+	if (test_cp_env_setup(t, &env, 1, NULL)) {
+		TEST_REPORT(t, false);
+		return;
+	}
+	osdp_cp_set_event_callback(env.cp, test_probe_event_callback, NULL);
+
+	result = test_probe_after_offline(&env);
+
+	test_cp_env_teardown(&env);
+
+	printf(SUB_1 "offline probe tests %s\n",
+	       result ? "succeeded" : "failed");
+	TEST_REPORT(t, result);
+}
@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2025 Siddharth Chandrasekaran <sidcha.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <osdp.h>
+#include "test.h"
+
+#define TEST_REMOVE_THREADS  4
+
+static volatile bool g_stop;
+static volatile int g_calls;
+
+static bool test_wait_command(struct test_cp_env *env, int pd, int count)
+{
+	int64_t start = osdp_millis_now();
+
+	while (osdp_millis_since(start) < 2000) {
+		if (env->num_cmds >= count &&
+		    env->cmd_pd[count - 1] == pd) {
+			return true;
+		}
+		test_cp_env_refresh(env);
+		usleep(1000);
+	}
+	return false;
+}
+
+static bool test_remove_pd(struct test_cp_env *env)
+{
+	int owner;
+	struct osdp_cmd cmd = {
+		.id = OSDP_CMD_BUZZER,
+		.buzzer = { .control_code = 1 },
+	};
+
+	printf(SUB_2 "testing PD removal\n");
+
+	/* PD-1 shares bus 0 with PD-0; its pending commands are dropped */
+	osdp_cp_submit_command(env->cp, 1, &cmd);
+	osdp_cp_submit_command(env->cp, 1, &cmd);
+	if (test_cp_env_remove_pd(env, 1) != 0 || env->closed[0] != 0) {
+		printf(SUB_2 "failed to remove PD-1\n");
+		return false;
+	}
+	if (osdp_cp_remove_pd(env->cp, 1) == 0 ||
+	    osdp_cp_submit_command(env->cp, 1, &cmd) == 0 ||
+	    osdp_cp_get_channel_owner(env->cp, 1, &owner) == 0) {
+		printf(SUB_2 "removed PD offset still accepted\n");
+		return false;
+	}
+	osdp_cp_get_channel_owner(env->cp, 0, &owner);
+	if (owner == 1) {
+		printf(SUB_2 "removed PD still owns the channel\n");
+		return false;
+	}
+
+	/* the last PD on a channel closes it */
+	if (test_cp_env_remove_pd(env, 2) != 0 || env->closed[1] != 1) {
+		printf(SUB_2 "channel of PD-2 was not closed\n");
+		return false;
+	}
+
+	/* PD-0 carries on */
+	env->num_cmds = 0;
+	if (osdp_cp_submit_command(env->cp, 0, &cmd) != 0 ||
+	    !test_wait_command(env, 0, 1)) {
+		printf(SUB_2 "PD-0 stopped taking commands\n");
+		return false;
+	}
+	return true;
+}
+
+static bool test_add_pd(struct test_cp_env *env)
+{
+	int pd;
+	struct osdp_cmd cmd = {
+		.id = OSDP_CMD_BUZZER,
+		.buzzer = { .control_code = 1 },
+	};
+
+	printf(SUB_2 "testing PD addition\n");
+
+	/* re-provision the reader on bus 1; it gets the lowest free offset */
+	pd = test_cp_env_add_pd(env, 1);
+	if (pd != 1) {
+		printf(SUB_2 "new PD got offset %d\n", pd);
+		return false;
+	}
+	if (!test_cp_env_wait_online(env, -1, 5000)) {
+		printf(SUB_2 "PDs not online after add\n");
+		return false;
+	}
+	env->num_cmds = 0;
+	if (osdp_cp_submit_command(env->cp, 1, &cmd) != 0 ||
+	    !test_wait_command(env, 1, 1)) {
+		printf(SUB_2 "new PD did not get a command\n");
+		return false;
+	}
+	return true;
+}
+
+static void *test_remove_thread(void *arg)
+{
+	struct test_cp_env *env = arg;
+	struct osdp_pd_snapshot snapshot;
+	struct osdp_pd_stats stats;
+	struct osdp_cmd cmd = {
+		.id = OSDP_CMD_BUZZER,
+		.buzzer = { .control_code = 1 },
+	};
+
+	while (!g_stop) {
+		if (osdp_cp_submit_command(env->cp, 1, &cmd) == 0 ||
+		    osdp_cp_get_pd_snapshot(env->cp, 1, &snapshot) == 0 ||
+		    osdp_get_pd_stats(env->cp, 1, &stats, false) == 0) {
+			__atomic_add_fetch(&g_calls, 1, __ATOMIC_RELAXED);
+		}
+	}
+	return NULL;
+}
+
+static bool test_remove_in_use(struct test_cp_env *env)
+{
+	int i, rc;
+	pthread_t threads[TEST_REMOVE_THREADS];
+
+	printf(SUB_2 "testing PD removal while other threads use it\n");
+
+	g_stop = false;
+	g_calls = 0;
+	for (i = 0; i < TEST_REMOVE_THREADS; i++) {
+		pthread_create(&threads[i], NULL, test_remove_thread, env);
+	}
+	while (g_calls < 100) {
+		test_cp_env_refresh(env);
+	}
+	rc = test_cp_env_remove_pd(env, 1);
+	test_cp_env_run(env, 20);
+	g_stop = true;
+	for (i = 0; i < TEST_REMOVE_THREADS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	if (rc != 0 || osdp_cp_get_channel_owner(env->cp, 1, &i) == 0) {
+		printf(SUB_2 "PD-1 was not removed\n");
+		return false;
+	}
+	return true;
+}
+
+void run_pd_add_remove_tests(struct test *t)
+{
+	bool result = false, workers;
+	const int bus[3] = { 0, 0, 1 };
+	struct test_cp_env env = { 0 };
+
+	printf("\nBegin PD add/remove tests\n");
+
+	if (test_cp_env_setup(t, &env, 3, bus)) {
+		TEST_REPORT(t, false);
+		return;
+	}
+
+	/* PDs are added and removed under the workers when they are built */
+	workers = osdp_cp_start_workers(env.cp, 2) == 0;
+
+	if (!test_cp_env_wait_online(&env, -1, 5000)) {
+		printf(SUB_2 "PDs failed to come online\n");
+	} else {
+		/* removed offsets are expected to be refused; don't log each */
+		osdp_logger_init("osdp::cp", LOG_EMERG, NULL);
+		result = test_remove_pd(&env) &&
+			 test_add_pd(&env) &&
+			 test_remove_in_use(&env);
+		osdp_logger_init("osdp::cp", t->loglevel, NULL);
+	}
+
+	if (workers) {
+		osdp_cp_stop_workers(env.cp);
+	}
+	test_cp_env_teardown(&env);
+
+	printf(SUB_1 "PD add/remove tests %s\n",
+	       result ? "succeeded" : "failed");
+	TEST_REPORT(t, result);
+}
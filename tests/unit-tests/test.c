@@ -329,6 +329,311 @@ int test_setup_devices(struct test *t, osdp_t **cp, osdp_t **pd)
 	return 0;
 }
 
+static void test_pipe_push(struct test_pipe *p, const uint8_t *buf, int len)
+{
+	int i, next;
+
+	for (i = 0; i < len; i++) {
+		next = (p->head + 1) % TEST_ENV_PIPE_LEN;
+		if (next == p->tail)
+			break; /* full; the rest is lost on the wire */
+		p->buf[p->head] = buf[i];
+		p->head = next;
+	}
+}
+
+static int test_pipe_pop(struct test_pipe *p, uint8_t *buf, int len)
+{
+	int i;
+
+	for (i = 0; i < len && p->tail != p->head; i++) {
+		buf[i] = p->buf[p->tail];
+		p->tail = (p->tail + 1) % TEST_ENV_PIPE_LEN;
+	}
+	return i;
+}
+
+static int test_env_cp_send(void *data, uint8_t *buf, int len)
+{
+	struct test_env_ep *ep = data;
+	struct test_cp_env *env = ep->env;
+	int i;
+
+	pthread_mutex_lock(&env->lock);
+	for (i = 0; i < TEST_ENV_MAX_PD; i++) {
+		if (env->pd[i] && env->bus[i] == ep->idx && !env->mute[i])
+			test_pipe_push(&env->to_pd[i], buf, len);
+	}
+	pthread_mutex_unlock(&env->lock);
+	return len;
+}
+
+static int test_env_cp_receive(void *data, uint8_t *buf, int len)
+{
+	struct test_env_ep *ep = data;
+	int ret;
+
+	pthread_mutex_lock(&ep->env->lock);
+	ret = test_pipe_pop(&ep->env->to_cp[ep->idx], buf, len);
+	pthread_mutex_unlock(&ep->env->lock);
+	return ret;
+}
+
+static void test_env_cp_flush(void *data)
+{
+	struct test_env_ep *ep = data;
+
+	pthread_mutex_lock(&ep->env->lock);
+	ep->env->to_cp[ep->idx].tail = ep->env->to_cp[ep->idx].head;
+	pthread_mutex_unlock(&ep->env->lock);
+}
+
+static void test_env_cp_close(void *data)
+{
+	struct test_env_ep *ep = data;
+
+	ep->env->closed[ep->idx]++;
+}
+
+static int test_env_pd_send(void *data, uint8_t *buf, int len)
+{
+	struct test_env_ep *ep = data;
+	struct test_cp_env *env = ep->env;
+
+	pthread_mutex_lock(&env->lock);
+	if (!env->mute[ep->idx])
+		test_pipe_push(&env->to_cp[env->bus[ep->idx]], buf, len);
+	pthread_mutex_unlock(&env->lock);
+	return len;
+}
+
+static int test_env_pd_receive(void *data, uint8_t *buf, int len)
+{
+	struct test_env_ep *ep = data;
+	int ret;
+
+	pthread_mutex_lock(&ep->env->lock);
+	ret = test_pipe_pop(&ep->env->to_pd[ep->idx], buf, len);
+	pthread_mutex_unlock(&ep->env->lock);
+	return ret;
+}
+
+static void test_env_pd_flush(void *data)
+{
+	struct test_env_ep *ep = data;
+
+	pthread_mutex_lock(&ep->env->lock);
+	ep->env->to_pd[ep->idx].tail = ep->env->to_pd[ep->idx].head;
+	pthread_mutex_unlock(&ep->env->lock);
+}
+
+static int test_env_command_callback(void *arg, struct osdp_cmd *cmd)
+{
+	struct test_env_ep *ep = arg;
+	struct test_cp_env *env = ep->env;
+
+	if (env->num_cmds < TEST_ENV_CMD_LOG) {
+		env->cmd_pd[env->num_cmds] = ep->idx;
+		memcpy(&env->cmds[env->num_cmds], cmd, sizeof(*cmd));
+	}
+	env->num_cmds++;
+	return 0;
+}
+
+static void test_env_cp_info(struct test_cp_env *env, int bus, int address,
+			     osdp_pd_info_t *info)
+{
+	memset(info, 0, sizeof(*info));
+	info->address = address;
+	info->baud_rate = 115200;
+	info->flags = env->flags;
+	info->channel.id = bus + 1;
+	info->channel.data = &env->cp_ep[bus];
+	info->channel.send = test_env_cp_send;
+	info->channel.recv = test_env_cp_receive;
+	info->channel.flush = test_env_cp_flush;
+	info->channel.close = test_env_cp_close;
+	info->scbk = env->cp_scbk;
+}
+
+static osdp_t *test_env_pd_setup(struct test_cp_env *env, int pd, int address)
+{
+	osdp_t *ctx;
+	struct osdp_pd_cap cap[] = {
+		{ OSDP_PD_CAP_READER_AUDIBLE_OUTPUT, 1, 1 },
+		{ OSDP_PD_CAP_READER_LED_CONTROL, 1, 4 },
+		{ OSDP_PD_CAP_OUTPUT_CONTROL, 4, 1 },
+		{ OSDP_PD_CAP_READER_TEXT_OUTPUT, 1, 1 },
+		{ OSDP_PD_CAP_CONTACT_STATUS_MONITORING, 8, 1 },
+		{ -1, -1, -1 }
+	};
+	osdp_pd_info_t info = {
+		.address = address,
+		.baud_rate = 115200,
+		.id = {
+			.version = 1,
+			.model = 153,
+			.vendor_code = 31337,
+			.serial_number = 0x01020304,
+			.firmware_version = 0x0A0B0C0D,
+		},
+		.cap = cap,
+		.channel.data = &env->pd_ep[pd],
+		.channel.send = test_env_pd_send,
+		.channel.recv = test_env_pd_receive,
+		.channel.flush = test_env_pd_flush,
+		.scbk = env->pd_scbk,
+	};
+
+	ctx = osdp_pd_setup(&info);
+	if (ctx != NULL)
+		osdp_pd_set_command_callback(ctx, test_env_command_callback,
+					     &env->pd_ep[pd]);
+	return ctx;
+}
+
+int test_cp_env_setup(struct test *t, struct test_cp_env *env, int num_pd,
+		      const int *bus)
+{
+	int i;
+	osdp_pd_info_t info[TEST_ENV_MAX_PD];
+
+	if (num_pd > TEST_ENV_MAX_PD)
+		return -1;
+
+	osdp_logger_init("osdp", t->loglevel, NULL);
+	pthread_mutex_init(&env->lock, NULL);
+	for (i = 0; i < TEST_ENV_MAX_PD; i++) {
+		env->cp_ep[i].env = env;
+		env->cp_ep[i].idx = i;
+		env->pd_ep[i].env = env;
+		env->pd_ep[i].idx = i;
+	}
+
+	for (i = 0; i < num_pd; i++) {
+		env->bus[i] = bus ? bus[i] : i;
+		test_env_cp_info(env, env->bus[i], 101 + i, &info[i]);
+		env->pd[i] = test_env_pd_setup(env, i, 101 + i);
+		if (env->pd[i] == NULL) {
+			printf(SUB_1 "pd init failed!\n");
+			test_cp_env_teardown(env);
+			return -1;
+		}
+	}
+
+	env->cp = osdp_cp_setup(num_pd, info);
+	if (env->cp == NULL) {
+		printf(SUB_1 "cp init failed!\n");
+		test_cp_env_teardown(env);
+		return -1;
+	}
+	return 0;
+}
+
+/* Returns the offset that the new PD got; -1 on errors */
+int test_cp_env_add_pd(struct test_cp_env *env, int bus)
+{
+	static int address = 101 + TEST_ENV_MAX_PD; /* after the setup PDs */
+	int i, owner, pd = -1;
+	bool taken[TEST_ENV_MAX_PD];
+	osdp_pd_info_t info;
+
+	for (i = 0; i < TEST_ENV_MAX_PD; i++)
+		taken[i] = osdp_cp_get_channel_owner(env->cp, i, &owner) == 0;
+
+	address++;
+	test_env_cp_info(env, bus, address, &info);
+	if (osdp_cp_add_pd(env->cp, 1, &info))
+		return -1;
+
+	for (i = 0; i < TEST_ENV_MAX_PD && pd < 0; i++) {
+		if (!taken[i] &&
+		    osdp_cp_get_channel_owner(env->cp, i, &owner) == 0)
+			pd = i;
+	}
+	if (pd < 0)
+		return -1;
+
+	pthread_mutex_lock(&env->lock);
+	env->bus[pd] = bus;
+	env->to_pd[pd].head = env->to_pd[pd].tail = 0;
+	pthread_mutex_unlock(&env->lock);
+	env->pd[pd] = test_env_pd_setup(env, pd, address);
+	return env->pd[pd] ? pd : -1;
+}
+
+int test_cp_env_remove_pd(struct test_cp_env *env, int pd)
+{
+	osdp_t *ctx;
+
+	if (osdp_cp_remove_pd(env->cp, pd))
+		return -1;
+	pthread_mutex_lock(&env->lock);
+	ctx = env->pd[pd];
+	env->pd[pd] = NULL;
+	pthread_mutex_unlock(&env->lock);
+	if (ctx)
+		osdp_pd_teardown(ctx);
+	return 0;
+}
+
+/* One refresh of the CP (a no-op with workers) and of each PD */
+void test_cp_env_refresh(struct test_cp_env *env)
+{
+	int i;
+
+	osdp_cp_refresh(env->cp);
+	for (i = 0; i < TEST_ENV_MAX_PD; i++) {
+		if (env->pd[i])
+			osdp_pd_refresh(env->pd[i]);
+	}
+}
+
+void test_cp_env_run(struct test_cp_env *env, int ms)
+{
+	int64_t start = osdp_millis_now();
+
+	while (osdp_millis_since(start) < ms) {
+		test_cp_env_refresh(env);
+		usleep(1000);
+	}
+}
+
+/* Wait for PD @pd (or all PDs that can answer, if -1) to be online */
+bool test_cp_env_wait_online(struct test_cp_env *env, int pd, int timeout_ms)
+{
+	int i;
+	uint8_t mask, want = 0;
+	int64_t start = osdp_millis_now();
+
+	for (i = 0; i < TEST_ENV_MAX_PD; i++) {
+		if ((pd < 0 || pd == i) && env->pd[i] && !env->mute[i])
+			want |= 1 << i;
+	}
+	while (osdp_millis_since(start) < timeout_ms) {
+		test_cp_env_refresh(env);
+		osdp_get_status_mask(env->cp, &mask);
+		if ((mask & want) == want)
+			return true;
+		usleep(1000);
+	}
+	return false;
+}
+
+void test_cp_env_teardown(struct test_cp_env *env)
+{
+	int i;
+
+	if (env->cp)
+		osdp_cp_teardown(env->cp);
+	for (i = 0; i < TEST_ENV_MAX_PD; i++) {
+		if (env->pd[i])
+			osdp_pd_teardown(env->pd[i]);
+	}
+	pthread_mutex_destroy(&env->lock);
+	memset(env, 0, sizeof(*env));
+}
+
 void test_start(struct test *t, int log_level)
 {
 	printf("\n");
@@ -382,6 +687,24 @@ int main(int argc, char *argv[])
 
 	run_hotplug_tests(&t);
 
+	run_cp_workers_tests(&t);
+
+	run_channel_owner_tests(&t);
+
+	run_offline_probe_tests(&t);
+
+	run_cmd_pool_tests(&t);
+
+	run_cmd_priority_tests(&t);
+
+	run_cmd_coalesce_tests(&t);
+
+	run_cmd_submit_tests(&t);
+
+	run_event_queue_tests(&t);
+
+	run_pd_add_remove_tests(&t);
+
 	run_async_fuzz_tests(&t);
 
 	rc = test_end(&t);
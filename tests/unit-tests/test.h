@@ -11,6 +11,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <pthread.h>
 #include "osdp_common.h"
 
 #define SUB_1 "    -- "
@@ -55,6 +56,56 @@ struct test {
 	void *mock_data;
 };
 
+#define TEST_ENV_MAX_PD   8
+#define TEST_ENV_PIPE_LEN 1024
+#define TEST_ENV_CMD_LOG  32
+
+struct test_cp_env;
+
+struct test_pipe {
+	uint8_t buf[TEST_ENV_PIPE_LEN];
+	int head;
+	int tail;
+};
+
+/* Channel data of one end of a mock bus */
+struct test_env_ep {
+	struct test_cp_env *env;
+	int idx; /* bus number on the CP end; PD offset on the PD end */
+};
+
+/**
+ * A CP whose PDs are answered by real PD contexts over mock buses, so tests
+ * can drive the CP through real refresh cycles. Bytes that the CP sends on a
+ * bus reach every PD on that bus; PDs only answer to their own address.
+ *
+ * Zero the struct and fill in the optional config members before calling
+ * test_cp_env_setup().
+ */
+struct test_cp_env {
+	/* config (optional) */
+	uint32_t flags;                 /* osdp_pd_info_t::flags of CP PDs */
+	const uint8_t *cp_scbk;         /* SCBK of CP PDs; NULL: no SC */
+	const uint8_t *pd_scbk;         /* SCBK of the PDs */
+
+	osdp_t *cp;
+	osdp_t *pd[TEST_ENV_MAX_PD];    /* PD end of each CP PD; NULL: none */
+	int bus[TEST_ENV_MAX_PD];       /* Bus of each PD */
+	volatile bool mute[TEST_ENV_MAX_PD]; /* Drop all bytes to/from PD */
+	int closed[TEST_ENV_MAX_PD];    /* channel close() calls per bus */
+
+	/* Commands received by the PDs, in order */
+	int num_cmds;
+	int cmd_pd[TEST_ENV_CMD_LOG];
+	struct osdp_cmd cmds[TEST_ENV_CMD_LOG];
+
+	pthread_mutex_t lock;
+	struct test_pipe to_cp[TEST_ENV_MAX_PD]; /* one per bus */
+	struct test_pipe to_pd[TEST_ENV_MAX_PD]; /* one per PD */
+	struct test_env_ep cp_ep[TEST_ENV_MAX_PD];
+	struct test_env_ep pd_ep[TEST_ENV_MAX_PD];
+};
+
 /* Helpers */
 int test_setup_devices(struct test *t, osdp_t **cp, osdp_t **pd);
 int async_runner_start(osdp_t *ctx, void (*fn)(osdp_t *));
@@ -63,6 +114,14 @@ int async_cp_runner_start(osdp_t *cp_ctx);
 int async_pd_runner_start(osdp_t *pd_ctx);
 int async_cp_runner_stop(int work_id);
 int async_pd_runner_stop(int work_id);
+int test_cp_env_setup(struct test *t, struct test_cp_env *env, int num_pd,
+		      const int *bus);
+int test_cp_env_add_pd(struct test_cp_env *env, int bus);
+int test_cp_env_remove_pd(struct test_cp_env *env, int pd);
+void test_cp_env_refresh(struct test_cp_env *env);
+void test_cp_env_run(struct test_cp_env *env, int ms);
+bool test_cp_env_wait_online(struct test_cp_env *env, int pd, int timeout_ms);
+void test_cp_env_teardown(struct test_cp_env *env);
 void enable_line_noise();
 void disable_line_noise();
 void print_line_noise_stats();
@@ -74,6 +133,15 @@ void run_file_tx_tests(struct test *t, bool line_noise);
 void run_command_tests(struct test *t);
 void run_event_tests(struct test *t);
 void run_hotplug_tests(struct test *t);
+void run_cp_workers_tests(struct test *t);
+void run_channel_owner_tests(struct test *t);
+void run_offline_probe_tests(struct test *t);
+void run_cmd_pool_tests(struct test *t);
+void run_cmd_priority_tests(struct test *t);
+void run_cmd_coalesce_tests(struct test *t);
+void run_cmd_submit_tests(struct test *t);
+void run_event_queue_tests(struct test *t);
+void run_pd_add_remove_tests(struct test *t);
 void run_async_fuzz_tests(struct test *t);
 
 #endif